@@ -0,0 +1,370 @@
+#include "catalog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "helper-pool.h"
+#include "mem-budget.h"
+
+#define MAX_PATH 4096
+
+static int grow_entries(Catalog *cat) {
+    int cap = cat->cap ? cat->cap * 2 : 1024;
+    size_t *name_off = realloc(cat->name_off, cap * sizeof(size_t));
+    if (name_off) {
+        cat->name_off = name_off;
+    }
+    long long *size = realloc(cat->size, cap * sizeof(long long));
+    if (size) {
+        cat->size = size;
+    }
+    time_t *mtime = realloc(cat->mtime, cap * sizeof(time_t));
+    if (mtime) {
+        cat->mtime = mtime;
+    }
+    if (!name_off || !size || !mtime) {
+        return 0;
+    }
+    cat->cap = cap;
+    return 1;
+}
+
+// Copia o nome para o fim da arena; devolve o offset ou -1
+static long intern_name(Catalog *cat, const char *name) {
+    size_t len = strlen(name) + 1;
+    if (cat->names_len + len > cat->names_cap) {
+        size_t cap = cat->names_cap ? cat->names_cap * 2 : 64 * 1024;
+        while (cat->names_len + len > cap) {
+            cap *= 2;
+        }
+        char *names = realloc(cat->names, cap);
+        if (!names) {
+            return -1;
+        }
+        cat->names = names;
+        cat->names_cap = cap;
+    }
+    memcpy(cat->names + cat->names_len, name, len);
+    cat->names_len += len;
+    return cat->names_len - len;
+}
+
+
+/******************************************************************************
+ * catalog_scan()
+ *
+ * Arguments: dir_path - directory to list
+ * Returns: catalog with every .jpeg in the directory, or NULL if the
+ *          directory can't be opened
+ * Side-Effects: allocates memory
+ *
+ *****************************************************************************/
+Catalog *catalog_scan(const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        return NULL;
+    }
+    Catalog *cat = calloc(1, sizeof(Catalog));
+    if (!cat) {
+        closedir(dir);
+        return NULL;
+    }
+
+    int dir_fd = dirfd(dir);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int len = strlen(entry->d_name);
+        if (len <= 5 || strcmp(entry->d_name + len - 5, ".jpeg") != 0) {
+            continue;
+        }
+        if (cat->count == cat->cap && !grow_entries(cat)) {
+            fprintf(stderr, "Aviso: sem memoria, lista de %s ficou com %d imagens\n", dir_path, cat->count);
+            break;
+        }
+        long off = intern_name(cat, entry->d_name);
+        if (off < 0) {
+            fprintf(stderr, "Aviso: sem memoria, lista de %s ficou com %d imagens\n", dir_path, cat->count);
+            break;
+        }
+
+        // relativo a pasta aberta: sem construir o caminho de cada ficheiro
+        struct stat st;
+        int i = cat->count++;
+        cat->name_off[i] = off;
+        if (fstatat(dir_fd, entry->d_name, &st, 0) == 0) {
+            cat->size[i] = st.st_size;
+            cat->mtime[i] = st.st_mtime;
+        } else {
+            cat->size[i] = 0;
+            cat->mtime[i] = 0;
+        }
+    }
+    closedir(dir);
+
+    cat->order = malloc((cat->count ? cat->count : 1) * sizeof(int));
+    if (!cat->order) {
+        catalog_free(cat);
+        return NULL;
+    }
+    for (int i = 0; i < cat->count; i++) {
+        cat->order[i] = i;
+    }
+    return cat;
+}
+
+
+// ---------------------------------------------------------------- tamanho
+
+// LSD radix de 8 bits sobre os indices; cada passagem e estavel
+static void radix_sort_by_size(Catalog *cat) {
+    int n = cat->count;
+    int *tmp = malloc(n * sizeof(int));
+    if (!tmp) {
+        return;
+    }
+    // histogramas de todos os bytes numa so leitura das chaves
+    int bytes = sizeof(unsigned long long);
+    int (*hist)[256] = calloc(bytes, sizeof(*hist));
+    if (!hist) {
+        free(tmp);
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        unsigned long long key = cat->size[i];
+        for (int b = 0; b < bytes; b++) {
+            hist[b][(key >> (8 * b)) & 0xFF]++;
+        }
+    }
+
+    int *src = cat->order, *dst = tmp;
+    for (int b = 0; b < bytes; b++) {
+        // todas as chaves com o mesmo byte: a passagem nao muda nada
+        int skip = 0;
+        for (int d = 0; d < 256; d++) {
+            if (hist[b][d] == n) {
+                skip = 1;
+            }
+        }
+        if (skip) {
+            continue;
+        }
+        int pos[256];
+        int sum = 0;
+        for (int d = 0; d < 256; d++) {
+            pos[d] = sum;
+            sum += hist[b][d];
+        }
+        for (int i = 0; i < n; i++) {
+            unsigned long long key = cat->size[src[i]];
+            dst[pos[(key >> (8 * b)) & 0xFF]++] = src[i];
+        }
+        int *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != cat->order) {
+        memcpy(cat->order, src, n * sizeof(int));
+    }
+    free(hist);
+    free(tmp);
+}
+
+
+// ---------------------------------------------------------------- nome
+
+typedef struct {
+    Catalog *cat;
+    int *src, *dst;
+    int num_parts;
+    int width;                    // partes em cada sequencia ja ordenada
+} NameSort;
+
+static int part_start(const NameSort *ns, int part) {
+    if (part >= ns->num_parts) {
+        return ns->cat->count;
+    }
+    return (int)((long long)ns->cat->count * part / ns->num_parts);
+}
+
+static int name_less_equal(const Catalog *cat, int a, int b) {
+    return strcmp(CATALOG_NAME(cat, a), CATALOG_NAME(cat, b)) <= 0;
+}
+
+// Junta src[lo, mid) e src[mid, hi) em dst[lo, hi)
+static void merge(const Catalog *cat, const int *src, int *dst, int lo, int mid, int hi) {
+    int i = lo, j = mid, k = lo;
+    while (i < mid && j < hi) {
+        dst[k++] = name_less_equal(cat, src[i], src[j]) ? src[i++] : src[j++];
+    }
+    while (i < mid) {
+        dst[k++] = src[i++];
+    }
+    while (j < hi) {
+        dst[k++] = src[j++];
+    }
+}
+
+// Merge sort de baixo para cima de uma parte; o resultado fica em src
+static void sort_part(void *arg, int part) {
+    NameSort *ns = arg;
+    int lo = part_start(ns, part), hi = part_start(ns, part + 1);
+    int *a = ns->src, *b = ns->dst;
+
+    for (int width = 1; width < hi - lo; width *= 2) {
+        for (int i = lo; i < hi; i += 2 * width) {
+            int mid = i + width < hi ? i + width : hi;
+            int end = i + 2 * width < hi ? i + 2 * width : hi;
+            merge(ns->cat, a, b, i, mid, end);
+        }
+        int *t = a;
+        a = b;
+        b = t;
+    }
+    if (a != ns->src) {
+        memcpy(ns->src + lo, a + lo, (hi - lo) * sizeof(int));
+    }
+}
+
+// Junta o par de sequencias p (cada uma com width partes)
+static void merge_pair(void *arg, int p) {
+    NameSort *ns = arg;
+    int lo = part_start(ns, 2 * p * ns->width);
+    int mid = part_start(ns, (2 * p + 1) * ns->width);
+    int hi = part_start(ns, (2 * p + 2) * ns->width);
+    merge(ns->cat, ns->src, ns->dst, lo, mid, hi);
+}
+
+static void merge_sort_by_name(Catalog *cat, int num_threads) {
+    int n = cat->count;
+    int *tmp = malloc(n * sizeof(int));
+    if (!tmp) {
+        return;
+    }
+    NameSort ns = { cat, cat->order, tmp, 1, 1 };
+    ns.num_parts = num_threads;
+    if (ns.num_parts > n / CATALOG_MIN_PART) {
+        ns.num_parts = n / CATALOG_MIN_PART;
+    }
+    if (ns.num_parts > HELPER_MAX_THREADS + 1) {
+        ns.num_parts = HELPER_MAX_THREADS + 1;
+    }
+    if (ns.num_parts < 1) {
+        ns.num_parts = 1;
+    }
+    if (ns.num_parts > 1) {
+        helper_pool_start(ns.num_parts - 1);
+    }
+
+    helper_pool_run(sort_part, &ns, ns.num_parts);
+
+    // cada ronda junta sequencias vizinhas duas a duas, em paralelo
+    for (ns.width = 1; ns.width < ns.num_parts; ns.width *= 2) {
+        int pairs = (ns.num_parts + 2 * ns.width - 1) / (2 * ns.width);
+        helper_pool_run(merge_pair, &ns, pairs);
+        int *t = ns.src;
+        ns.src = ns.dst;
+        ns.dst = t;
+    }
+    if (ns.src != cat->order) {
+        memcpy(cat->order, ns.src, n * sizeof(int));
+    }
+    free(tmp);
+}
+
+
+/******************************************************************************
+ * catalog_sort()
+ *
+ * Arguments: cat - catalog
+ *            key - CATALOG_BY_NAME or CATALOG_BY_SIZE (ascending)
+ *            num_threads - threads that may be used
+ * Returns: none
+ * Side-Effects: reorders cat->order
+ *
+ *****************************************************************************/
+void catalog_sort(Catalog *cat, int key, int num_threads) {
+    if (cat->count < 2) {
+        return;
+    }
+    if (key == CATALOG_BY_SIZE) {
+        radix_sort_by_size(cat);
+    } else {
+        merge_sort_by_name(cat, num_threads);
+    }
+}
+
+
+// ---------------------------------------------------------------- custo
+
+typedef struct {
+    Catalog *cat;
+    const char *dir_path;
+    int num_parts;
+} CostJob;
+
+static void predict_part(void *arg, int part) {
+    CostJob *job = arg;
+    int lo = (int)((long long)job->cat->count * part / job->num_parts);
+    int hi = (int)((long long)job->cat->count * (part + 1) / job->num_parts);
+    for (int i = lo; i < hi; i++) {
+        char path[MAX_PATH];
+        snprintf(path, MAX_PATH, "%s/%s", job->dir_path, CATALOG_NAME(job->cat, i));
+        job->cat->cost[i] = mem_predict_bytes(path);
+    }
+}
+
+
+/******************************************************************************
+ * catalog_predict_costs()
+ *
+ * Arguments: cat - catalog
+ *            dir_path - directory given to catalog_scan()
+ *            num_threads - threads that may be used
+ * Returns: none
+ * Side-Effects: fills cat->cost reading only the JPEG headers
+ *
+ *****************************************************************************/
+void catalog_predict_costs(Catalog *cat, const char *dir_path, int num_threads) {
+    if (!cat->cost) {
+        cat->cost = calloc(cat->count ? cat->count : 1, sizeof(long long));
+        if (!cat->cost) {
+            return;
+        }
+    }
+    // sobretudo espera pelo disco: uma parte por thread
+    CostJob job = { cat, dir_path, num_threads };
+    if (job.num_parts > HELPER_MAX_THREADS + 1) {
+        job.num_parts = HELPER_MAX_THREADS + 1;
+    }
+    if (job.num_parts > cat->count) {
+        job.num_parts = cat->count;
+    }
+    if (job.num_parts > 1) {
+        helper_pool_start(job.num_parts - 1);
+    }
+    helper_pool_run(predict_part, &job, job.num_parts);
+}
+
+
+/******************************************************************************
+ * catalog_free()
+ *
+ * Arguments: cat - catalog
+ * Returns: none
+ * Side-Effects: frees the catalog and its arrays
+ *
+ *****************************************************************************/
+void catalog_free(Catalog *cat) {
+    if (!cat) {
+        return;
+    }
+    free(cat->names);
+    free(cat->name_off);
+    free(cat->size);
+    free(cat->mtime);
+    free(cat->cost);
+    free(cat->order);
+    free(cat);
+}
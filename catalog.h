@@ -0,0 +1,83 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define CATALOG_BY_NAME 0
+#define CATALOG_BY_SIZE 1
+#define CATALOG_MIN_PART 4096     // entradas minimas por parte ordenada em paralelo
+
+// Lista das imagens de uma pasta: os nomes ficam todos numa so arena e os
+// atributos em arrays separados (um por campo), indexados pela entrada.
+// A ordem de processamento e um array de indices, por isso ordenar nunca
+// move os nomes.
+typedef struct {
+    char *names;                  // arena: nomes terminados em '\0'
+    size_t names_len, names_cap;
+    size_t *name_off;             // inicio do nome de cada entrada na arena
+    long long *size;              // bytes do ficheiro
+    time_t *mtime;
+    long long *cost;              // memoria prevista (NULL ate catalog_predict_costs)
+    int *order;                   // entradas pela ordem escolhida
+    int count, cap;
+} Catalog;
+
+// Nome da entrada i (i e uma entrada, nao uma posicao em order)
+#define CATALOG_NAME(c, i) ((c)->names + (c)->name_off[i])
+
+
+/******************************************************************************
+ * catalog_scan()
+ *
+ * Arguments: dir_path - directory to list
+ * Returns: catalog with every .jpeg in the directory, or NULL if the
+ *          directory can't be opened
+ * Side-Effects: allocates memory
+ *
+ * Description: sizes and modification times come from fstatat() on the
+ *              open directory; order starts in directory order
+ *
+ *****************************************************************************/
+Catalog *catalog_scan(const char *dir_path);
+
+/******************************************************************************
+ * catalog_sort()
+ *
+ * Arguments: cat - catalog
+ *            key - CATALOG_BY_NAME or CATALOG_BY_SIZE (ascending)
+ *            num_threads - threads that may be used
+ * Returns: none
+ * Side-Effects: reorders cat->order
+ *
+ * Description: by size it is an LSD radix sort of the indices (stable,
+ *              passes whose byte is the same in every key are skipped);
+ *              by name the indices are split in parts merge sorted by the
+ *              helper threads and then merged two by two in parallel
+ *
+ *****************************************************************************/
+void catalog_sort(Catalog *cat, int key, int num_threads);
+
+/******************************************************************************
+ * catalog_predict_costs()
+ *
+ * Arguments: cat - catalog
+ *            dir_path - directory given to catalog_scan()
+ *            num_threads - threads that may be used
+ * Returns: none
+ * Side-Effects: fills cat->cost reading only the JPEG headers
+ *
+ *****************************************************************************/
+void catalog_predict_costs(Catalog *cat, const char *dir_path, int num_threads);
+
+/******************************************************************************
+ * catalog_free()
+ *
+ * Arguments: cat - catalog
+ * Returns: none
+ * Side-Effects: frees the catalog and its arrays
+ *
+ *****************************************************************************/
+void catalog_free(Catalog *cat);
+
+#endif
@@ -0,0 +1,268 @@
+#include "dir-watch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+
+#ifdef __linux__
+
+static long elapsed_ms(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void *find_tag(DirWatcher *w, int wd) {
+    void *tag = NULL;
+    pthread_mutex_lock(&w->mutex);
+    for (int i = 0; i < w->num_dirs; i++) {
+        if (w->dirs[i].wd == wd) {
+            tag = w->dirs[i].tag;
+        }
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return tag;
+}
+
+// Junta a chegada a rajada; o mesmo ficheiro so entra uma vez
+static void add_arrival(DirWatcher *w, void *tag, const char *name, const struct timespec *now) {
+    for (int i = 0; i < w->num_pending; i++) {
+        if (w->pending[i].tag == tag && strcmp(w->pending[i].filename, name) == 0) {
+            pthread_mutex_lock(&w->mutex);
+            w->duplicates++;
+            pthread_mutex_unlock(&w->mutex);
+            return;
+        }
+    }
+    WatchArrival *a = &w->pending[w->num_pending++];
+    a->tag = tag;
+    strncpy(a->filename, name, sizeof(a->filename) - 1);
+    a->filename[sizeof(a->filename) - 1] = '\0';
+    a->arrival = *now;
+}
+
+static void flush_burst(DirWatcher *w) {
+    if (w->num_pending == 0) {
+        return;
+    }
+    pthread_mutex_lock(&w->mutex);
+    w->bursts++;
+    pthread_mutex_unlock(&w->mutex);
+    w->fn(w->ctx, w->pending, w->num_pending);
+    w->num_pending = 0;
+}
+
+static int is_jpeg(const char *name) {
+    int len = strlen(name);
+    return len > 5 && strcmp(name + len - 5, ".jpeg") == 0;
+}
+
+static void *watch_thread(void *arg) {
+    DirWatcher *w = arg;
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        int timeout = -1;
+        if (w->num_pending > 0) {
+            long waited = elapsed_ms(&w->pending[0].arrival);
+            timeout = WATCH_MAX_DELAY_MS - waited;
+            if (timeout > WATCH_COALESCE_MS) {
+                timeout = WATCH_COALESCE_MS;
+            }
+            if (timeout < 0) {
+                timeout = 0;
+            }
+        }
+
+        struct pollfd fds[2] = { { w->fd, POLLIN, 0 }, { w->wake[0], POLLIN, 0 } };
+        int r = poll(fds, 2, timeout);
+        if (r < 0) {
+            continue;
+        }
+        if (fds[1].revents) {
+            break;                // dir_watch_stop()
+        }
+        if (r == 0) {
+            flush_burst(w);       // acabou a rajada
+            continue;
+        }
+
+        ssize_t len = read(w->fd, buf, sizeof(buf));
+        if (len <= 0) {
+            continue;
+        }
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                fprintf(stderr, "Aviso: fila do inotify cheia, perderam-se chegadas\n");
+                continue;
+            }
+            if (!(ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) || ev->len == 0 || !is_jpeg(ev->name)) {
+                continue;
+            }
+            void *tag = find_tag(w, ev->wd);
+            if (!tag) {
+                continue;         // diretoria ja deixou de ser vigiada
+            }
+            pthread_mutex_lock(&w->mutex);
+            w->events++;
+            pthread_mutex_unlock(&w->mutex);
+
+            add_arrival(w, tag, ev->name, &now);
+            if (w->num_pending == WATCH_MAX_BURST) {
+                flush_burst(w);
+            }
+        }
+        if (w->num_pending > 0 && elapsed_ms(&w->pending[0].arrival) >= WATCH_MAX_DELAY_MS) {
+            flush_burst(w);
+        }
+    }
+    flush_burst(w);
+    return NULL;
+}
+
+
+/******************************************************************************
+ * dir_watch_start()
+ *
+ * Arguments: fn - function called with every burst of arrivals
+ *            ctx - first argument of fn
+ * Returns: watcher, or NULL if inotify is not available
+ * Side-Effects: starts the watcher thread
+ *
+ *****************************************************************************/
+DirWatcher *dir_watch_start(watch_fn fn, void *ctx) {
+    DirWatcher *w = calloc(1, sizeof(DirWatcher));
+    if (!w) {
+        return NULL;
+    }
+    w->pending = malloc(WATCH_MAX_BURST * sizeof(WatchArrival));
+    w->fd = inotify_init1(IN_CLOEXEC);
+    if (!w->pending || w->fd < 0 || pipe(w->wake) != 0) {
+        perror("Erro ao iniciar o inotify");
+        if (w->fd >= 0) {
+            close(w->fd);
+        }
+        free(w->pending);
+        free(w);
+        return NULL;
+    }
+    w->fn = fn;
+    w->ctx = ctx;
+    pthread_mutex_init(&w->mutex, NULL);
+    pthread_create(&w->thread, NULL, watch_thread, w);
+    return w;
+}
+
+
+/******************************************************************************
+ * dir_watch_add()
+ *
+ * Arguments: w - watcher
+ *            dir - directory to watch
+ *            tag - value passed back with its arrivals
+ * Returns: (bool) 1 in case of success, 0 in case of failure
+ * Side-Effects: adds an inotify watch
+ *
+ *****************************************************************************/
+int dir_watch_add(DirWatcher *w, const char *dir, void *tag) {
+    pthread_mutex_lock(&w->mutex);
+    if (w->num_dirs == WATCH_MAX_DIRS) {
+        pthread_mutex_unlock(&w->mutex);
+        return 0;
+    }
+    int wd = inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd >= 0) {
+        w->dirs[w->num_dirs].wd = wd;
+        w->dirs[w->num_dirs].tag = tag;
+        w->num_dirs++;
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return wd >= 0;
+}
+
+
+/******************************************************************************
+ * dir_watch_remove()
+ *
+ * Arguments: w - watcher
+ *            tag - value given to dir_watch_add()
+ * Returns: (bool) 1 if it was being watched
+ * Side-Effects: removes the inotify watch
+ *
+ *****************************************************************************/
+int dir_watch_remove(DirWatcher *w, void *tag) {
+    int found = 0;
+    pthread_mutex_lock(&w->mutex);
+    for (int i = 0; i < w->num_dirs; i++) {
+        if (w->dirs[i].tag == tag) {
+            inotify_rm_watch(w->fd, w->dirs[i].wd);
+            w->dirs[i] = w->dirs[--w->num_dirs];
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return found;
+}
+
+
+/******************************************************************************
+ * dir_watch_stop()
+ *
+ * Arguments: w - watcher
+ * Returns: none
+ * Side-Effects: delivers the last burst, stops the thread and frees w
+ *
+ *****************************************************************************/
+void dir_watch_stop(DirWatcher *w) {
+    if (write(w->wake[1], "q", 1) != 1) {
+        perror("Erro ao parar o inotify");
+    }
+    pthread_join(w->thread, NULL);
+    close(w->fd);
+    close(w->wake[0]);
+    close(w->wake[1]);
+    free(w->pending);
+    pthread_mutex_destroy(&w->mutex);
+    free(w);
+}
+
+#else
+
+// Sem inotify (fora do Linux) o WATCH nao esta disponivel
+DirWatcher *dir_watch_start(watch_fn fn, void *ctx) {
+    (void)fn;
+    (void)ctx;
+    return NULL;
+}
+
+int dir_watch_add(DirWatcher *w, const char *dir, void *tag) {
+    (void)w;
+    (void)dir;
+    (void)tag;
+    return 0;
+}
+
+int dir_watch_remove(DirWatcher *w, void *tag) {
+    (void)w;
+    (void)tag;
+    return 0;
+}
+
+void dir_watch_stop(DirWatcher *w) {
+    (void)w;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef DIR_WATCH_H
+#define DIR_WATCH_H
+
+#include <pthread.h>
+#include <time.h>
+
+#define WATCH_MAX_DIRS 64
+#define WATCH_COALESCE_MS 20      // rajada acaba apos 20ms sem eventos
+#define WATCH_MAX_DELAY_MS 100    // ... ou 100ms depois do primeiro
+#define WATCH_MAX_BURST 512       // ... ou com 512 ficheiros
+
+// Ficheiro acabado de chegar a uma diretoria vigiada
+typedef struct {
+    void *tag;                    // o que foi dado a dir_watch_add()
+    char filename[256];
+    struct timespec arrival;      // CLOCK_MONOTONIC do primeiro evento
+} WatchArrival;
+
+// Recebe cada rajada ja sem repetidos (chamada pela thread que vigia)
+typedef void (*watch_fn)(void *ctx, WatchArrival *arrivals, int n);
+
+typedef struct {
+    int fd;                       // inotify
+    int wake[2];                  // pipe para acordar a thread no fim
+    struct {
+        int wd;
+        void *tag;
+    } dirs[WATCH_MAX_DIRS];
+    int num_dirs;
+    watch_fn fn;
+    void *ctx;
+    WatchArrival *pending;        // rajada em curso
+    int num_pending;
+    unsigned long events, duplicates, bursts;
+    pthread_mutex_t mutex;        // protege dirs e os contadores
+    pthread_t thread;
+} DirWatcher;
+
+
+/******************************************************************************
+ * dir_watch_start()
+ *
+ * Arguments: fn - function called with every burst of arrivals
+ *            ctx - first argument of fn
+ * Returns: watcher, or NULL if inotify is not available
+ * Side-Effects: starts the watcher thread
+ *
+ *****************************************************************************/
+DirWatcher *dir_watch_start(watch_fn fn, void *ctx);
+
+/******************************************************************************
+ * dir_watch_add()
+ *
+ * Arguments: w - watcher
+ *            dir - directory to watch
+ *            tag - value passed back with its arrivals
+ * Returns: (bool) 1 in case of success, 0 in case of failure
+ * Side-Effects: adds an inotify watch
+ *
+ * Description: a .jpeg counts as arrived when it is closed after being
+ *              written (IN_CLOSE_WRITE) or renamed into the directory
+ *              (IN_MOVED_TO). Events are grouped into bursts and a file
+ *              that appears twice in the same burst is sent once.
+ *
+ *****************************************************************************/
+int dir_watch_add(DirWatcher *w, const char *dir, void *tag);
+
+/******************************************************************************
+ * dir_watch_remove()
+ *
+ * Arguments: w - watcher
+ *            tag - value given to dir_watch_add()
+ * Returns: (bool) 1 if it was being watched
+ * Side-Effects: removes the inotify watch
+ *
+ *****************************************************************************/
+int dir_watch_remove(DirWatcher *w, void *tag);
+
+/******************************************************************************
+ * dir_watch_stop()
+ *
+ * Arguments: w - watcher
+ * Returns: none
+ * Side-Effects: delivers the last burst, stops the thread and frees w
+ *
+ *****************************************************************************/
+void dir_watch_stop(DirWatcher *w);
+
+#endif
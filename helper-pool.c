@@ -0,0 +1,221 @@
+#include "helper-pool.h"
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "trace.h"
+
+// Trabalho publicado na fila ate todas as partes terem sido tiradas
+typedef struct HelperJob {
+    helper_fn fn;
+    void *arg;
+    int n;
+    int next;                     // proxima parte por tirar
+    int done;                     // partes acabadas
+    struct HelperJob *next_job;
+} HelperJob;
+
+static pthread_mutex_t helper_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t helper_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t helper_done = PTHREAD_COND_INITIALIZER;
+static HelperJob *helper_queue = NULL;
+static int helper_threads = 0;
+static int helper_lent = 0;       // threads de quem chama a espera em helper_pool_idle()
+static pid_t helper_pid = 0;      // processo dono das threads
+
+
+// Um filho criado com fork() herda as variaveis mas nao as threads.
+// Chamada com o mutex fechado
+static void claim_process(void) {
+    if (helper_pid != getpid()) {
+        helper_pid = getpid();
+        helper_threads = 0;
+        helper_lent = 0;
+        helper_queue = NULL;
+    }
+}
+
+
+// Tira uma parte do trabalho; sai da fila quando ja nao tem partes.
+// Chamada com o mutex fechado; devolve -1 se ja nao ha partes
+static int take_part(HelperJob *job) {
+    if (job->next >= job->n) {
+        return -1;
+    }
+    int i = job->next++;
+    if (job->next == job->n) {
+        HelperJob **p = &helper_queue;
+        while (*p && *p != job) {
+            p = &(*p)->next_job;
+        }
+        if (*p) {
+            *p = job->next_job;
+        }
+    }
+    return i;
+}
+
+static void finish_part(HelperJob *job) {
+    job->done++;
+    if (job->done == job->n) {
+        pthread_cond_broadcast(&helper_done);
+    }
+}
+
+static void *helper_thread(void *arg) {
+    trace_thread_name("helper %d", (int)(long)arg);
+
+    pthread_mutex_lock(&helper_mutex);
+    while (1) {
+        while (!helper_queue) {
+            pthread_cond_wait(&helper_work, &helper_mutex);
+        }
+        HelperJob *job = helper_queue;
+        int i = take_part(job);
+        pthread_mutex_unlock(&helper_mutex);
+
+        job->fn(job->arg, i);
+
+        pthread_mutex_lock(&helper_mutex);
+        finish_part(job);
+    }
+    return NULL;
+}
+
+
+/******************************************************************************
+ * helper_pool_start()
+ *
+ * Arguments: num_threads - number of helper threads wanted in this process
+ * Returns: number of helper threads running
+ * Side-Effects: starts the threads on the first call of each process
+ *
+ *****************************************************************************/
+int helper_pool_start(int num_threads) {
+    if (num_threads > HELPER_MAX_THREADS) {
+        num_threads = HELPER_MAX_THREADS;
+    }
+    pthread_mutex_lock(&helper_mutex);
+    claim_process();
+    while (helper_threads < num_threads) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, helper_thread, (void *)(long)helper_threads) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        helper_threads++;
+    }
+    int running = helper_threads;
+    pthread_mutex_unlock(&helper_mutex);
+    return running;
+}
+
+
+/******************************************************************************
+ * helper_pool_run()
+ *
+ * Arguments: fn - function to call
+ *            arg - argument passed to every call
+ *            n - number of parts; fn(arg, i) is called for i = 0 .. n-1
+ * Returns: none
+ * Side-Effects: blocks until every part is done
+ *
+ *****************************************************************************/
+void helper_pool_run(helper_fn fn, void *arg, int n) {
+    if (n <= 0) {
+        return;
+    }
+    if (n == 1 || helper_threads + helper_lent == 0 || helper_pid != getpid()) {
+        for (int i = 0; i < n; i++) {
+            fn(arg, i);
+        }
+        return;
+    }
+
+    HelperJob job = { fn, arg, n, 0, 0, NULL };
+
+    pthread_mutex_lock(&helper_mutex);
+    job.next_job = helper_queue;
+    helper_queue = &job;
+    pthread_cond_broadcast(&helper_work);
+
+    // quem chama tambem trabalha, ate nao haver partes por tirar
+    int i;
+    while ((i = take_part(&job)) >= 0) {
+        pthread_mutex_unlock(&helper_mutex);
+        fn(arg, i);
+        pthread_mutex_lock(&helper_mutex);
+        finish_part(&job);
+    }
+    while (job.done < job.n) {
+        pthread_cond_wait(&helper_done, &helper_mutex);
+    }
+    pthread_mutex_unlock(&helper_mutex);
+}
+
+
+/******************************************************************************
+ * helper_pool_idle()
+ *
+ * Arguments: more_work - returns 0 when the caller should stop helping
+ * Returns: none
+ * Side-Effects: the calling thread runs parts of other threads' jobs
+ *
+ *****************************************************************************/
+void helper_pool_idle(int (*more_work)(void)) {
+    pthread_mutex_lock(&helper_mutex);
+    claim_process();
+    helper_lent++;
+    while (more_work()) {
+        if (!helper_queue) {
+            pthread_cond_wait(&helper_work, &helper_mutex);
+            continue;
+        }
+        HelperJob *job = helper_queue;
+        int i = take_part(job);
+        pthread_mutex_unlock(&helper_mutex);
+
+        job->fn(job->arg, i);
+
+        pthread_mutex_lock(&helper_mutex);
+        finish_part(job);
+    }
+    helper_lent--;
+    pthread_mutex_unlock(&helper_mutex);
+}
+
+
+/******************************************************************************
+ * helper_pool_wake()
+ *
+ * Arguments: none
+ * Returns: none
+ * Side-Effects: wakes the threads in helper_pool_idle() to check more_work
+ *
+ *****************************************************************************/
+void helper_pool_wake(void) {
+    pthread_mutex_lock(&helper_mutex);
+    pthread_cond_broadcast(&helper_work);
+    pthread_mutex_unlock(&helper_mutex);
+}
+
+
+/******************************************************************************
+ * helper_pool_share()
+ *
+ * Arguments: processes - processes that will each start helpers
+ *            wanted - helper threads each process would like
+ * Returns: helper threads each process may start
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int helper_pool_share(int processes, int wanted) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu < 1) {
+        ncpu = 1;
+    }
+    int share = (int)(ncpu / (processes > 0 ? processes : 1)) - 1;
+    if (share < 0) {
+        share = 0;
+    }
+    return wanted < share ? wanted : share;
+}
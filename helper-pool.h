@@ -0,0 +1,79 @@
+#ifndef HELPER_POOL_H
+#define HELPER_POOL_H
+
+#define HELPER_MAX_THREADS 16
+
+// Funcao de um trabalho dividido em partes: chamada uma vez por cada i
+typedef void (*helper_fn)(void *arg, int i);
+
+
+/******************************************************************************
+ * helper_pool_start()
+ *
+ * Arguments: num_threads - number of helper threads wanted in this process
+ * Returns: number of helper threads running
+ * Side-Effects: starts the threads on the first call of each process (a
+ *               forked child starts its own); later calls only add threads
+ *               up to num_threads
+ *
+ *****************************************************************************/
+int helper_pool_start(int num_threads);
+
+/******************************************************************************
+ * helper_pool_run()
+ *
+ * Arguments: fn - function to call
+ *            arg - argument passed to every call
+ *            n - number of parts; fn(arg, i) is called for i = 0 .. n-1
+ * Returns: none
+ * Side-Effects: blocks until every part is done
+ *
+ * Description: idle helper threads take parts while the caller also works
+ *              on them, so it never waits for a busy helper and runs
+ *              everything itself when there are no helpers. Safe to call
+ *              from several threads at once.
+ *
+ *****************************************************************************/
+void helper_pool_run(helper_fn fn, void *arg, int n);
+
+/******************************************************************************
+ * helper_pool_idle()
+ *
+ * Arguments: more_work - returns 0 when the caller should stop helping
+ * Returns: none
+ * Side-Effects: the calling thread runs parts of other threads' jobs
+ *
+ * Description: lends a thread that ran out of its own work to the pool
+ *              until more_work() returns 0; more_work is checked with the
+ *              pool locked, so whoever changes its answer must call
+ *              helper_pool_wake() afterwards
+ *
+ *****************************************************************************/
+void helper_pool_idle(int (*more_work)(void));
+
+/******************************************************************************
+ * helper_pool_wake()
+ *
+ * Arguments: none
+ * Returns: none
+ * Side-Effects: wakes the threads in helper_pool_idle() to check more_work
+ *
+ *****************************************************************************/
+void helper_pool_wake(void);
+
+/******************************************************************************
+ * helper_pool_share()
+ *
+ * Arguments: processes - processes that will each start helpers
+ *            wanted - helper threads each process would like
+ * Returns: helper threads each process may start
+ * Side-Effects: none
+ *
+ * Description: at most one thread per CPU in total: each process gets
+ *              ncpu / processes threads, one of which is its own worker,
+ *              so N processes do not start N * (N - 1) helpers
+ *
+ *****************************************************************************/
+int helper_pool_share(int processes, int wanted);
+
+#endif
@@ -0,0 +1,269 @@
+#include "image-cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+// Um shard: tabela de dispersao + lista LRU com sentinela
+typedef struct {
+    pthread_mutex_t mutex;
+    CacheEntry *buckets[CACHE_BUCKETS];
+    CacheEntry lru;               // lru.next = mais antiga, lru.prev = mais recente
+    size_t bytes;
+    size_t capacity;
+} CacheShard;
+
+// Contadores somados por todos os processos (memoria partilhada)
+typedef struct {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long too_large;      // nao cabiam num shard
+    long long bytes;
+    long entries;
+    long long capacity;           // orcamento total
+} CacheStats;
+
+static CacheShard *cache_shards = NULL;
+static CacheStats *cache_stats = NULL;
+
+
+// FNV-1a do caminho
+static unsigned int hash_path(const char *path) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    return h;
+}
+
+static size_t pixmap_bytes(const Pixmap *pix) {
+    return pix ? (size_t)pix->stride * pix->height * pix->channels : 0;
+}
+
+static void lru_unlink(CacheEntry *e) {
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+}
+
+// Passa para o fim da lista (a mais recente)
+static void lru_push(CacheShard *shard, CacheEntry *e) {
+    e->prev = shard->lru.prev;
+    e->next = &shard->lru;
+    shard->lru.prev->next = e;
+    shard->lru.prev = e;
+}
+
+static void free_entry(CacheEntry *e) {
+    pixmap_destroy(e->image);
+    pixmap_destroy(e->luma);
+    free(e->path);
+    free(e);
+}
+
+// Tira a entrada da tabela e da LRU; so e libertada quando ninguem a usa.
+// Chamada com o mutex do shard fechado
+static void drop_entry(CacheShard *shard, CacheEntry *e) {
+    CacheEntry **p = &shard->buckets[e->hash % CACHE_BUCKETS];
+    while (*p != e) {
+        p = &(*p)->chain;
+    }
+    *p = e->chain;
+    lru_unlink(e);
+    shard->bytes -= e->bytes;
+    __atomic_sub_fetch(&cache_stats->bytes, (long long)e->bytes, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&cache_stats->entries, 1, __ATOMIC_RELAXED);
+    if (--e->refs == 0) {
+        free_entry(e);
+    }
+}
+
+static CacheEntry *find_path(CacheShard *shard, const char *path, unsigned int hash) {
+    for (CacheEntry *e = shard->buckets[hash % CACHE_BUCKETS]; e; e = e->chain) {
+        if (e->hash == hash && strcmp(e->path, path) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+
+/******************************************************************************
+ * image_cache_enable()
+ *
+ * Arguments: bytes - memory for decoded images
+ *            processes - worker processes sharing the budget (1 = threads)
+ * Returns: (bool) 1 if enabled, 0 in case of failure
+ * Side-Effects: allocates the cache and its counters
+ *
+ *****************************************************************************/
+int image_cache_enable(long long bytes, int processes) {
+    CacheStats *stats = mmap(NULL, sizeof(CacheStats), PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED) {
+        return 0;
+    }
+    cache_shards = calloc(CACHE_SHARDS, sizeof(CacheShard));
+    if (!cache_shards) {
+        munmap(stats, sizeof(CacheStats));
+        return 0;
+    }
+    memset(stats, 0, sizeof(CacheStats));
+    stats->capacity = bytes;
+    cache_stats = stats;
+
+    // depois do fork cada processo fica com a sua copia (vazia) dos shards
+    if (processes < 1) {
+        processes = 1;
+    }
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *shard = &cache_shards[i];
+        pthread_mutex_init(&shard->mutex, NULL);
+        shard->lru.next = shard->lru.prev = &shard->lru;
+        shard->capacity = bytes / processes / CACHE_SHARDS;
+    }
+    return 1;
+}
+
+int image_cache_enabled(void) {
+    return cache_shards != NULL;
+}
+
+
+/******************************************************************************
+ * image_cache_get()
+ *
+ * Arguments: path, mtime, size - key of the source file
+ * Returns: entry (with a reference for the caller), or NULL on a miss
+ * Side-Effects: moves the entry to the front of its LRU
+ *
+ *****************************************************************************/
+CacheEntry *image_cache_get(const char *path, time_t mtime, long long size) {
+    unsigned int hash = hash_path(path);
+    CacheShard *shard = &cache_shards[hash % CACHE_SHARDS];
+
+    pthread_mutex_lock(&shard->mutex);
+    CacheEntry *e = find_path(shard, path, hash);
+    if (e && (e->mtime != mtime || e->size != size)) {
+        drop_entry(shard, e);     // o ficheiro mudou
+        e = NULL;
+    }
+    if (e) {
+        e->refs++;
+        lru_unlink(e);
+        lru_push(shard, e);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    __atomic_add_fetch(e ? &cache_stats->hits : &cache_stats->misses, 1, __ATOMIC_RELAXED);
+    return e;
+}
+
+
+/******************************************************************************
+ * image_cache_put()
+ *
+ * Arguments: path, mtime, size - key of the source file
+ *            image, luma - decoded pixmaps (luma may be NULL)
+ * Returns: entry (with a reference for the caller), or NULL if it does
+ *          not fit in a shard
+ * Side-Effects: takes the pixmaps and evicts the least recently used
+ *               entries of the shard until it fits
+ *
+ *****************************************************************************/
+CacheEntry *image_cache_put(const char *path, time_t mtime, long long size,
+                            Pixmap *image, Pixmap *luma) {
+    unsigned int hash = hash_path(path);
+    CacheShard *shard = &cache_shards[hash % CACHE_SHARDS];
+    size_t bytes = sizeof(CacheEntry) + strlen(path) + 1 + pixmap_bytes(image) + pixmap_bytes(luma);
+
+    if (bytes > shard->capacity) {
+        __atomic_add_fetch(&cache_stats->too_large, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    CacheEntry *e = calloc(1, sizeof(CacheEntry));
+    if (!e || !(e->path = strdup(path))) {
+        free(e);
+        return NULL;
+    }
+    e->mtime = mtime;
+    e->size = size;
+    e->image = image;
+    e->luma = luma;
+    e->bytes = bytes;
+    e->hash = hash;
+    e->refs = 2;                  // a cache e quem chamou
+
+    pthread_mutex_lock(&shard->mutex);
+    // outra thread pode ter descodificado a mesma imagem ao mesmo tempo
+    CacheEntry *old = find_path(shard, path, hash);
+    if (old && old->mtime == mtime && old->size == size) {
+        old->refs++;
+        pthread_mutex_unlock(&shard->mutex);
+        free_entry(e);
+        return old;
+    }
+    if (old) {
+        drop_entry(shard, old);
+    }
+    while (shard->bytes + bytes > shard->capacity) {
+        drop_entry(shard, shard->lru.next);
+        __atomic_add_fetch(&cache_stats->evictions, 1, __ATOMIC_RELAXED);
+    }
+    e->chain = shard->buckets[hash % CACHE_BUCKETS];
+    shard->buckets[hash % CACHE_BUCKETS] = e;
+    lru_push(shard, e);
+    shard->bytes += bytes;
+    pthread_mutex_unlock(&shard->mutex);
+
+    __atomic_add_fetch(&cache_stats->bytes, (long long)bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&cache_stats->entries, 1, __ATOMIC_RELAXED);
+    return e;
+}
+
+
+/******************************************************************************
+ * image_cache_release()
+ *
+ * Arguments: entry - entry from image_cache_get() / image_cache_put()
+ * Returns: none
+ * Side-Effects: frees an evicted entry when its last user lets go
+ *
+ *****************************************************************************/
+void image_cache_release(CacheEntry *entry) {
+    CacheShard *shard = &cache_shards[entry->hash % CACHE_SHARDS];
+    pthread_mutex_lock(&shard->mutex);
+    int last = --entry->refs == 0;
+    pthread_mutex_unlock(&shard->mutex);
+    if (last) {
+        free_entry(entry);
+    }
+}
+
+
+/******************************************************************************
+ * image_cache_report()
+ *
+ * Arguments: fp - where to write
+ * Returns: none
+ * Side-Effects: writes hits, misses, evictions and memory in use to fp
+ *
+ *****************************************************************************/
+void image_cache_report(FILE *fp) {
+    if (!cache_stats) {
+        return;
+    }
+    unsigned long hits = __atomic_load_n(&cache_stats->hits, __ATOMIC_RELAXED);
+    unsigned long misses = __atomic_load_n(&cache_stats->misses, __ATOMIC_RELAXED);
+    unsigned long lookups = hits + misses;
+
+    fprintf(fp, "=== Cache de imagens ===\n");
+    fprintf(fp, "Hits: %lu, misses: %lu (%.1f%% hits), despejadas: %lu, grandes demais: %lu\n",
+            hits, misses, lookups ? 100.0 * hits / lookups : 0.0,
+            __atomic_load_n(&cache_stats->evictions, __ATOMIC_RELAXED),
+            __atomic_load_n(&cache_stats->too_large, __ATOMIC_RELAXED));
+    fprintf(fp, "Em cache: %ld imagens, %.1f MB de %.1f MB\n",
+            __atomic_load_n(&cache_stats->entries, __ATOMIC_RELAXED),
+            __atomic_load_n(&cache_stats->bytes, __ATOMIC_RELAXED) / 1048576.0,
+            cache_stats->capacity / 1048576.0);
+}
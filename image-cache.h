@@ -0,0 +1,97 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include <stdio.h>
+#include <time.h>
+#include "pixmap.h"
+
+#define CACHE_SHARDS 8            // cada um com o seu mutex, LRU e 1/8 do orcamento
+#define CACHE_BUCKETS 1024        // por shard
+
+// Imagem descodificada guardada entre comandos. Os pixmaps so se leem:
+// varias threads podem usar a mesma entrada ao mesmo tempo
+typedef struct CacheEntry {
+    char *path;                   // chave: caminho + mtime + tamanho
+    time_t mtime;
+    long long size;
+    Pixmap *image;                // original
+    Pixmap *luma;                 // plano Y da JPEG (NULL se nao foi lido)
+    size_t bytes;
+    int refs;                     // quem esta a usar (a cache conta como 1)
+    unsigned int hash;
+    struct CacheEntry *prev, *next;   // LRU do shard (next = mais antiga)
+    struct CacheEntry *chain;         // mesma posicao da tabela
+} CacheEntry;
+
+
+/******************************************************************************
+ * image_cache_enable()
+ *
+ * Arguments: bytes - memory for decoded images
+ *            processes - worker processes sharing the budget (1 = threads)
+ * Returns: (bool) 1 if enabled, 0 in case of failure
+ * Side-Effects: allocates the cache and its counters (shared memory, so
+ *               that forked workers add to the same totals); must be
+ *               called before creating threads or processes
+ *
+ * Description: with processes > 1 each process keeps its own cache of
+ *              bytes / processes
+ *
+ *****************************************************************************/
+int image_cache_enable(long long bytes, int processes);
+
+/******************************************************************************
+ * image_cache_enabled()
+ *
+ * Returns: (bool) 1 if image_cache_enable() was called
+ *
+ *****************************************************************************/
+int image_cache_enabled(void);
+
+/******************************************************************************
+ * image_cache_get()
+ *
+ * Arguments: path, mtime, size - key of the source file
+ * Returns: entry (with a reference for the caller), or NULL on a miss
+ * Side-Effects: moves the entry to the front of its LRU; an entry for the
+ *               same path with another mtime or size is dropped
+ *
+ *****************************************************************************/
+CacheEntry *image_cache_get(const char *path, time_t mtime, long long size);
+
+/******************************************************************************
+ * image_cache_put()
+ *
+ * Arguments: path, mtime, size - key of the source file
+ *            image, luma - decoded pixmaps (luma may be NULL)
+ * Returns: entry (with a reference for the caller), or NULL if it does
+ *          not fit in a shard; on NULL the pixmaps still belong to the
+ *          caller
+ * Side-Effects: takes the pixmaps and evicts the least recently used
+ *               entries of the shard until it fits
+ *
+ *****************************************************************************/
+CacheEntry *image_cache_put(const char *path, time_t mtime, long long size,
+                            Pixmap *image, Pixmap *luma);
+
+/******************************************************************************
+ * image_cache_release()
+ *
+ * Arguments: entry - entry from image_cache_get() / image_cache_put()
+ * Returns: none
+ * Side-Effects: frees an evicted entry when its last user lets go
+ *
+ *****************************************************************************/
+void image_cache_release(CacheEntry *entry);
+
+/******************************************************************************
+ * image_cache_report()
+ *
+ * Arguments: fp - where to write
+ * Returns: none
+ * Side-Effects: writes hits, misses, evictions and memory in use to fp
+ *
+ *****************************************************************************/
+void image_cache_report(FILE *fp);
+
+#endif
@@ -1,8 +1,12 @@
 #include "image-lib.h"
+#include "helper-pool.h"
 #include <sys/stat.h>
 #include <dirent.h>
 #include <assert.h>
 #include <time.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 /******************************************************************************
  * smooth_image()
@@ -188,6 +192,99 @@ int write_jpeg_file(gdImagePtr write_img, char * file_name){
 }
 
 
+/******************************************************************************
+ * read_file_data()
+ *
+ * Arguments: file_name - name of file to read
+ *            size - where to store the number of bytes read
+ * Returns: data - malloc'ed buffer with the whole file, or NULL if failure
+ * Side-Effects: none
+ *
+ * Description: reads a file into memory
+ *
+ *****************************************************************************/
+void * read_file_data(char * file_name, int * size){
+
+	FILE * fp;
+	struct stat st;
+	void * data;
+
+	fp = fopen(file_name, "rb");
+	if (!fp) {
+		fprintf(stderr, "Can't read image %s\n", file_name);
+		return NULL;
+	}
+	if (fstat(fileno(fp), &st) != 0 || st.st_size <= 0) {
+		fclose(fp);
+		return NULL;
+	}
+	data = malloc(st.st_size);
+	if (data == NULL || fread(data, 1, st.st_size, fp) != (size_t)st.st_size) {
+		free(data);
+		fclose(fp);
+		return NULL;
+	}
+	fclose(fp);
+
+	*size = (int)st.st_size;
+	return data;
+}
+
+/******************************************************************************
+ * decode_jpeg_data()
+ *
+ * Arguments: data, size - JPEG file in memory
+ * Returns: img - the decoded image or NULL if failure to decode
+ * Side-Effects: none
+ *
+ * Description: decodes a JPEG image from memory
+ *
+ *****************************************************************************/
+gdImagePtr decode_jpeg_data(void * data, int size){
+	return gdImageCreateFromJpegPtr(size, data);
+}
+
+/******************************************************************************
+ * encode_jpeg_data()
+ *
+ * Arguments: img - pointer to image to be encoded
+ *            size - where to store the number of bytes
+ * Returns: data - JPEG file in memory (free with gdFree()), or NULL
+ * Side-Effects: none
+ *
+ * Description: encodes with the same quality as write_jpeg_file()
+ *
+ *****************************************************************************/
+void * encode_jpeg_data(gdImagePtr img, int * size){
+	return gdImageJpegPtr(img, size, 70);
+}
+
+/******************************************************************************
+ * write_file_data()
+ *
+ * Arguments: file_name - name of file to write
+ *            data, size - bytes to write
+ * Returns: (bool) 1 in case of success, 0 in case of failure to write
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int write_file_data(char * file_name, void * data, int size){
+	FILE * fp;
+	int ok;
+
+	fp = fopen(file_name, "wb");
+	if (fp == NULL) {
+		return 0;
+	}
+	ok = fwrite(data, 1, size, fp) == (size_t)size;
+	if (fclose(fp) != 0) {
+		ok = 0;
+	}
+
+	return ok;
+}
+
+
 /******************************************************************************
  * create_directory()
  *
@@ -237,3 +334,572 @@ struct timespec diff_timespec(const struct timespec *time1, const struct timespe
   }
   return diff;
 }
+
+
+
+static long band_min_pixels = BAND_MIN_PIXELS;
+static int band_helpers = 0;
+
+/******************************************************************************
+ * image_set_bands()
+ *
+ * Arguments: min_pixels - smallest image split in bands (0 = never)
+ *            helpers - helper threads to start for the bands (besides any
+ *                      thread lent with helper_pool_idle())
+ * Returns: none
+ * Side-Effects: changes how later transforms run
+ *
+ *****************************************************************************/
+void image_set_bands(long min_pixels, int helpers){
+	band_min_pixels = min_pixels;
+	band_helpers = helpers;
+}
+
+/* numero de faixas de pelo menos min_rows linhas (1 = imagem inteira) */
+static int band_count(const Pixmap *in, int min_rows){
+	if (band_min_pixels <= 0 || (long)in->width * in->height < band_min_pixels) {
+		return 1;
+	}
+	int n = in->height / min_rows;
+	if (n > BAND_MAX_PARTS) {
+		n = BAND_MAX_PARTS;
+	}
+	if (n < 2) {
+		return 1;
+	}
+	if (band_helpers > 0) {
+		helper_pool_start(band_helpers);
+	}
+	return n;
+}
+
+/* linhas [y0, y1) da faixa i de n */
+static void band_rows(const Pixmap *in, int n, int i, int *y0, int *y1){
+	*y0 = (int)((long)in->height * i / n);
+	*y1 = (int)((long)in->height * (i + 1) / n);
+}
+
+
+/* aplica uma tabela de 256 entradas as linhas [y0, y1) de um plano */
+static void apply_lut(const Pixmap *in, Pixmap *out, int c, const unsigned char *lut,
+		int y0, int y1){
+	for (int y = y0; y < y1; y++) {
+		const unsigned char *src = PIXMAP_ROW(in, c, y);
+		unsigned char *dst = PIXMAP_ROW(out, c, y);
+		for (int x = 0; x < in->width; x++) {
+			dst[x] = lut[src[x]];
+		}
+	}
+}
+
+static void copy_plane(const Pixmap *in, Pixmap *out, int c){
+	memcpy(out->plane[c], in->plane[c], (size_t)in->stride * in->height);
+}
+
+/* uma tabela por canal RGB; o alfa e copiado */
+typedef struct {
+	const Pixmap *in;
+	Pixmap *out;
+	const unsigned char (*lut)[256];
+	int bands;
+} lut_job;
+
+static void lut_band(void *arg, int i){
+	lut_job *job = arg;
+	int y0, y1;
+	band_rows(job->in, job->bands, i, &y0, &y1);
+	for (int c = 0; c < 3; c++) {
+		apply_lut(job->in, job->out, c, job->lut[c], y0, y1);
+	}
+	if (job->in->channels == 4) {
+		memcpy(PIXMAP_ROW(job->out, 3, y0), PIXMAP_ROW(job->in, 3, y0),
+		       (size_t)job->in->stride * (y1 - y0));
+	}
+}
+
+static Pixmap *lut_pixmap(const Pixmap *in, const unsigned char lut[3][256]){
+	Pixmap *out = pixmap_create(in->width, in->height, in->channels);
+
+	if (!out) {
+		return NULL;
+	}
+	lut_job job = { in, out, lut, band_count(in, BAND_MIN_ROWS) };
+	helper_pool_run(lut_band, &job, job.bands);
+	return out;
+}
+
+
+/******************************************************************************
+ * contrast_pixmap()
+ *
+ * Arguments: in - pointer to pixmap
+ * Returns: out - pointer to transformed pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: same formula as gdImageContrast(img, -20)
+ *
+ *****************************************************************************/
+Pixmap *contrast_pixmap(const Pixmap *in){
+
+	unsigned char lut[3][256];
+	double contrast = (100.0 - (-20)) / 100.0;
+
+	contrast = contrast * contrast;
+	for (int v = 0; v < 256; v++) {
+		double f = ((v / 255.0 - 0.5) * contrast + 0.5) * 255.0;
+		f = (f > 255.0) ? 255.0 : ((f < 0.0) ? 0.0 : f);
+		lut[0][v] = lut[1][v] = lut[2][v] = (unsigned char)f;
+	}
+	return lut_pixmap(in, lut);
+}
+
+
+/******************************************************************************
+ * sepia_pixmap()
+ *
+ * Arguments: in - pointer to pixmap
+ * Returns: out - pointer to sepia pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: same as gdImageColor(img, 120, 70, 0, 0)
+ *
+ *****************************************************************************/
+Pixmap *sepia_pixmap(const Pixmap *in){
+
+	const int add[3] = {120, 70, 0};
+	unsigned char lut[3][256];
+
+	for (int c = 0; c < 3; c++) {
+		for (int v = 0; v < 256; v++) {
+			int n = v + add[c];
+			lut[c][v] = n > 255 ? 255 : n;
+		}
+	}
+	return lut_pixmap(in, lut);
+}
+
+
+/******************************************************************************
+ * gray_pixmap()
+ *
+ * Arguments: in - pointer to pixmap
+ * Returns: out - pointer to grayscale pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: same weights as gdImageGrayScale()
+ *
+ *****************************************************************************/
+Pixmap *gray_pixmap(const Pixmap *in){
+
+	Pixmap *out = pixmap_create(in->width, in->height, in->channels);
+
+	if (!out) {
+		return NULL;
+	}
+	for (int y = 0; y < in->height; y++) {
+		const unsigned char *r = PIXMAP_ROW(in, 0, y);
+		const unsigned char *g = PIXMAP_ROW(in, 1, y);
+		const unsigned char *b = PIXMAP_ROW(in, 2, y);
+		unsigned char *o = PIXMAP_ROW(out, 0, y);
+		for (int x = 0; x < in->width; x++) {
+			o[x] = (unsigned char)(.299 * r[x] + .587 * g[x] + .114 * b[x]);
+		}
+		memcpy(PIXMAP_ROW(out, 1, y), o, in->width);
+		memcpy(PIXMAP_ROW(out, 2, y), o, in->width);
+	}
+	if (in->channels == 4) {
+		copy_plane(in, out, 3);
+	}
+	return out;
+}
+
+
+/* arredonda e satura como o uchar_clamp() do gd */
+static inline unsigned char clamp_u8(float v, int max){
+	int r = (int)(v + 0.5f);
+	return r < 0 ? 0 : (r > max ? max : r);
+}
+
+/* indice espelhado nas margens, como o reflect() do gd */
+static inline int reflect_index(int max, int x){
+	while (x < 0 || x >= max) {
+		if (x < 0) {
+			x = -x;
+		}
+		if (x >= max) {
+			x = max - (x - max) - 1;
+		}
+	}
+	return x;
+}
+
+/* blur de uma faixa de linhas */
+typedef struct {
+	const Pixmap *in;
+	Pixmap *out;
+	const float *coeffs;
+	int radius;
+	int bands;
+	int failed;
+} blur_job;
+
+/* Faz as linhas [y0, y1) da saida. A passagem horizontal vai para um tmp
+ * so da faixa, com radius linhas a mais de cada lado (halo, ja espelhadas
+ * nas margens da imagem), por isso as faixas nao dependem umas das outras
+ * e o resultado e igual ao da imagem inteira */
+static void blur_band(void *arg, int i){
+	blur_job *job = arg;
+	const Pixmap *in = job->in;
+	int w = in->width, h = in->height;
+	int radius = job->radius, taps = 2 * radius + 1;
+	int y0, y1;
+
+	band_rows(in, job->bands, i, &y0, &y1);
+	int rows = y1 - y0 + 2 * radius;
+	float *acc = malloc(w * sizeof(float));
+	unsigned char *pad = malloc(w + 2 * radius);
+	Pixmap *tmp = pixmap_create(w, rows, 1);
+
+	if (!acc || !pad || !tmp) {
+		free(acc);
+		free(pad);
+		pixmap_destroy(tmp);
+		job->failed = 1;
+		return;
+	}
+	for (int c = 0; c < in->channels; c++) {
+		int max = c == 3 ? gdAlphaMax : 255;
+
+		/* passagem horizontal: plano -> tmp, sobre uma copia da linha com
+		 * as margens ja espelhadas para o ciclo interior ser contiguo */
+		for (int t = 0; t < rows; t++) {
+			const unsigned char *src = PIXMAP_ROW(in, c, reflect_index(h, y0 - radius + t));
+			unsigned char *dst = PIXMAP_ROW(tmp, 0, t);
+			for (int x = -radius; x < 0; x++) {
+				pad[x + radius] = src[reflect_index(w, x)];
+				pad[w - 1 - x + radius] = src[reflect_index(w, w - 1 - x)];
+			}
+			memcpy(pad + radius, src, w);
+			memset(acc, 0, w * sizeof(float));
+			for (int k = 0; k < taps; k++) {
+				const unsigned char *p = pad + k;
+				const float ck = job->coeffs[k];
+				for (int x = 0; x < w; x++) {
+					acc[x] += ck * p[x];
+				}
+			}
+			for (int x = 0; x < w; x++) {
+				dst[x] = clamp_u8(acc[x], max);
+			}
+		}
+
+		/* passagem vertical: tmp -> saida, linha a linha */
+		for (int y = y0; y < y1; y++) {
+			memset(acc, 0, w * sizeof(float));
+			for (int k = 0; k < taps; k++) {
+				const unsigned char *src = PIXMAP_ROW(tmp, 0, y - y0 + k);
+				const float ck = job->coeffs[k];
+				for (int x = 0; x < w; x++) {
+					acc[x] += ck * src[x];
+				}
+			}
+			unsigned char *dst = PIXMAP_ROW(job->out, c, y);
+			for (int x = 0; x < w; x++) {
+				dst[x] = clamp_u8(acc[x], max);
+			}
+		}
+	}
+
+	free(acc);
+	free(pad);
+	pixmap_destroy(tmp);
+}
+
+/******************************************************************************
+ * gaussian_blur_pixmap()
+ *
+ * Arguments: in - pointer to pixmap
+ *            radius - kernel radius; sigma is 2/3 of it, as in gd
+ * Returns: out - pointer to smoother pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: separable Gaussian, horizontal pass then vertical pass. The
+ *              vertical pass runs along whole rows so it vectorises.
+ *
+ *****************************************************************************/
+Pixmap *gaussian_blur_pixmap(const Pixmap *in, int radius){
+
+	int taps = 2 * radius + 1;
+	float *coeffs = malloc(taps * sizeof(float));
+	Pixmap *out = pixmap_create(in->width, in->height, in->channels);
+
+	if (!coeffs || !out) {
+		free(coeffs);
+		pixmap_destroy(out);
+		return NULL;
+	}
+
+	double sigma = (2.0 / 3.0) * radius;
+	double s = 2.0 * sigma * sigma, sum = 0.0;
+	for (int k = -radius; k <= radius; k++) {
+		double v = exp(-(k * k) / s);
+		coeffs[k + radius] = v;
+		sum += v;
+	}
+	for (int k = 0; k < taps; k++) {
+		coeffs[k] /= sum;
+	}
+
+	/* o halo repete 2*radius linhas por faixa: faixas bem maiores do que isso */
+	int min_rows = 16 * radius > BAND_MIN_ROWS ? 16 * radius : BAND_MIN_ROWS;
+	blur_job job = { in, out, coeffs, radius, band_count(in, min_rows), 0 };
+	helper_pool_run(blur_band, &job, job.bands);
+
+	free(coeffs);
+	if (job.failed) {
+		pixmap_destroy(out);
+		return NULL;
+	}
+	return out;
+}
+
+
+/******************************************************************************
+ * blur_pixmap()
+ *
+ * Arguments: in - pointer to pixmap
+ * Returns: out - pointer to smoother pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: same radius as blur_image()
+ *
+ *****************************************************************************/
+Pixmap *blur_pixmap(const Pixmap *in){
+	return gaussian_blur_pixmap(in, 20);
+}
+
+
+/******************************************************************************
+ * build_pyramid()
+ *
+ * Arguments: in - pointer to pixmap
+ *            pyr - pyramid to fill
+ *            levels - number of levels wanted (including the original)
+ * Returns: (bool) 1 in case of success, 0 in case of failure
+ * Side-Effects: allocates the levels below the original
+ *
+ * Description: builds a mip pyramid with 2x2 box averaging
+ *
+ *****************************************************************************/
+int build_pyramid(const Pixmap *in, image_pyramid * pyr, int levels){
+
+	if (levels > PYRAMID_MAX_LEVELS) {
+		levels = PYRAMID_MAX_LEVELS;
+	}
+	pyr->level[0] = in;
+	pyr->levels = 1;
+
+	for (int l = 1; l < levels; l++) {
+		const Pixmap *src = pyr->level[l - 1];
+		if (src->width / 2 < 8 || src->height / 2 < 8) {
+			break;
+		}
+		Pixmap *dst = pixmap_downsample2(src);
+		if (!dst) {
+			free_pyramid(pyr);
+			return 0;
+		}
+		pyr->level[l] = dst;
+		pyr->levels++;
+	}
+	return 1;
+}
+
+
+/******************************************************************************
+ * free_pyramid()
+ *
+ * Arguments: pyr - pyramid built by build_pyramid()
+ * Returns: none
+ * Side-Effects: destroys every level except the original
+ *
+ *****************************************************************************/
+void free_pyramid(image_pyramid * pyr){
+	for (int l = 1; l < pyr->levels; l++) {
+		pixmap_destroy((Pixmap *)pyr->level[l]);
+	}
+	pyr->levels = 1;
+}
+
+
+/******************************************************************************
+ * blur_pixmap_fast()
+ *
+ * Arguments: pyr - pyramid of the image
+ * Returns: out - pointer to smoother pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: approximates blur_pixmap() on the 1/4 level
+ *
+ *****************************************************************************/
+Pixmap *blur_pixmap_fast(image_pyramid * pyr){
+
+	Pixmap *small, *out;
+	int l = pyr->levels - 1;
+
+	if (l > 2) {
+		l = 2;
+	}
+	if (l == 0) {
+		return blur_pixmap(pyr->level[0]);
+	}
+
+	/* o raio (e o sigma) escalam com a resolucao do nivel */
+	small = gaussian_blur_pixmap(pyr->level[l], 20 >> l);
+	if (!small) {
+		return NULL;
+	}
+	out = pixmap_resize_bilinear(small, pyr->level[0]->width, pyr->level[0]->height);
+	pixmap_destroy(small);
+
+	return out;
+}
+
+
+/* nivel mais pequeno da piramide com pelo menos 2 pixels por pixel de
+ * saida (a media por area so e boa assim) */
+static const Pixmap *pyramid_source(image_pyramid * pyr, int width, int heigth){
+
+	int l = pyr->levels - 1;
+
+	while (l > 0 && (pyr->level[l]->width < 2 * width || pyr->level[l]->height < 2 * heigth)) {
+		l--;
+	}
+	return pyr->level[l];
+}
+
+
+/******************************************************************************
+ * thumb_pixmap_set()
+ *
+ * Arguments: pyr - pyramid of the image (levels = 1 for the exact result)
+ *            divisors - size of each rendition (1/divisor), increasing
+ *            n - number of renditions
+ *            out - array receiving the n thumbnails (NULL where it failed)
+ * Returns: number of thumbnails made
+ * Side-Effects: none
+ *
+ * Description: cascaded downscaling. Only the first (largest) rendition is
+ *              reduced from the image (or from a pyramid level); each of
+ *              the others is reduced from the previous rendition, so the
+ *              extra sizes read a fraction of the pixels. The sizes are
+ *              always computed from the original image.
+ *
+ *****************************************************************************/
+int thumb_pixmap_set(image_pyramid * pyr, const int *divisors, int n, Pixmap **out){
+
+	const Pixmap *src = NULL;
+	int made = 0;
+
+	for (int i = 0; i < n; i++) {
+		int width = pyr->level[0]->width / divisors[i];
+		int heigth = pyr->level[0]->height / divisors[i];
+
+		out[i] = NULL;
+		if (width < 1 || heigth < 1) {
+			continue;
+		}
+		if (!src) {
+			src = pyramid_source(pyr, width, heigth);
+		}
+		out[i] = pixmap_resize_area(src, width, heigth);
+		if (out[i]) {
+			src = out[i];
+			made++;
+		}
+	}
+	return made;
+}
+
+
+/******************************************************************************
+ * image_psnr()
+ *
+ * Arguments: a, b - pixmaps with the same size
+ * Returns: PSNR in dB over the RGB planes
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+double image_psnr(const Pixmap *a, const Pixmap *b){
+
+	double sse = 0.0;
+
+	if (a->width != b->width || a->height != b->height) {
+		return -1;
+	}
+	for (int c = 0; c < 3; c++) {
+		for (int y = 0; y < a->height; y++) {
+			const unsigned char *ra = PIXMAP_ROW(a, c, y);
+			const unsigned char *rb = PIXMAP_ROW(b, c, y);
+			for (int x = 0; x < a->width; x++) {
+				int d = ra[x] - rb[x];
+				sse += d * d;
+			}
+		}
+	}
+	if (sse == 0.0) {
+		return 1000;
+	}
+	double mse = sse / (3.0 * a->width * a->height);
+	return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+
+static double luma_at(const Pixmap *p, int x, int y){
+	return 0.299 * PIXMAP_ROW(p, 0, y)[x] + 0.587 * PIXMAP_ROW(p, 1, y)[x] +
+		0.114 * PIXMAP_ROW(p, 2, y)[x];
+}
+
+/******************************************************************************
+ * image_ssim()
+ *
+ * Arguments: a, b - pixmaps with the same size
+ * Returns: mean SSIM of the luma over 8x8 windows
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+double image_ssim(const Pixmap *a, const Pixmap *b){
+
+	const double c1 = (0.01 * 255) * (0.01 * 255);
+	const double c2 = (0.03 * 255) * (0.03 * 255);
+	double total = 0.0;
+	int windows = 0;
+
+	if (a->width != b->width || a->height != b->height) {
+		return -1;
+	}
+	for (int wy = 0; wy + 8 <= a->height; wy += 8) {
+		for (int wx = 0; wx + 8 <= a->width; wx += 8) {
+			double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+			for (int y = wy; y < wy + 8; y++) {
+				for (int x = wx; x < wx + 8; x++) {
+					double va = luma_at(a, x, y);
+					double vb = luma_at(b, x, y);
+					sa += va; sb += vb;
+					saa += va * va; sbb += vb * vb; sab += va * vb;
+				}
+			}
+			double ma = sa / 64, mb = sb / 64;
+			double var_a = saa / 64 - ma * ma;
+			double var_b = sbb / 64 - mb * mb;
+			double cov = sab / 64 - ma * mb;
+			total += ((2 * ma * mb + c1) * (2 * cov + c2)) /
+				((ma * ma + mb * mb + c1) * (var_a + var_b + c2));
+			windows++;
+		}
+	}
+	if (windows == 0) {
+		return 1.0;
+	}
+	return total / windows;
+}
@@ -1,4 +1,8 @@
+#ifndef IMAGE_LIB_H
+#define IMAGE_LIB_H
+
 #include "gd.h"
+#include "pixmap.h"
 
 
 
@@ -92,6 +96,55 @@ gdImagePtr read_jpeg_file(char * file_name);
  *****************************************************************************/
 int write_jpeg_file(gdImagePtr write_img, char * file_name);
 
+/******************************************************************************
+ * read_file_data()
+ *
+ * Arguments: file_name - name of file to read
+ *            size - where to store the number of bytes read
+ * Returns: data - malloc'ed buffer with the whole file, or NULL if failure
+ * Side-Effects: none
+ *
+ * Description: reads a file into memory (first half of read_jpeg_file())
+ *
+ *****************************************************************************/
+void * read_file_data(char * file_name, int * size);
+
+/******************************************************************************
+ * decode_jpeg_data()
+ *
+ * Arguments: data, size - JPEG file in memory
+ * Returns: img - the decoded image or NULL if failure to decode
+ * Side-Effects: none
+ *
+ * Description: decodes a JPEG image from memory
+ *
+ *****************************************************************************/
+gdImagePtr decode_jpeg_data(void * data, int size);
+
+/******************************************************************************
+ * encode_jpeg_data()
+ *
+ * Arguments: img - pointer to image to be encoded
+ *            size - where to store the number of bytes
+ * Returns: data - JPEG file in memory (free with gdFree()), or NULL
+ * Side-Effects: none
+ *
+ * Description: encodes with the same quality as write_jpeg_file()
+ *
+ *****************************************************************************/
+void * encode_jpeg_data(gdImagePtr img, int * size);
+
+/******************************************************************************
+ * write_file_data()
+ *
+ * Arguments: file_name - name of file to write
+ *            data, size - bytes to write
+ * Returns: (bool) 1 in case of success, 0 in case of failure to write
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int write_file_data(char * file_name, void * data, int size);
+
 /******************************************************************************
  * create_directory()
  *
@@ -107,3 +160,146 @@ int create_directory(char * dir_name);
 
 
 struct timespec diff_timespec(const struct timespec *time1, const struct timespec *time0);
+
+
+/******************************************************************************
+ * contrast_pixmap(), blur_pixmap(), sepia_pixmap(), gray_pixmap()
+ *
+ * Arguments: in - pointer to pixmap
+ * Returns: out - pointer to transformed pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: same transformations as the gd versions above, working on
+ *              the planar representation. Contrast, sepia and gray give the
+ *              same pixels as gd; blur is the same separable Gaussian with
+ *              float accumulation.
+ *
+ *****************************************************************************/
+Pixmap *contrast_pixmap(const Pixmap *in);
+Pixmap *blur_pixmap(const Pixmap *in);
+Pixmap *sepia_pixmap(const Pixmap *in);
+Pixmap *gray_pixmap(const Pixmap *in);
+
+/******************************************************************************
+ * gaussian_blur_pixmap()
+ *
+ * Arguments: in - pointer to pixmap
+ *            radius - kernel radius; sigma is 2/3 of it, as in gd
+ * Returns: out - pointer to smoother pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+Pixmap *gaussian_blur_pixmap(const Pixmap *in, int radius);
+
+
+#define BAND_MIN_PIXELS 8000000   /* imagens a partir de 8 MP sao divididas em faixas */
+#define BAND_MIN_ROWS 64
+#define BAND_MAX_PARTS 32
+
+/******************************************************************************
+ * image_set_bands()
+ *
+ * Arguments: min_pixels - smallest image split in bands (0 = never)
+ *            helpers - helper threads to start for the bands (besides any
+ *                      thread lent with helper_pool_idle())
+ * Returns: none
+ * Side-Effects: changes how later transforms run
+ *
+ * Description: contrast, sepia and blur of an image with at least
+ *              min_pixels pixels are split in horizontal bands run by the
+ *              helper pool, so one huge image is not left to a single
+ *              thread. Each blur band has a halo of radius rows, so the
+ *              result is the same as without bands.
+ *
+ *****************************************************************************/
+void image_set_bands(long min_pixels, int helpers);
+
+
+#define PYRAMID_MAX_LEVELS 4
+
+/* piramide de resolucoes: level[0] e a imagem original (nao pertence a
+ * piramide), cada nivel seguinte tem metade da largura e da altura */
+typedef struct {
+	int levels;
+	const Pixmap *level[PYRAMID_MAX_LEVELS];
+} image_pyramid;
+
+/******************************************************************************
+ * build_pyramid()
+ *
+ * Arguments: in - pointer to pixmap
+ *            pyr - pyramid to fill
+ *            levels - number of levels wanted (including the original)
+ * Returns: (bool) 1 in case of success, 0 in case of failure
+ * Side-Effects: allocates the levels below the original
+ *
+ * Description: builds a mip pyramid with 2x2 box averaging. Stops early if
+ *              a level would be smaller than 8x8 pixels.
+ *
+ *****************************************************************************/
+int build_pyramid(const Pixmap *in, image_pyramid * pyr, int levels);
+
+/******************************************************************************
+ * free_pyramid()
+ *
+ * Arguments: pyr - pyramid built by build_pyramid()
+ * Returns: none
+ * Side-Effects: destroys every level except the original
+ *
+ *****************************************************************************/
+void free_pyramid(image_pyramid * pyr);
+
+/******************************************************************************
+ * blur_pixmap_fast()
+ *
+ * Arguments: pyr - pyramid of the image
+ * Returns: out - pointer to smoother pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: approximates blur_pixmap() by blurring the 1/4 level with a
+ *              radius 4x smaller and scaling the result back to full size
+ *
+ *****************************************************************************/
+Pixmap *blur_pixmap_fast(image_pyramid * pyr);
+
+#define MAX_THUMB_RENDITIONS 8
+
+/******************************************************************************
+ * thumb_pixmap_set()
+ *
+ * Arguments: pyr - pyramid of the image (levels = 1 for the exact result)
+ *            divisors - size of each rendition (1/divisor), increasing
+ *            n - number of renditions (at most MAX_THUMB_RENDITIONS)
+ *            out - array receiving the n thumbnails (NULL where it failed)
+ * Returns: number of thumbnails made
+ * Side-Effects: none
+ *
+ * Description: cascaded downscaling: the largest rendition is reduced from
+ *              the image and every smaller one from the previous rendition
+ *
+ *****************************************************************************/
+int thumb_pixmap_set(image_pyramid * pyr, const int *divisors, int n, Pixmap **out);
+
+/******************************************************************************
+ * image_psnr()
+ *
+ * Arguments: a, b - pixmaps with the same size
+ * Returns: PSNR in dB over the RGB planes (1000 if identical, -1 if the
+ *          sizes differ)
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+double image_psnr(const Pixmap *a, const Pixmap *b);
+
+/******************************************************************************
+ * image_ssim()
+ *
+ * Arguments: a, b - pixmaps with the same size
+ * Returns: mean SSIM of the luma over 8x8 windows (1.0 if identical, -1 if
+ *          the sizes differ)
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+double image_ssim(const Pixmap *a, const Pixmap *b);
+
+#endif
@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gd.h>
+#include "image-lib.h"
+#include "jpeg-codec.h"
+
+// Compara o caminho antigo (gd) com o libjpeg direto do jpeg-codec.c:
+// tempo de descodificacao e de codificacao por imagem, tamanho das JPEG
+// e diferenca dos pixeis em relacao ao gd (PSNR; "igual" = mesmos pixeis).
+
+#define NUM_DECODERS 5           // gd + 4 variantes do libjpeg
+#define NUM_ENCODERS 6           // gd + 5 variantes do libjpeg
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static Pixmap *decode_gd(const void *data, int size, int flags) {
+    (void)flags;
+    gdImagePtr img = decode_jpeg_data((void *)data, size);
+    if (!img) {
+        return NULL;
+    }
+    Pixmap *pix = pixmap_from_gd(img);
+    gdImageDestroy(img);
+    return pix;
+}
+
+// Caminho antigo: volta a gdImage e codifica pelo gd (liberta-se com gdFree)
+static void *encode_gd(const Pixmap *pix, const JpegEncodeSettings *settings, int *size) {
+    (void)settings;
+    gdImagePtr img = pixmap_to_gd(pix);
+    if (!img) {
+        return NULL;
+    }
+    void *data = encode_jpeg_data(img, size);
+    gdImageDestroy(img);
+    return data;
+}
+
+static const struct {
+    const char *name;
+    Pixmap *(*decode)(const void *, int, int);
+    int flags;
+} decoders[NUM_DECODERS] = {
+    { "gd", decode_gd, 0 },
+    { "libjpeg", jpeg_decode_rgb, 0 },
+    { "fast-dct", jpeg_decode_rgb, JPEG_FAST_DCT },
+    { "fast-upsample", jpeg_decode_rgb, JPEG_FAST_UPSAMPLE },
+    { "fast-dct+ups", jpeg_decode_rgb, JPEG_FAST_DCT | JPEG_FAST_UPSAMPLE },
+};
+
+static const struct {
+    const char *name;
+    const char *settings;         // para jpeg_parse_settings()
+} encoders[NUM_ENCODERS] = {
+    { "gd", "" },
+    { "libjpeg", "" },
+    { "opt", "opt" },
+    { "fast-dct", "fast-dct" },
+    { "444", "444" },
+    { "444,opt", "444,opt" },
+};
+
+typedef struct {
+    double time;
+    long long bytes;
+    double psnr_min;              // pior imagem
+} BenchTotal;
+
+// "igual" quando os pixeis sao os mesmos; sem unidade nesse caso
+static void print_psnr(double psnr) {
+    if (psnr >= 1000) {
+        printf("   igual");
+    } else {
+        printf(" %7.2f dB", psnr);
+    }
+}
+
+// Os resultados do gd libertam-se com gdFree(), os do libjpeg com free()
+static void free_encoded(int variant, void *data) {
+    if (variant == 0) {
+        gdFree(data);
+    } else {
+        free(data);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int reps = 3;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+        reps = atoi(argv[2]);
+        first = 3;
+    }
+    if (first >= argc || reps <= 0) {
+        fprintf(stderr, "Uso: %s [-n repeticoes] <ficheiro.jpeg>...\n", argv[0]);
+        exit(1);
+    }
+
+    BenchTotal dec[NUM_DECODERS], enc[NUM_ENCODERS];
+    for (int v = 0; v < NUM_DECODERS; v++) {
+        dec[v] = (BenchTotal){ 0, 0, 1000 };
+    }
+    for (int v = 0; v < NUM_ENCODERS; v++) {
+        enc[v] = (BenchTotal){ 0, 0, 1000 };
+    }
+
+    for (int f = first; f < argc; f++) {
+        int size;
+        void *data = read_file_data(argv[f], &size);
+        if (!data) {
+            fprintf(stderr, "Erro ao ler %s\n", argv[f]);
+            continue;
+        }
+        Pixmap *ref = decode_gd(data, size, 0);
+        if (!ref) {
+            fprintf(stderr, "Erro ao descodificar %s\n", argv[f]);
+            free(data);
+            continue;
+        }
+        printf("%s (%dx%d)\n", argv[f], ref->width, ref->height);
+
+        //DESCODIFICACAO: tempo medio e diferenca para o gd
+        for (int v = 0; v < NUM_DECODERS; v++) {
+            Pixmap *pix = NULL;
+            double t0 = now();
+            for (int r = 0; r < reps; r++) {
+                pixmap_destroy(pix);
+                pix = decoders[v].decode(data, size, decoders[v].flags);
+            }
+            double t = (now() - t0) / reps;
+            if (!pix) {
+                printf("  decode %-14s falhou (CMYK?)\n", decoders[v].name);
+                continue;
+            }
+            double psnr = image_psnr(pix, ref);
+            printf("  decode %-14s %8.2f ms", decoders[v].name, t * 1000);
+            print_psnr(psnr);
+            printf("\n");
+            dec[v].time += t;
+            if (psnr < dec[v].psnr_min) {
+                dec[v].psnr_min = psnr;
+            }
+            pixmap_destroy(pix);
+        }
+
+        //CODIFICACAO da imagem descodificada: tempo, bytes e o que volta
+        for (int v = 0; v < NUM_ENCODERS; v++) {
+            JpegEncodeSettings settings = JPEG_ENCODE_DEFAULTS;
+            jpeg_parse_settings(encoders[v].settings, &settings);
+            void *out = NULL;
+            int out_size = 0;
+            double t0 = now();
+            for (int r = 0; r < reps; r++) {
+                if (out) {
+                    free_encoded(v, out);
+                }
+                if (v == 0) {
+                    out = encode_gd(ref, &settings, &out_size);
+                } else {
+                    out = jpeg_encode_rgb(ref, &settings, &out_size);
+                }
+            }
+            double t = (now() - t0) / reps;
+            if (!out) {
+                printf("  encode %-14s falhou\n", encoders[v].name);
+                continue;
+            }
+            Pixmap *back = decode_gd(out, out_size, 0);
+            double psnr = back ? image_psnr(back, ref) : 0;
+            printf("  encode %-14s %8.2f ms %8d bytes", encoders[v].name, t * 1000, out_size);
+            print_psnr(psnr);
+            printf("\n");
+            enc[v].time += t;
+            enc[v].bytes += out_size;
+            if (psnr < enc[v].psnr_min) {
+                enc[v].psnr_min = psnr;
+            }
+            pixmap_destroy(back);
+            free_encoded(v, out);
+        }
+        pixmap_destroy(ref);
+        free(data);
+    }
+
+    printf("=== Total (PSNR da pior imagem) ===\n");
+    for (int v = 0; v < NUM_DECODERS; v++) {
+        printf("  decode %-14s %8.2f ms %5.2fx", decoders[v].name, dec[v].time * 1000,
+               dec[v].time > 0 ? dec[0].time / dec[v].time : 0);
+        print_psnr(dec[v].psnr_min);
+        printf("\n");
+    }
+    for (int v = 0; v < NUM_ENCODERS; v++) {
+        printf("  encode %-14s %8.2f ms %5.2fx %10lld bytes", encoders[v].name, enc[v].time * 1000,
+               enc[v].time > 0 ? enc[0].time / enc[v].time : 0, enc[v].bytes);
+        print_psnr(enc[v].psnr_min);
+        printf("\n");
+    }
+    return 0;
+}
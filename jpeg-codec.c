@@ -0,0 +1,490 @@
+#include "jpeg-codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <jerror.h>
+
+// O tratamento de erros por omissao do libjpeg faz exit(): aqui volta-se
+// ao setjmp e a imagem falha sozinha
+typedef struct {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jump;
+} CodecError;
+
+static void codec_error_exit(j_common_ptr cinfo) {
+    CodecError *err = (CodecError *)cinfo->err;
+    char message[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, message);
+    fprintf(stderr, "\tErro no libjpeg: %s\n", message);
+    longjmp(err->jump, 1);
+}
+
+// Sem mensagem: para quem so espreita o cabecalho de um ficheiro cujo
+// erro ja foi escrito
+static void codec_quiet_exit(j_common_ptr cinfo) {
+    longjmp(((CodecError *)cinfo->err)->jump, 1);
+}
+
+static void codec_output_message(j_common_ptr cinfo) {
+    (void)cinfo;                  // avisos (dados corrompidos recuperaveis) calados
+}
+
+static void set_decode_flags(struct jpeg_decompress_struct *cinfo, int flags) {
+    if (flags & JPEG_FAST_DCT) {
+        cinfo->dct_method = JDCT_IFAST;
+    }
+    if (flags & JPEG_FAST_UPSAMPLE) {
+        cinfo->do_fancy_upsampling = FALSE;
+    }
+}
+
+// Destino em memoria com o buffer sob controlo do codec: o jpeg_mem_dest()
+// troca o buffer por dentro ao crescer, e depois de um longjmp nao se sabe
+// se o ponteiro de quem chamou ainda e o atual. Aqui so o MemDest guarda o
+// buffer, e o caminho de erro liberta-o uma unica vez
+typedef struct {
+    struct jpeg_destination_mgr mgr;
+    unsigned char *buffer;
+    size_t capacity;
+    size_t size;                  // bytes escritos (depois do term_destination)
+} MemDest;
+
+#define MEM_DEST_MIN 65536
+
+static void mem_init_destination(j_compress_ptr cinfo) {
+    MemDest *dest = (MemDest *)cinfo->dest;
+    dest->mgr.next_output_byte = dest->buffer;
+    dest->mgr.free_in_buffer = dest->capacity;
+}
+
+static boolean mem_empty_output_buffer(j_compress_ptr cinfo) {
+    MemDest *dest = (MemDest *)cinfo->dest;
+    unsigned char *bigger = realloc(dest->buffer, dest->capacity * 2);
+    if (!bigger) {
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+    }
+    dest->buffer = bigger;
+    dest->mgr.next_output_byte = bigger + dest->capacity;
+    dest->mgr.free_in_buffer = dest->capacity;
+    dest->capacity *= 2;
+    return TRUE;
+}
+
+static void mem_term_destination(j_compress_ptr cinfo) {
+    MemDest *dest = (MemDest *)cinfo->dest;
+    dest->size = dest->capacity - dest->mgr.free_in_buffer;
+}
+
+// Um quarto dos pixeis chega para quase todas as JPEG com qualidade 70
+static int mem_dest_init(MemDest *dest, j_compress_ptr cinfo, size_t expected) {
+    dest->capacity = expected > MEM_DEST_MIN ? expected : MEM_DEST_MIN;
+    dest->buffer = malloc(dest->capacity);
+    dest->size = 0;
+    if (!dest->buffer) {
+        return 0;
+    }
+    dest->mgr.init_destination = mem_init_destination;
+    dest->mgr.empty_output_buffer = mem_empty_output_buffer;
+    dest->mgr.term_destination = mem_term_destination;
+    cinfo->dest = &dest->mgr;
+    return 1;
+}
+
+// Depois de jpeg_set_defaults(), que volta a por a DCT exata e o 4:2:0
+static void set_encode_settings(struct jpeg_compress_struct *cinfo, const JpegEncodeSettings *settings) {
+    jpeg_set_quality(cinfo, settings->quality, TRUE);
+    cinfo->optimize_coding = settings->optimize ? TRUE : FALSE;
+    cinfo->dct_method = settings->fast_dct ? JDCT_IFAST : JDCT_ISLOW;
+    if (cinfo->num_components == 3) {
+        // o Cb e o Cr ficam a 1x1: a resolucao deles e a do Y dividida por estes
+        cinfo->comp_info[0].h_samp_factor = settings->subsampling == JPEG_SUBSAMPLE_444 ? 1 : 2;
+        cinfo->comp_info[0].v_samp_factor = settings->subsampling == JPEG_SUBSAMPLE_420 ? 2 : 1;
+    }
+    cinfo->density_unit = 1;      // 96 dpi como o gd
+    cinfo->X_density = 96;
+    cinfo->Y_density = 96;
+}
+
+// Linha RGB intercalada do libjpeg -> planos do pixmap
+static void split_rgb_row(const unsigned char *rgb, Pixmap *pix, int y) {
+    unsigned char *r = PIXMAP_ROW(pix, 0, y);
+    unsigned char *g = PIXMAP_ROW(pix, 1, y);
+    unsigned char *b = PIXMAP_ROW(pix, 2, y);
+    for (int x = 0; x < pix->width; x++) {
+        r[x] = rgb[3 * x];
+        g[x] = rgb[3 * x + 1];
+        b[x] = rgb[3 * x + 2];
+    }
+}
+
+// Planos do pixmap -> linha RGB intercalada para o libjpeg
+static void merge_rgb_row(const Pixmap *pix, int y, unsigned char *rgb) {
+    const unsigned char *r = PIXMAP_ROW(pix, 0, y);
+    const unsigned char *g = PIXMAP_ROW(pix, 1, y);
+    const unsigned char *b = PIXMAP_ROW(pix, 2, y);
+    for (int x = 0; x < pix->width; x++) {
+        rgb[3 * x] = r[x];
+        rgb[3 * x + 1] = g[x];
+        rgb[3 * x + 2] = b[x];
+    }
+}
+
+
+// Conversao YCbCr -> RGB com a mesma aritmetica inteira do libjpeg
+// (jdcolor.c, 16 bits de fracao), para dar os mesmos pixeis que o JCS_RGB.
+// Cada constante fica partida num multiplo de 2^16, que passa para fora
+// do shift, e num resto que cabe em 16 bits com sinal: assim o compilador
+// usa multiplicacoes de 16 bits (pmullw/pmulhw) e vectoriza o ciclo. Da o
+// mesmo que a formula original para todos os Cb/Cr
+#define YCC_BITS 16
+#define YCC_ONE (1 << YCC_BITS)
+#define YCC_HALF (1 << (YCC_BITS - 1))
+#define YCC_FIX(x) ((int)((x) * YCC_ONE + 0.5))
+#define YCC_CR_R (YCC_FIX(1.40200) - YCC_ONE)          // r = y + cr + ...
+#define YCC_CB_B (YCC_FIX(1.77200) - 2 * YCC_ONE)      // b = y + 2 * cb + ...
+#define YCC_CB_G (-YCC_FIX(0.34414))
+#define YCC_CR_G (YCC_ONE - YCC_FIX(0.71414))          // g = y - cr + ...
+
+static inline unsigned char clamp_u8(int v) {
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+// Planos Y, Cb e Cr contiguos -> planos RGB
+static void ycc_to_rgb(const unsigned char *restrict l, const unsigned char *restrict cb,
+                       const unsigned char *restrict cr, unsigned char *restrict r,
+                       unsigned char *restrict g, unsigned char *restrict b, int width) {
+    for (int x = 0; x < width; x++) {
+        short u = cb[x] - 128;
+        short v = cr[x] - 128;
+        int lum = l[x];
+        r[x] = clamp_u8(lum + v + ((YCC_CR_R * v + YCC_HALF) >> YCC_BITS));
+        g[x] = clamp_u8(lum - v + ((YCC_CB_G * u + YCC_CR_G * v + YCC_HALF) >> YCC_BITS));
+        b[x] = clamp_u8(lum + 2 * u + ((YCC_CB_B * u + YCC_HALF) >> YCC_BITS));
+    }
+}
+
+// Linha YCbCr intercalada -> plano Y (luma) e planos RGB do pixmap: o Y
+// vai direto para a luma e o Cb/Cr para chroma (2 * width) antes de converter
+static void split_ycc_row(const unsigned char *ycc, unsigned char *chroma,
+                          Pixmap *pix, Pixmap *luma, int y) {
+    int width = pix->width;
+    unsigned char *l = PIXMAP_ROW(luma, 0, y);
+    unsigned char *cb = chroma;
+    unsigned char *cr = chroma + width;
+    for (int x = 0; x < width; x++) {
+        l[x] = ycc[3 * x];
+        cb[x] = ycc[3 * x + 1];
+        cr[x] = ycc[3 * x + 2];
+    }
+    ycc_to_rgb(l, cb, cr, PIXMAP_ROW(pix, 0, y), PIXMAP_ROW(pix, 1, y), PIXMAP_ROW(pix, 2, y), width);
+}
+
+// Linha cinzenta -> plano Y e os tres planos RGB iguais
+static void split_gray_row(const unsigned char *gray, Pixmap *pix, Pixmap *luma, int y) {
+    memcpy(PIXMAP_ROW(luma, 0, y), gray, pix->width);
+    for (int c = 0; c < 3; c++) {
+        memcpy(PIXMAP_ROW(pix, c, y), gray, pix->width);
+    }
+}
+
+
+/******************************************************************************
+ * jpeg_decode_rgb()
+ *
+ * Arguments: data, size - JPEG file in memory
+ *            flags - JPEG_FAST_DCT | JPEG_FAST_UPSAMPLE, or 0
+ * Returns: 3-channel pixmap, or NULL if the file is CMYK/YCCK or fails
+ *          to decode
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+Pixmap *jpeg_decode_rgb(const void *data, int size, int flags) {
+    return jpeg_decode_rgb_luma(data, size, flags, NULL);
+}
+
+
+/******************************************************************************
+ * jpeg_decode_rgb_luma()
+ *
+ * Arguments: data, size - JPEG file in memory
+ *            flags - JPEG_FAST_DCT | JPEG_FAST_UPSAMPLE, or 0
+ *            luma - where to store the 1-channel luminance pixmap, or NULL
+ * Returns: 3-channel pixmap, or NULL if the file is CMYK/YCCK or fails
+ *          to decode (then *luma is NULL too)
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+Pixmap *jpeg_decode_rgb_luma(const void *data, int size, int flags, Pixmap **luma) {
+    struct jpeg_decompress_struct cinfo;
+    CodecError err;
+    Pixmap *volatile pix = NULL;
+    Pixmap *volatile lum = NULL;
+    unsigned char *volatile rows = NULL;
+    JSAMPROW row[JPEG_BATCH_ROWS];
+
+    if (luma) {
+        *luma = NULL;
+    }
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = codec_error_exit;
+    err.mgr.output_message = codec_output_message;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        pixmap_destroy(pix);
+        pixmap_destroy(lum);
+        free(rows);
+        return NULL;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (const unsigned char *)data, size);
+    jpeg_read_header(&cinfo, TRUE);
+
+    // o gd trata do CMYK invertido que o Photoshop escreve
+    if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        jpeg_destroy_decompress(&cinfo);
+        return NULL;
+    }
+    // Com luma o libjpeg so amplia o Cb/Cr e a cor converte-se aqui, para
+    // o Y sair da mesma descodificacao. Outros espacos (RGB guardado como
+    // RGB) ficam sem luma e o gray calcula-a do RGB
+    int ycc = luma && cinfo.jpeg_color_space == JCS_YCbCr;
+    int gray = luma && cinfo.jpeg_color_space == JCS_GRAYSCALE;
+    cinfo.out_color_space = ycc ? JCS_YCbCr : gray ? JCS_GRAYSCALE : JCS_RGB;
+    set_decode_flags(&cinfo, flags);
+    jpeg_start_decompress(&cinfo);
+
+    int width = cinfo.output_width;
+    int components = cinfo.output_components;
+    pix = pixmap_create(width, cinfo.output_height, 3);
+    if (ycc || gray) {
+        lum = pixmap_create(width, cinfo.output_height, 1);
+    }
+    // no YCbCr, mais 2 * width para o Cb/Cr separados de uma linha
+    rows = malloc((size_t)width * components * JPEG_BATCH_ROWS + (ycc ? (size_t)width * 2 : 0));
+    if (!pix || !rows || ((ycc || gray) && !lum)) {
+        jpeg_destroy_decompress(&cinfo);
+        pixmap_destroy(pix);
+        pixmap_destroy(lum);
+        free(rows);
+        return NULL;
+    }
+    for (int i = 0; i < JPEG_BATCH_ROWS; i++) {
+        row[i] = rows + (size_t)i * width * components;
+    }
+    while (cinfo.output_scanline < cinfo.output_height) {
+        int y = cinfo.output_scanline;
+        int n = jpeg_read_scanlines(&cinfo, row, JPEG_BATCH_ROWS);
+        for (int i = 0; i < n; i++) {
+            if (ycc) {
+                split_ycc_row(row[i], rows + (size_t)width * 3 * JPEG_BATCH_ROWS, pix, lum, y + i);
+            } else if (gray) {
+                split_gray_row(row[i], pix, lum, y + i);
+            } else {
+                split_rgb_row(row[i], pix, y + i);
+            }
+        }
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    free(rows);
+    if (luma) {
+        *luma = lum;
+    }
+    return pix;
+}
+
+
+/******************************************************************************
+ * jpeg_is_cmyk()
+ *
+ * Arguments: data, size - JPEG file in memory
+ * Returns: (bool) 1 if the header says CMYK/YCCK, 0 otherwise (also when
+ *          the header can't be read)
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int jpeg_is_cmyk(const void *data, int size) {
+    struct jpeg_decompress_struct cinfo;
+    CodecError err;
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = codec_quiet_exit;
+    err.mgr.output_message = codec_output_message;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        return 0;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (const unsigned char *)data, size);
+    jpeg_read_header(&cinfo, TRUE);
+    int cmyk = cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK;
+    jpeg_destroy_decompress(&cinfo);
+    return cmyk;
+}
+
+
+/******************************************************************************
+ * jpeg_encode_rgb()
+ *
+ * Arguments: pix - pixmap (planes 0..2)
+ *            settings - quality, subsampling, Huffman and DCT options
+ *            size - where to store the number of bytes
+ * Returns: JPEG file (free with free()), or NULL in case of failure
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+void *jpeg_encode_rgb(const Pixmap *pix, const JpegEncodeSettings *settings, int *size) {
+    struct jpeg_compress_struct cinfo;
+    CodecError err;
+    MemDest dest = { .buffer = NULL };
+    unsigned char *volatile rows = NULL;
+    JSAMPROW row[JPEG_BATCH_ROWS];
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = codec_error_exit;
+    err.mgr.output_message = codec_output_message;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(dest.buffer);
+        free(rows);
+        return NULL;
+    }
+
+    rows = malloc((size_t)pix->width * 3 * JPEG_BATCH_ROWS);
+    if (!rows) {
+        return NULL;
+    }
+    for (int i = 0; i < JPEG_BATCH_ROWS; i++) {
+        row[i] = rows + (size_t)i * pix->width * 3;
+    }
+
+    jpeg_create_compress(&cinfo);
+    if (!mem_dest_init(&dest, &cinfo, (size_t)pix->width * pix->height / 4)) {
+        jpeg_destroy_compress(&cinfo);
+        free(rows);
+        return NULL;
+    }
+    cinfo.image_width = pix->width;
+    cinfo.image_height = pix->height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    set_encode_settings(&cinfo, settings);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        int y = cinfo.next_scanline;
+        int n = pix->height - y < JPEG_BATCH_ROWS ? pix->height - y : JPEG_BATCH_ROWS;
+        for (int i = 0; i < n; i++) {
+            merge_rgb_row(pix, y + i, row[i]);
+        }
+        jpeg_write_scanlines(&cinfo, row, n);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(rows);
+
+    *size = (int)dest.size;
+    return dest.buffer;
+}
+
+
+/******************************************************************************
+ * jpeg_encode_gray()
+ *
+ * Arguments: gray - pixmap (only plane 0 is used)
+ *            settings - quality, Huffman and DCT options
+ *            size - where to store the number of bytes
+ * Returns: single-component JPEG (free with free()), or NULL in case of
+ *          failure
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+void *jpeg_encode_gray(const Pixmap *gray, const JpegEncodeSettings *settings, int *size) {
+    struct jpeg_compress_struct cinfo;
+    CodecError err;
+    MemDest dest = { .buffer = NULL };
+
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = codec_error_exit;
+    err.mgr.output_message = codec_output_message;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        free(dest.buffer);
+        return NULL;
+    }
+
+    jpeg_create_compress(&cinfo);
+    if (!mem_dest_init(&dest, &cinfo, (size_t)gray->width * gray->height / 8)) {
+        jpeg_destroy_compress(&cinfo);
+        return NULL;
+    }
+    cinfo.image_width = gray->width;
+    cinfo.image_height = gray->height;
+    cinfo.input_components = 1;
+    cinfo.in_color_space = JCS_GRAYSCALE;
+    jpeg_set_defaults(&cinfo);
+    set_encode_settings(&cinfo, settings);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = PIXMAP_ROW(gray, 0, cinfo.next_scanline);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    *size = (int)dest.size;
+    return dest.buffer;
+}
+
+
+/******************************************************************************
+ * jpeg_parse_settings()
+ *
+ * Arguments: list - comma separated items: q=N, 420, 422, 444, opt, fast-dct
+ *            settings - settings to change
+ * Returns: (bool) 1 in case of success, 0 if some item is invalid
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int jpeg_parse_settings(const char *list, JpegEncodeSettings *settings) {
+    JpegEncodeSettings parsed = *settings;
+    char item[32];
+
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        if (len == 0 || len >= sizeof(item)) {
+            return 0;
+        }
+        memcpy(item, list, len);
+        item[len] = '\0';
+        list += len + (list[len] == ',');
+
+        if (strncmp(item, "q=", 2) == 0) {
+            char *end;
+            long q = strtol(item + 2, &end, 10);
+            if (end == item + 2 || *end || q < 1 || q > 100) {
+                return 0;
+            }
+            parsed.quality = (int)q;
+        } else if (strcmp(item, "420") == 0) {
+            parsed.subsampling = JPEG_SUBSAMPLE_420;
+        } else if (strcmp(item, "422") == 0) {
+            parsed.subsampling = JPEG_SUBSAMPLE_422;
+        } else if (strcmp(item, "444") == 0) {
+            parsed.subsampling = JPEG_SUBSAMPLE_444;
+        } else if (strcmp(item, "opt") == 0) {
+            parsed.optimize = 1;
+        } else if (strcmp(item, "fast-dct") == 0) {
+            parsed.fast_dct = 1;
+        } else {
+            return 0;
+        }
+    }
+    *settings = parsed;
+    return 1;
+}
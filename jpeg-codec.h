@@ -0,0 +1,123 @@
+#ifndef JPEG_CODEC_H
+#define JPEG_CODEC_H
+
+#include "pixmap.h"
+
+#define JPEG_QUALITY 70           // a mesma do encode_jpeg_data()
+#define JPEG_BATCH_ROWS 16        // linhas passadas ao libjpeg de cada vez
+
+// Opcoes da descodificacao (podem juntar-se com |)
+#define JPEG_FAST_DCT 1           // IDCT inteira rapida (JDCT_IFAST), menos exata
+#define JPEG_FAST_UPSAMPLE 2      // Cb/Cr ampliados por replicacao, sem interpolar
+
+// Resolucao do Cb/Cr na codificacao
+typedef enum {
+    JPEG_SUBSAMPLE_420,           // metade nas duas direcoes (a do gd)
+    JPEG_SUBSAMPLE_422,           // metade na horizontal
+    JPEG_SUBSAMPLE_444            // sem reducao
+} JpegSubsampling;
+
+// Parametros de codificacao de um resultado
+typedef struct {
+    int quality;                  // 1..100
+    JpegSubsampling subsampling;  // ignorado no gray (um so componente)
+    int optimize;                 // tabelas de Huffman da propria imagem (mais pequena)
+    int fast_dct;                 // DCT inteira rapida (JDCT_IFAST)
+} JpegEncodeSettings;
+
+// Os mesmos parametros com que o gd codifica (gdImageJpegPtr com qualidade 70)
+#define JPEG_ENCODE_DEFAULTS { JPEG_QUALITY, JPEG_SUBSAMPLE_420, 0, 0 }
+
+
+/******************************************************************************
+ * jpeg_decode_rgb()
+ *
+ * Arguments: data, size - JPEG file in memory
+ *            flags - JPEG_FAST_DCT | JPEG_FAST_UPSAMPLE, or 0
+ * Returns: 3-channel pixmap, or NULL if the file is CMYK/YCCK or fails
+ *          to decode
+ * Side-Effects: none
+ *
+ * Description: libjpeg decodes JPEG_BATCH_ROWS rows at a time into a small
+ *              RGB buffer that is split straight into the pixmap planes,
+ *              without the int-per-pixel gd image. With flags 0 the pixels
+ *              are the same as gdImageCreateFromJpegPtr() gives; CMYK files
+ *              are left to gd, which handles the inverted Adobe CMYK
+ *
+ *****************************************************************************/
+Pixmap *jpeg_decode_rgb(const void *data, int size, int flags);
+
+/******************************************************************************
+ * jpeg_decode_rgb_luma()
+ *
+ * Arguments: data, size - JPEG file in memory
+ *            flags - JPEG_FAST_DCT | JPEG_FAST_UPSAMPLE, or 0
+ *            luma - where to store the 1-channel luminance pixmap, or NULL
+ * Returns: 3-channel pixmap, or NULL if the file is CMYK/YCCK or fails
+ *          to decode (then *luma is NULL too)
+ * Side-Effects: none
+ *
+ * Description: one decode for both: libjpeg is asked for JCS_YCbCr, so it
+ *              does the IDCT and the chroma upsampling but no color
+ *              conversion; each row gives the Y plane as it is and is
+ *              converted to RGB here with libjpeg's own integer formula, so
+ *              the RGB pixels are the same as jpeg_decode_rgb() gives.
+ *              *luma stays NULL for files that are not YCbCr/grayscale
+ *
+ *****************************************************************************/
+Pixmap *jpeg_decode_rgb_luma(const void *data, int size, int flags, Pixmap **luma);
+
+/******************************************************************************
+ * jpeg_is_cmyk()
+ *
+ * Arguments: data, size - JPEG file in memory
+ * Returns: (bool) 1 if the header says CMYK/YCCK, 0 otherwise (also when
+ *          the header can't be read)
+ * Side-Effects: none
+ *
+ * Description: only reads the header, quietly. Tells a file the decoders
+ *              above leave to gd from one libjpeg could not decode
+ *
+ *****************************************************************************/
+int jpeg_is_cmyk(const void *data, int size);
+
+/******************************************************************************
+ * jpeg_encode_rgb()
+ *
+ * Arguments: pix - pixmap (planes 0..2; alpha is dropped, as gd does)
+ *            settings - quality, subsampling, Huffman and DCT options
+ *            size - where to store the number of bytes
+ * Returns: JPEG file (free with free()), or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: with JPEG_ENCODE_DEFAULTS the file has the same image data
+ *              as gdImageJpegPtr() writes (only gd's COM marker is missing)
+ *
+ *****************************************************************************/
+void *jpeg_encode_rgb(const Pixmap *pix, const JpegEncodeSettings *settings, int *size);
+
+/******************************************************************************
+ * jpeg_encode_gray()
+ *
+ * Arguments: gray - pixmap (only plane 0 is used)
+ *            settings - quality, Huffman and DCT options
+ *            size - where to store the number of bytes
+ * Returns: single-component JPEG (free with free()), or NULL in case of
+ *          failure
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+void *jpeg_encode_gray(const Pixmap *gray, const JpegEncodeSettings *settings, int *size);
+
+/******************************************************************************
+ * jpeg_parse_settings()
+ *
+ * Arguments: list - comma separated items: q=N, 420, 422, 444, opt, fast-dct
+ *            settings - settings to change (items not in the list are kept)
+ * Returns: (bool) 1 in case of success, 0 if some item is invalid
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int jpeg_parse_settings(const char *list, JpegEncodeSettings *settings);
+
+#endif
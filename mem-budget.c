@@ -0,0 +1,382 @@
+#include "mem-budget.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Reserva de uma imagem em curso (pid para recuperar as de processos mortos)
+typedef struct {
+    int pid;                      // 0 = livre
+    long long bytes;
+} MemReservation;
+
+// Estado partilhado pelas threads e pelos processos trabalhadores
+typedef struct {
+    pthread_mutex_t mutex;        // robusto e partilhado entre processos
+    pthread_cond_t released;
+    long long budget;
+    long long in_use;
+    long long peak;
+    int running;                  // imagens admitidas e por acabar
+    unsigned long admitted;
+    unsigned long waited;         // admissoes que tiveram de esperar
+    unsigned long turns;          // vezes que uma imagem esfomeada ficou com a vez
+    double wait_time;
+    unsigned long next_ticket;    // ordem de chegada das esperas
+    unsigned long turn_ticket;    // espera que tem a vez (0 = nenhuma)
+    int turn_pid;
+    MemReservation res[MEM_MAX_RESERVATIONS];
+} MemShared;
+
+static MemShared *mem_shared = NULL;
+
+
+static void mem_lock(void) {
+    int r = pthread_mutex_lock(&mem_shared->mutex);
+#ifdef PTHREAD_MUTEX_ROBUST
+    if (r == EOWNERDEAD) {
+        pthread_mutex_consistent(&mem_shared->mutex);
+    }
+#else
+    (void)r;
+#endif
+}
+
+static void mem_timed_wait(void) {
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += 100000000;   // acorda de vez em quando para ver mortos
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_nsec -= 1000000000;
+        until.tv_sec++;
+    }
+    int r = pthread_cond_timedwait(&mem_shared->released, &mem_shared->mutex, &until);
+#ifdef PTHREAD_MUTEX_ROBUST
+    if (r == EOWNERDEAD) {
+        pthread_mutex_consistent(&mem_shared->mutex);
+    }
+#else
+    (void)r;
+#endif
+}
+
+// Devolve as reservas de processos que morreram a meio de uma imagem
+static void reclaim_dead(void) {
+    for (int i = 0; i < MEM_MAX_RESERVATIONS; i++) {
+        MemReservation *r = &mem_shared->res[i];
+        if (r->pid && kill(r->pid, 0) != 0 && errno == ESRCH) {
+            mem_shared->in_use -= r->bytes;
+            mem_shared->running--;
+            r->pid = 0;
+        }
+    }
+    if (mem_shared->turn_ticket && kill(mem_shared->turn_pid, 0) != 0 && errno == ESRCH) {
+        mem_shared->turn_ticket = 0;
+    }
+}
+
+// ticket: o da espera que pergunta (0 = ainda nao esperou)
+static int admissible(long long bytes, unsigned long ticket) {
+    if (mem_shared->turn_ticket && mem_shared->turn_ticket != ticket) {
+        return 0;                 // uma imagem esfomeada tem a vez
+    }
+    if (mem_shared->running == 0) {
+        return 1;                 // maior do que o orcamento: corre sozinha
+    }
+    return mem_shared->in_use + bytes <= mem_shared->budget;
+}
+
+static int free_slot(void) {
+    for (int i = 0; i < MEM_MAX_RESERVATIONS; i++) {
+        if (mem_shared->res[i].pid == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/******************************************************************************
+ * mem_budget_enable()
+ *
+ * Arguments: bytes - pixel memory allowed for all images in flight
+ * Returns: (bool) 1 if enabled, 0 in case of failure
+ * Side-Effects: allocates the budget in shared memory
+ *
+ *****************************************************************************/
+int mem_budget_enable(long long bytes) {
+    MemShared *shm = mmap(NULL, sizeof(MemShared), PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shm == MAP_FAILED) {
+        return 0;
+    }
+    memset(shm, 0, sizeof(MemShared));
+    shm->budget = bytes;
+
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+#ifdef PTHREAD_MUTEX_ROBUST
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+#endif
+    pthread_mutex_init(&shm->mutex, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&shm->released, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    mem_shared = shm;
+    return 1;
+}
+
+int mem_budget_enabled(void) {
+    return mem_shared != NULL;
+}
+
+
+// Procura o SOF nos segmentos a seguir ao SOI. Devolve 1 se o encontrou
+static int read_sof(FILE *fp, int *width, int *height) {
+    int found = 0;
+    if (fgetc(fp) != 0xFF || fgetc(fp) != 0xD8) {
+        return 0;
+    }
+    while (!found) {
+        int c = fgetc(fp);
+        if (c != 0xFF) {
+            break;                // lixo entre segmentos: desiste
+        }
+        int marker;
+        do {
+            marker = fgetc(fp);   // 0xFF repetidos sao enchimento
+        } while (marker == 0xFF);
+        if (marker == EOF || marker == 0xD9 || marker == 0xDA) {
+            break;                // fim ou dados de imagem sem SOF
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+            continue;             // marcadores sem comprimento
+        }
+        int hi = fgetc(fp), lo = fgetc(fp);
+        if (hi == EOF || lo == EOF) {
+            break;
+        }
+        int length = (hi << 8) | lo;
+
+        // SOF0..SOF15, menos DHT (C4), JPG (C8) e DAC (CC)
+        if (marker >= 0xC0 && marker <= 0xCF &&
+            marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            unsigned char sof[5];
+            if (fread(sof, 1, 5, fp) == 5) {
+                *height = (sof[1] << 8) | sof[2];
+                *width = (sof[3] << 8) | sof[4];
+                found = *width > 0 && *height > 0;
+            }
+            break;
+        }
+        if (length < 2 || fseek(fp, length - 2, SEEK_CUR) != 0) {
+            break;
+        }
+    }
+    return found;
+}
+
+
+/******************************************************************************
+ * jpeg_read_size()
+ *
+ * Arguments: path - JPEG file
+ *            width, height - where to store the size
+ * Returns: (bool) 1 if a SOF marker was found, 0 otherwise
+ * Side-Effects: reads only the headers of the file
+ *
+ *****************************************************************************/
+int jpeg_read_size(const char *path, int *width, int *height) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return 0;
+    }
+    int found = read_sof(fp, width, height);
+    fclose(fp);
+    return found;
+}
+
+
+/******************************************************************************
+ * mem_predict_bytes()
+ *
+ * Arguments: path - JPEG file
+ * Returns: predicted peak pixel memory to process it
+ * Side-Effects: reads only the headers of the file
+ *
+ *****************************************************************************/
+long long mem_predict_bytes(const char *path) {
+    int width, height;
+    if (jpeg_read_size(path, &width, &height)) {
+        return (long long)width * height * MEM_BYTES_PER_PIXEL * MEM_LIVE_COPIES;
+    }
+    // sem cabecalho: uma JPEG tem tipicamente ~1/10 dos bytes RGB
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        return (long long)st.st_size * 10 / 3 * MEM_BYTES_PER_PIXEL * MEM_LIVE_COPIES;
+    }
+    return 0;
+}
+
+
+/******************************************************************************
+ * mem_predict_bytes_data()
+ *
+ * Arguments: data, size - JPEG file in memory
+ * Returns: predicted peak pixel memory to process it
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+long long mem_predict_bytes_data(const void *data, int size) {
+    int width, height;
+    int found = 0;
+    FILE *fp = fmemopen((void *)data, size, "rb");
+    if (fp) {
+        found = read_sof(fp, &width, &height);
+        fclose(fp);
+    }
+    if (found) {
+        return (long long)width * height * MEM_BYTES_PER_PIXEL * MEM_LIVE_COPIES;
+    }
+    return (long long)size * 10 / 3 * MEM_BYTES_PER_PIXEL * MEM_LIVE_COPIES;
+}
+
+
+/******************************************************************************
+ * mem_budget_fits()
+ *
+ * Arguments: bytes - predicted footprint
+ * Returns: (bool) 1 if a job of this size would be admitted right now
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int mem_budget_fits(long long bytes) {
+    if (!mem_shared) {
+        return 1;
+    }
+    mem_lock();
+    int fits = admissible(bytes, 0);
+    pthread_mutex_unlock(&mem_shared->mutex);
+    return fits;
+}
+
+
+/******************************************************************************
+ * mem_budget_acquire()
+ *
+ * Arguments: bytes - predicted footprint
+ * Returns: reservation handle, or -1 if the budget is off
+ * Side-Effects: blocks until the job fits
+ *
+ *****************************************************************************/
+int mem_budget_acquire(long long bytes) {
+    if (!mem_shared) {
+        return -1;
+    }
+    struct timespec start, end;
+    int waited = 0;
+    unsigned long ticket = 0;
+    int slot = -1;
+
+    mem_lock();
+    while (!admissible(bytes, ticket) || (slot = free_slot()) < 0) {
+        if (!waited) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            ticket = ++mem_shared->next_ticket;
+            waited = 1;
+        }
+        mem_timed_wait();
+        reclaim_dead();
+
+        // ao fim de MEM_STARVE_MS a espera mais antiga fica com a vez
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+        if (ms >= MEM_STARVE_MS &&
+            (mem_shared->turn_ticket == 0 || ticket < mem_shared->turn_ticket)) {
+            if (mem_shared->turn_ticket == 0) {
+                mem_shared->turns++;
+            }
+            mem_shared->turn_ticket = ticket;
+            mem_shared->turn_pid = (int)getpid();
+        }
+    }
+    if (ticket && mem_shared->turn_ticket == ticket) {
+        mem_shared->turn_ticket = 0;
+        pthread_cond_broadcast(&mem_shared->released);
+    }
+    mem_shared->res[slot].pid = (int)getpid();
+    mem_shared->res[slot].bytes = bytes;
+    mem_shared->in_use += bytes;
+    mem_shared->running++;
+    if (mem_shared->in_use > mem_shared->peak) {
+        mem_shared->peak = mem_shared->in_use;
+    }
+    mem_shared->admitted++;
+    if (waited) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        mem_shared->waited++;
+        mem_shared->wait_time += (end.tv_sec - start.tv_sec) +
+                                 (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+    }
+    pthread_mutex_unlock(&mem_shared->mutex);
+    return slot;
+}
+
+
+/******************************************************************************
+ * mem_budget_release()
+ *
+ * Arguments: handle - value returned by mem_budget_acquire()
+ * Returns: none
+ * Side-Effects: wakes the jobs waiting for memory
+ *
+ *****************************************************************************/
+void mem_budget_release(int handle) {
+    if (!mem_shared || handle < 0 || handle >= MEM_MAX_RESERVATIONS) {
+        return;
+    }
+    mem_lock();
+    MemReservation *r = &mem_shared->res[handle];
+    if (r->pid) {
+        mem_shared->in_use -= r->bytes;
+        mem_shared->running--;
+        r->pid = 0;
+    }
+    pthread_cond_broadcast(&mem_shared->released);
+    pthread_mutex_unlock(&mem_shared->mutex);
+}
+
+
+/******************************************************************************
+ * mem_budget_report()
+ *
+ * Arguments: fp - where to write
+ * Returns: none
+ * Side-Effects: writes budget, peak use, admissions and waits to fp
+ *
+ *****************************************************************************/
+void mem_budget_report(FILE *fp) {
+    if (!mem_shared) {
+        return;
+    }
+    mem_lock();
+    fprintf(fp, "=== Memoria ===\n");
+    fprintf(fp, "Orcamento: %.1f MB, em uso: %.1f MB, pico: %.1f MB\n",
+            mem_shared->budget / 1048576.0, mem_shared->in_use / 1048576.0,
+            mem_shared->peak / 1048576.0);
+    fprintf(fp, "Imagens admitidas: %lu, tiveram de esperar: %lu (%.2fs no total), "
+            "ficaram com a vez: %lu\n",
+            mem_shared->admitted, mem_shared->waited, mem_shared->wait_time, mem_shared->turns);
+    pthread_mutex_unlock(&mem_shared->mutex);
+}
@@ -0,0 +1,116 @@
+#ifndef MEM_BUDGET_H
+#define MEM_BUDGET_H
+
+#include <stdio.h>
+
+// Copias de tamanho total vivas ao mesmo tempo por imagem: a original
+// descodificada, a transformada e a copia gd que vai ser codificada
+#define MEM_LIVE_COPIES 3
+#define MEM_BYTES_PER_PIXEL 4
+#define MEM_MAX_RESERVATIONS 256
+#define MEM_STARVE_MS 200         // espera apos a qual a imagem fica com a vez
+
+
+/******************************************************************************
+ * mem_budget_enable()
+ *
+ * Arguments: bytes - pixel memory allowed for all images in flight
+ * Returns: (bool) 1 if enabled, 0 in case of failure
+ * Side-Effects: allocates the budget in shared memory (must be called
+ *               before creating threads or processes)
+ *
+ *****************************************************************************/
+int mem_budget_enable(long long bytes);
+
+/******************************************************************************
+ * mem_budget_enabled()
+ *
+ * Returns: (bool) 1 if mem_budget_enable() was called
+ *
+ *****************************************************************************/
+int mem_budget_enabled(void);
+
+/******************************************************************************
+ * jpeg_read_size()
+ *
+ * Arguments: path - JPEG file
+ *            width, height - where to store the size
+ * Returns: (bool) 1 if a SOF marker was found, 0 otherwise
+ * Side-Effects: reads only the headers of the file
+ *
+ *****************************************************************************/
+int jpeg_read_size(const char *path, int *width, int *height);
+
+/******************************************************************************
+ * mem_predict_bytes()
+ *
+ * Arguments: path - JPEG file
+ * Returns: predicted peak pixel memory to process it
+ * Side-Effects: reads only the headers of the file
+ *
+ * Description: width x height x MEM_BYTES_PER_PIXEL x MEM_LIVE_COPIES;
+ *              when the header can't be read, a guess from the file size
+ *
+ *****************************************************************************/
+long long mem_predict_bytes(const char *path);
+
+/******************************************************************************
+ * mem_predict_bytes_data()
+ *
+ * Arguments: data, size - JPEG file in memory
+ * Returns: predicted peak pixel memory to process it
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+long long mem_predict_bytes_data(const void *data, int size);
+
+/******************************************************************************
+ * mem_budget_fits()
+ *
+ * Arguments: bytes - predicted footprint
+ * Returns: (bool) 1 if a job of this size would be admitted right now
+ *          (0 while a starved job holds the turn)
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int mem_budget_fits(long long bytes);
+
+/******************************************************************************
+ * mem_budget_acquire()
+ *
+ * Arguments: bytes - predicted footprint
+ * Returns: reservation handle, or -1 if the budget is off
+ * Side-Effects: blocks until the job fits
+ *
+ * Description: a job is admitted when it fits in what is left of the
+ *              budget; a job larger than the whole budget is admitted when
+ *              nothing else is running. Once the oldest waiting job has
+ *              waited MEM_STARVE_MS it holds the turn: no other job is
+ *              admitted until it is, so a big image is not starved by a
+ *              stream of small ones. Reservations of processes that died
+ *              are given back.
+ *
+ *****************************************************************************/
+int mem_budget_acquire(long long bytes);
+
+/******************************************************************************
+ * mem_budget_release()
+ *
+ * Arguments: handle - value returned by mem_budget_acquire()
+ * Returns: none
+ * Side-Effects: wakes the jobs waiting for memory
+ *
+ *****************************************************************************/
+void mem_budget_release(int handle);
+
+/******************************************************************************
+ * mem_budget_report()
+ *
+ * Arguments: fp - where to write
+ * Returns: none
+ * Side-Effects: writes budget, peak use, admissions and waits to fp
+ *
+ *****************************************************************************/
+void mem_budget_report(FILE *fp);
+
+#endif
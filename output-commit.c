@@ -0,0 +1,358 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE               // syncfs()
+#endif
+#include "output-commit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static unsigned long hash_name(const char *s) {
+    unsigned long h = 2166136261UL;
+    for (; *s; s++) {
+        h = (h ^ (unsigned char)*s) * 16777619UL;
+    }
+    return h;
+}
+
+static void nameset_add(NameSet *set, const char *name) {
+    if ((set->count + 1) * 2 > set->capacity) {
+        int old_capacity = set->capacity;
+        char **old = set->slots;
+        set->capacity = old_capacity ? old_capacity * 2 : 256;
+        set->slots = calloc(set->capacity, sizeof(char *));
+        set->count = 0;
+        for (int i = 0; i < old_capacity; i++) {
+            if (old[i]) {
+                nameset_add(set, old[i]);
+                free(old[i]);
+            }
+        }
+        free(old);
+    }
+    unsigned long i = hash_name(name) % set->capacity;
+    while (set->slots[i]) {
+        if (strcmp(set->slots[i], name) == 0) {
+            return;
+        }
+        i = (i + 1) % set->capacity;
+    }
+    set->slots[i] = strdup(name);
+    set->count++;
+}
+
+static int nameset_contains(NameSet *set, const char *name) {
+    if (set->capacity == 0) {
+        return 0;
+    }
+    unsigned long i = hash_name(name) % set->capacity;
+    while (set->slots[i]) {
+        if (strcmp(set->slots[i], name) == 0) {
+            return 1;
+        }
+        i = (i + 1) % set->capacity;
+    }
+    return 0;
+}
+
+static void nameset_free(NameSet *set) {
+    for (int i = 0; i < set->capacity; i++) {
+        free(set->slots[i]);
+    }
+    free(set->slots);
+}
+
+// Le o diario; uma ultima linha sem '\n' (escrita interrompida) e ignorada
+static void load_journal(OutputCommitter *oc, const char *journal_path) {
+    FILE *fp = fopen(journal_path, "r");
+    if (!fp) {
+        return;
+    }
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') {
+            break;
+        }
+        line[len - 1] = '\0';
+        if (line[0]) {
+            nameset_add(&oc->done, line);
+        }
+    }
+    fclose(fp);
+}
+
+// Apaga ficheiros temporarios (".<nome>.tmp.*") deixados por um crash
+static void remove_stale_temporaries(const char *output_dir) {
+    DIR *d = opendir(output_dir);
+    if (!d) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.' && strstr(entry->d_name, ".tmp.")) {
+            char path[4096 + 256];
+            snprintf(path, sizeof(path), "%s/%s", output_dir, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+}
+
+// Uma so escrita com todas as linhas (O_APPEND: atomica entre processos);
+// sem memoria para a juntar, uma escrita por linha
+static void append_journal(OutputCommitter *oc, char **names, int count) {
+    size_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += strlen(names[i]) + 1;
+    }
+    char *buf = malloc(total);
+    if (buf) {
+        size_t pos = 0;
+        for (int i = 0; i < count; i++) {
+            size_t len = strlen(names[i]);
+            memcpy(buf + pos, names[i], len);
+            buf[pos + len] = '\n';
+            pos += len + 1;
+        }
+        if (write(oc->journal_fd, buf, total) != (ssize_t)total) {
+            perror("Erro ao escrever o diario");
+        }
+        free(buf);
+    } else {
+        for (int i = 0; i < count; i++) {
+            char line[512];
+            int len = snprintf(line, sizeof(line), "%s\n", names[i]);
+            if (len >= (int)sizeof(line) || write(oc->journal_fd, line, len) != len) {
+                perror("Erro ao escrever o diario");
+            }
+        }
+    }
+    fdatasync(oc->journal_fd);
+}
+
+// Um sync para todos os ficheiros do lote e depois o diario. Sem oc->mutex:
+// as outras threads continuam a acabar imagens durante o syncfs
+static void commit_batch(OutputCommitter *oc, char **names, int count) {
+#ifdef __linux__
+    if (syncfs(oc->dir_fd) != 0) {
+        sync();
+    }
+#else
+    sync();
+#endif
+
+    pthread_mutex_lock(&oc->journal_mutex);
+    append_journal(oc, names, count);
+    pthread_mutex_unlock(&oc->journal_mutex);
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+}
+
+// Troca a lista pendente por uma vazia (com oc->mutex); NULL sem memoria
+static char **take_pending_locked(OutputCommitter *oc, int *count) {
+    char **fresh = malloc(oc->interval * sizeof(char *));
+    if (!fresh) {
+        return NULL;
+    }
+    char **batch = oc->pending;
+    *count = oc->num_pending;
+    oc->pending = fresh;
+    oc->num_pending = 0;
+    oc->committing++;
+    return batch;
+}
+
+// Sync e diario sem largar oc->mutex (no flush, ou sem memoria para trocar)
+static void commit_pending_locked(OutputCommitter *oc) {
+    if (oc->num_pending == 0) {
+        return;
+    }
+    commit_batch(oc, oc->pending, oc->num_pending);
+    oc->num_pending = 0;
+}
+
+
+/******************************************************************************
+ * output_commit_open()
+ *
+ * Arguments: output_dir - directory with the results
+ *            interval - number of completed images between two syncs
+ * Returns: committer, or NULL in case of failure
+ * Side-Effects: removes temporary files left by a crash and loads the
+ *               completion journal
+ *
+ *****************************************************************************/
+OutputCommitter *output_commit_open(const char *output_dir, int interval) {
+    OutputCommitter *oc = calloc(1, sizeof(OutputCommitter));
+    if (!oc) {
+        return NULL;
+    }
+    strncpy(oc->output_dir, output_dir, sizeof(oc->output_dir) - 1);
+    oc->interval = interval > 0 ? interval : 1;
+    oc->pending = malloc(oc->interval * sizeof(char *));
+
+    char journal_path[4096 + 32];
+    snprintf(journal_path, sizeof(journal_path), "%s/%s", output_dir, COMMIT_JOURNAL_NAME);
+
+    remove_stale_temporaries(output_dir);
+    load_journal(oc, journal_path);
+
+    oc->dir_fd = open(output_dir, O_RDONLY);
+    oc->journal_fd = open(journal_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (oc->dir_fd < 0 || oc->journal_fd < 0 || !oc->pending) {
+        perror("Erro ao abrir o diario de resultados");
+        if (oc->dir_fd >= 0) {
+            close(oc->dir_fd);
+        }
+        if (oc->journal_fd >= 0) {
+            close(oc->journal_fd);
+        }
+        free(oc->pending);
+        nameset_free(&oc->done);
+        free(oc);
+        return NULL;
+    }
+    pthread_mutex_init(&oc->mutex, NULL);
+    pthread_cond_init(&oc->committed, NULL);
+    pthread_mutex_init(&oc->journal_mutex, NULL);
+    return oc;
+}
+
+
+/******************************************************************************
+ * output_commit_is_done()
+ *
+ * Arguments: oc - committer
+ *            filename - name of the source image
+ * Returns: (bool) 1 if the image was in the journal when it was opened
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int output_commit_is_done(OutputCommitter *oc, const char *filename) {
+    return nameset_contains(&oc->done, filename);
+}
+
+
+/******************************************************************************
+ * output_commit_write()
+ *
+ * Arguments: oc - committer
+ *            path - final path of the result
+ *            data, size - bytes to write
+ * Returns: (bool) 1 in case of success, 0 in case of failure
+ * Side-Effects: creates a temporary file and renames it to path
+ *
+ *****************************************************************************/
+int output_commit_write(OutputCommitter *oc, const char *path, void *data, int size) {
+    static unsigned long counter = 0;
+    char tmp_path[4096 + 64];
+    (void)oc;                     // o sync e o diario sao no output_commit_image_done()
+
+    // ".<nome>.tmp.<pid>.<n>" na mesma diretoria, para o rename ser atomico
+    const char *slash = strrchr(path, '/');
+    int dir_len = slash ? (int)(slash - path + 1) : 0;
+    snprintf(tmp_path, sizeof(tmp_path), "%.*s.%s.tmp.%d.%lu", dir_len, path,
+             path + dir_len, (int)getpid(), __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED));
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return 0;
+    }
+    char *p = data;
+    int left = size;
+    while (left > 0) {
+        ssize_t n = write(fd, p, left);
+        if (n <= 0) {
+            close(fd);
+            unlink(tmp_path);
+            return 0;
+        }
+        p += n;
+        left -= n;
+    }
+    if (close(fd) != 0 || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+
+/******************************************************************************
+ * output_commit_image_done()
+ *
+ * Arguments: oc - committer
+ *            filename - name of the source image whose results are written
+ * Returns: none
+ * Side-Effects: may sync the file system and append to the journal
+ *
+ *****************************************************************************/
+void output_commit_image_done(OutputCommitter *oc, const char *filename) {
+    char **batch = NULL;
+    int count = 0;
+
+    pthread_mutex_lock(&oc->mutex);
+    oc->pending[oc->num_pending++] = strdup(filename);
+    if (oc->num_pending >= oc->interval) {
+        batch = take_pending_locked(oc, &count);
+        if (!batch) {
+            commit_pending_locked(oc);
+        }
+    }
+    pthread_mutex_unlock(&oc->mutex);
+
+    if (batch) {
+        commit_batch(oc, batch, count);
+        free(batch);
+        pthread_mutex_lock(&oc->mutex);
+        if (--oc->committing == 0) {
+            pthread_cond_broadcast(&oc->committed);
+        }
+        pthread_mutex_unlock(&oc->mutex);
+    }
+}
+
+
+/******************************************************************************
+ * output_commit_flush()
+ *
+ * Arguments: oc - committer
+ * Returns: none
+ * Side-Effects: waits for the batches being synced by other threads, then
+ *               syncs and journals every pending image
+ *
+ *****************************************************************************/
+void output_commit_flush(OutputCommitter *oc) {
+    pthread_mutex_lock(&oc->mutex);
+    while (oc->committing > 0) {
+        pthread_cond_wait(&oc->committed, &oc->mutex);
+    }
+    commit_pending_locked(oc);
+    pthread_mutex_unlock(&oc->mutex);
+}
+
+
+/******************************************************************************
+ * output_commit_close()
+ *
+ * Arguments: oc - committer
+ * Returns: none
+ * Side-Effects: flushes and frees the committer
+ *
+ *****************************************************************************/
+void output_commit_close(OutputCommitter *oc) {
+    output_commit_flush(oc);
+    close(oc->journal_fd);
+    close(oc->dir_fd);
+    free(oc->pending);
+    nameset_free(&oc->done);
+    pthread_mutex_destroy(&oc->mutex);
+    pthread_cond_destroy(&oc->committed);
+    pthread_mutex_destroy(&oc->journal_mutex);
+    free(oc);
+}
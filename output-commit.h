@@ -0,0 +1,110 @@
+#ifndef OUTPUT_COMMIT_H
+#define OUTPUT_COMMIT_H
+
+#include <pthread.h>
+
+#define COMMIT_JOURNAL_NAME ".commit-journal"
+#define COMMIT_DEFAULT_INTERVAL 32
+
+// Nomes ja registados no diario (tabela de dispersao simples)
+typedef struct {
+    char **slots;
+    int capacity;
+    int count;
+} NameSet;
+
+typedef struct {
+    char output_dir[4096];
+    int dir_fd;                   // para o syncfs()
+    int journal_fd;               // aberto com O_APPEND
+    int interval;                 // imagens por cada sync
+    char **pending;               // imagens completas ainda sem sync
+    int num_pending;
+    int committing;               // lotes tirados de pending a fazer sync
+    NameSet done;                 // imagens no diario quando foi aberto
+    pthread_mutex_t mutex;        // pending, num_pending, committing
+    pthread_cond_t committed;     // committing voltou a 0
+    pthread_mutex_t journal_mutex; // escritas no diario, uma de cada vez
+} OutputCommitter;
+
+
+/******************************************************************************
+ * output_commit_open()
+ *
+ * Arguments: output_dir - directory with the results
+ *            interval - number of completed images between two syncs
+ * Returns: committer, or NULL in case of failure
+ * Side-Effects: removes temporary files left by a crash and loads the
+ *               completion journal
+ *
+ * Description: results are written to temporary files and renamed into
+ *              place. Every interval images the whole file system is
+ *              flushed once (syncfs) and the names of those images are
+ *              appended to the journal and the journal is flushed. An image
+ *              is only "done" once it is in the journal, so after a crash the
+ *              images not in the journal are simply processed again.
+ *
+ *****************************************************************************/
+OutputCommitter *output_commit_open(const char *output_dir, int interval);
+
+/******************************************************************************
+ * output_commit_is_done()
+ *
+ * Arguments: oc - committer
+ *            filename - name of the source image
+ * Returns: (bool) 1 if the image was in the journal when it was opened
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int output_commit_is_done(OutputCommitter *oc, const char *filename);
+
+/******************************************************************************
+ * output_commit_write()
+ *
+ * Arguments: oc - committer
+ *            path - final path of the result
+ *            data, size - bytes to write
+ * Returns: (bool) 1 in case of success, 0 in case of failure
+ * Side-Effects: creates a temporary file and renames it to path
+ *
+ * Description: readers never see a half-written path. No fsync here.
+ *
+ *****************************************************************************/
+int output_commit_write(OutputCommitter *oc, const char *path, void *data, int size);
+
+/******************************************************************************
+ * output_commit_image_done()
+ *
+ * Arguments: oc - committer
+ *            filename - name of the source image whose results are written
+ * Returns: none
+ * Side-Effects: may sync the file system and append to the journal
+ *
+ * Description: the thread that completes a batch takes it out of the
+ *              pending list and does the sync without holding the
+ *              committer lock, so the other threads keep completing images
+ *
+ *****************************************************************************/
+void output_commit_image_done(OutputCommitter *oc, const char *filename);
+
+/******************************************************************************
+ * output_commit_flush()
+ *
+ * Arguments: oc - committer
+ * Returns: none
+ * Side-Effects: syncs and journals every pending image
+ *
+ *****************************************************************************/
+void output_commit_flush(OutputCommitter *oc);
+
+/******************************************************************************
+ * output_commit_close()
+ *
+ * Arguments: oc - committer
+ * Returns: none
+ * Side-Effects: flushes and frees the committer
+ *
+ *****************************************************************************/
+void output_commit_close(OutputCommitter *oc);
+
+#endif
@@ -0,0 +1,280 @@
+#include "perf-counters.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+// Totais por etapa (memoria partilhada, para incluir os processos filhos)
+typedef struct {
+    unsigned long long calls;
+    unsigned long long time_ns;
+    unsigned long long value[PERF_NUM_COUNTERS];
+} PerfStageTotal;
+
+typedef struct {
+    int available[PERF_NUM_COUNTERS];   // 1 se alguma thread o conseguiu abrir
+    unsigned long long hw_enabled;      // somas do grupo de hardware, para
+    unsigned long long hw_running;      // mostrar se foi multiplexado
+    PerfStageTotal stage[];
+} PerfShared;
+
+static PerfShared *perf_shared = NULL;
+static int perf_num_stages = 0;
+static const char **perf_stage_names = NULL;
+
+static const char *counter_names[PERF_NUM_COUNTERS] = {
+    "cycles", "instructions", "LLC-references", "LLC-misses",
+    "context-switches", "page-faults"
+};
+
+// Grupo de cada contador; o primeiro de cada grupo e o lider
+static const int counter_group[PERF_NUM_COUNTERS] = { 0, 0, 0, 0, 1, 1 };
+
+// Descritores das threads; -1 = contador indisponivel
+static __thread int thread_fds[PERF_NUM_COUNTERS];
+static __thread int thread_leader[PERF_NUM_GROUPS];
+static __thread int thread_ready = 0;
+
+
+#ifdef __linux__
+static int open_counter(int counter, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 0;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    switch (counter) {
+        case PERF_CYCLES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PERF_INSTRUCTIONS:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PERF_LLC_REFERENCES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_REFERENCES;
+            break;
+        case PERF_LLC_MISSES:
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case PERF_CONTEXT_SWITCHES:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+            break;
+        default:
+            attr.type = PERF_TYPE_SOFTWARE;
+            attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+            break;
+    }
+
+    // pid 0 / cpu -1: conta so a thread que chama, em qualquer CPU.
+    // Com perf_event_paranoid >= 2 so se pode contar em modo utilizador.
+    int fd = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+    if (fd < 0) {
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+    }
+    return fd;
+}
+#endif
+
+// O primeiro contador de um grupo que abrir fica lider; os seguintes
+// juntam-se a ele (um que o kernel recuse fica indisponivel sozinho)
+static void thread_open(void) {
+    for (int g = 0; g < PERF_NUM_GROUPS; g++) {
+        thread_leader[g] = -1;
+    }
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+        int g = counter_group[c];
+#ifdef __linux__
+        thread_fds[c] = open_counter(c, thread_leader[g]);
+#else
+        thread_fds[c] = -1;
+#endif
+        if (thread_fds[c] >= 0) {
+            if (thread_leader[g] < 0) {
+                thread_leader[g] = thread_fds[c];
+            }
+            perf_shared->available[c] = 1;
+        }
+    }
+    thread_ready = 1;
+}
+
+// Uma leitura por grupo: { numero de contadores, tempo ativo, tempo a
+// contar, valores pela ordem em que entraram no grupo }
+static void read_counters(unsigned long long *value, unsigned long long *enabled,
+                          unsigned long long *running) {
+    unsigned long long buf[3 + PERF_NUM_COUNTERS];
+
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+        value[c] = 0;
+    }
+    for (int g = 0; g < PERF_NUM_GROUPS; g++) {
+        enabled[g] = running[g] = 0;
+        if (thread_leader[g] < 0) {
+            continue;
+        }
+        ssize_t n = read(thread_leader[g], buf, sizeof(buf));
+        if (n < (ssize_t)(3 * sizeof(buf[0]))) {
+            continue;
+        }
+        enabled[g] = buf[1];
+        running[g] = buf[2];
+        unsigned long long member = 0;
+        for (int c = 0; c < PERF_NUM_COUNTERS && member < buf[0]; c++) {
+            if (counter_group[c] == g && thread_fds[c] >= 0) {
+                value[c] = buf[3 + member++];
+            }
+        }
+    }
+}
+
+
+/******************************************************************************
+ * perf_counters_enable()
+ *
+ * Arguments: num_stages - number of pipeline stages
+ *            stage_names - name of each stage (kept, not copied)
+ * Returns: (bool) 1 if enabled, 0 in case of failure
+ * Side-Effects: allocates the totals in shared memory
+ *
+ * Description: turns on the instrumentation
+ *
+ *****************************************************************************/
+int perf_counters_enable(int num_stages, const char **stage_names) {
+    size_t size = sizeof(PerfShared) + num_stages * sizeof(PerfStageTotal);
+
+    perf_shared = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (perf_shared == MAP_FAILED) {
+        perf_shared = NULL;
+        return 0;
+    }
+    memset(perf_shared, 0, size);
+    perf_num_stages = num_stages;
+    perf_stage_names = stage_names;
+    return 1;
+}
+
+int perf_counters_enabled(void) {
+    return perf_shared != NULL;
+}
+
+
+/******************************************************************************
+ * perf_stage_begin()
+ *
+ * Arguments: sample - where to keep the initial counter values
+ * Returns: none
+ * Side-Effects: opens the counters of the calling thread on first use
+ *
+ *****************************************************************************/
+void perf_stage_begin(PerfSample *sample) {
+    if (!perf_shared) {
+        return;
+    }
+    if (!thread_ready) {
+        thread_open();
+    }
+    read_counters(sample->value, sample->enabled, sample->running);
+    clock_gettime(CLOCK_MONOTONIC, &sample->start);
+}
+
+
+/******************************************************************************
+ * perf_stage_end()
+ *
+ * Arguments: sample - value returned by perf_stage_begin()
+ *            stage - stage being measured
+ * Returns: none
+ * Side-Effects: adds the deltas to the shared totals (atomically)
+ *
+ *****************************************************************************/
+void perf_stage_end(PerfSample *sample, int stage) {
+    if (!perf_shared || stage < 0 || stage >= perf_num_stages) {
+        return;
+    }
+    struct timespec end;
+    unsigned long long value[PERF_NUM_COUNTERS];
+    unsigned long long enabled[PERF_NUM_GROUPS], running[PERF_NUM_GROUPS];
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    read_counters(value, enabled, running);
+
+    PerfStageTotal *total = &perf_shared->stage[stage];
+    unsigned long long ns = (end.tv_sec - sample->start.tv_sec) * 1000000000ULL +
+                            end.tv_nsec - sample->start.tv_nsec;
+    __atomic_fetch_add(&total->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&total->time_ns, ns, __ATOMIC_RELAXED);
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+        int g = counter_group[c];
+        unsigned long long delta = value[c] - sample->value[c];
+        unsigned long long de = enabled[g] - sample->enabled[g];
+        unsigned long long dr = running[g] - sample->running[g];
+        // grupo multiplexado: estima o que teria contado o tempo todo
+        if (dr > 0 && dr < de) {
+            delta = (unsigned long long)((double)delta * de / dr);
+        }
+        __atomic_fetch_add(&total->value[c], delta, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&perf_shared->hw_enabled, enabled[0] - sample->enabled[0], __ATOMIC_RELAXED);
+    __atomic_fetch_add(&perf_shared->hw_running, running[0] - sample->running[0], __ATOMIC_RELAXED);
+}
+
+
+/******************************************************************************
+ * perf_counters_report()
+ *
+ * Arguments: fp - where to write the table
+ * Returns: none
+ * Side-Effects: writes to fp
+ *
+ * Description: one line per stage
+ *
+ *****************************************************************************/
+void perf_counters_report(FILE *fp) {
+    if (!perf_shared) {
+        return;
+    }
+    int *av = perf_shared->available;
+
+    fprintf(fp, "=== Contadores por etapa ===\n");
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+        if (!av[c]) {
+            fprintf(fp, "(%s indisponivel)\n", counter_names[c]);
+        }
+    }
+    if (perf_shared->hw_running < perf_shared->hw_enabled) {
+        fprintf(fp, "(contadores de hardware multiplexados: a contar %.1f%% do tempo, valores escalados)\n",
+                100.0 * perf_shared->hw_running / perf_shared->hw_enabled);
+    }
+    fprintf(fp, "%-9s %8s %12s %14s %14s %6s %14s %7s %7s %9s %9s\n",
+            "etapa", "chamadas", "tempo(s)", "ciclos", "instrucoes", "IPC",
+            "LLC-misses", "miss%", "MPKI", "ctx-sw", "page-flt");
+
+    for (int s = 0; s < perf_num_stages; s++) {
+        PerfStageTotal *t = &perf_shared->stage[s];
+        unsigned long long *v = t->value;
+        double ipc = v[PERF_CYCLES] ? (double)v[PERF_INSTRUCTIONS] / v[PERF_CYCLES] : 0;
+        double miss_rate = v[PERF_LLC_REFERENCES] ?
+                           100.0 * v[PERF_LLC_MISSES] / v[PERF_LLC_REFERENCES] : 0;
+        double mpki = v[PERF_INSTRUCTIONS] ?
+                      1000.0 * v[PERF_LLC_MISSES] / v[PERF_INSTRUCTIONS] : 0;
+
+        fprintf(fp, "%-9s %8llu %12.6f %14llu %14llu %6.2f %14llu %6.2f%% %7.2f %9llu %9llu\n",
+                perf_stage_names[s], t->calls, t->time_ns / 1e9,
+                v[PERF_CYCLES], v[PERF_INSTRUCTIONS], ipc, v[PERF_LLC_MISSES],
+                miss_rate, mpki, v[PERF_CONTEXT_SWITCHES], v[PERF_PAGE_FAULTS]);
+    }
+}
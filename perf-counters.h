@@ -0,0 +1,98 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdio.h>
+#include <time.h>
+
+// Contadores abertos por cada thread (perf_event_open)
+enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_REFERENCES,
+    PERF_LLC_MISSES,
+    PERF_CONTEXT_SWITCHES,
+    PERF_PAGE_FAULTS,
+    PERF_NUM_COUNTERS
+};
+
+// Os contadores abrem-se em dois grupos (o kernel agenda cada grupo de uma
+// vez, por isso os racios dentro do grupo sao coerentes): hardware, com os
+// ciclos como lider, e software, com as trocas de contexto como lider
+#define PERF_NUM_GROUPS 2
+
+// Leitura feita no inicio de uma etapa
+typedef struct {
+    unsigned long long value[PERF_NUM_COUNTERS];
+    unsigned long long enabled[PERF_NUM_GROUPS];  // tempo com o grupo ativo
+    unsigned long long running[PERF_NUM_GROUPS];  // tempo com o grupo a contar
+    struct timespec start;
+} PerfSample;
+
+
+/******************************************************************************
+ * perf_counters_enable()
+ *
+ * Arguments: num_stages - number of pipeline stages
+ *            stage_names - name of each stage (kept, not copied)
+ * Returns: (bool) 1 if enabled, 0 in case of failure
+ * Side-Effects: allocates the totals in shared memory so that worker
+ *               processes created afterwards add to the same table
+ *
+ * Description: turns on the instrumentation. Must be called before the
+ *              workers are created. Counters the kernel or the hardware do
+ *              not provide are reported as unavailable.
+ *
+ *****************************************************************************/
+int perf_counters_enable(int num_stages, const char **stage_names);
+
+/******************************************************************************
+ * perf_counters_enabled()
+ *
+ * Returns: (bool) 1 if perf_counters_enable() succeeded
+ *
+ *****************************************************************************/
+int perf_counters_enabled(void);
+
+/******************************************************************************
+ * perf_stage_begin()
+ *
+ * Arguments: sample - where to keep the initial counter values
+ * Returns: none
+ * Side-Effects: opens the counters of the calling thread on first use
+ *
+ * Description: does nothing if the instrumentation is off
+ *
+ *****************************************************************************/
+void perf_stage_begin(PerfSample *sample);
+
+/******************************************************************************
+ * perf_stage_end()
+ *
+ * Arguments: sample - value returned by perf_stage_begin()
+ *            stage - stage being measured
+ * Returns: none
+ * Side-Effects: adds the deltas to the shared totals (atomically)
+ *
+ * Description: when the kernel multiplexes the hardware counters, the
+ *              deltas of a group are scaled by its time enabled / time
+ *              running during the stage
+ *
+ *****************************************************************************/
+void perf_stage_end(PerfSample *sample, int stage);
+
+/******************************************************************************
+ * perf_counters_report()
+ *
+ * Arguments: fp - where to write the table
+ * Returns: none
+ * Side-Effects: writes to fp
+ *
+ * Description: one line per stage with time, cycles, instructions, IPC,
+ *              LLC misses (rate and per 1000 instructions), context
+ *              switches and page faults; also how much of the time the
+ *              hardware group was really counting, if it was multiplexed
+ *
+ *****************************************************************************/
+void perf_counters_report(FILE *fp);
+
+#endif
@@ -0,0 +1,604 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <gd.h>
+#include "image-lib.h"
+#include "photo-pipeline.h"
+#include "perf-counters.h"
+#include "trace.h"
+#include "helper-pool.h"
+#include "mem-budget.h"
+#include "shm-sink.h"
+#include "jpeg-codec.h"
+#include "image-cache.h"
+
+#define MAX_PATH 4096
+
+PipelineOptions pipeline_options = {
+    .encode = { JPEG_ENCODE_DEFAULTS, JPEG_ENCODE_DEFAULTS, JPEG_ENCODE_DEFAULTS,
+                JPEG_ENCODE_DEFAULTS, JPEG_ENCODE_DEFAULTS }
+};
+
+const char *pipeline_stage_names[NUM_STAGES] = {
+    "read", "decode", "pyramid", "contrast", "blur", "sepia", "thumb", "gray", "encode", "write"
+};
+
+const char *pipeline_output_names[NUM_OUTPUTS] = {
+    "contrast", "blur", "sepia", "thumb", "gray"
+};
+
+
+//simples verificação para ver se o file existe
+int file_exists(const char *filename) {
+    return access(filename, F_OK) == 0;
+}
+
+// Inicio de uma etapa: contadores (-perf) e tracer (-trace)
+typedef struct {
+    PerfSample perf;
+    TraceSpan trace;
+} StageSample;
+
+static void stage_begin(StageSample *sample) {
+    perf_stage_begin(&sample->perf);
+    trace_begin(&sample->trace);
+}
+
+static void stage_end(StageSample *sample, int stage) {
+    perf_stage_end(&sample->perf, stage);
+    trace_end(&sample->trace, pipeline_stage_names[stage], NULL);
+}
+
+// Decide se um resultado tem de ser (re)feito. Com o diario so se confia
+// na imagem inteira: um ficheiro que existe pode ter ficado truncado
+static int output_needed(const char *output_path) {
+    if (pipeline_options.committer || pipeline_options.sink) {
+        return 1;
+    }
+    return !(pipeline_options.skip_existing && file_exists(output_path));
+}
+
+// Aplica uma transformacao medindo-a como uma etapa
+static Pixmap *run_stage(Pixmap *(*transform)(const Pixmap *), const Pixmap *in, int stage) {
+    StageSample ps;
+    stage_begin(&ps);
+    Pixmap *out = transform(in);
+    stage_end(&ps, stage);
+    return out;
+}
+
+// Escreve uma JPEG ja codificada no destino escolhido
+// Devolve 1 se o resultado ficou escrito (ou publicado no destino partilhado)
+static int save_encoded(void *data, int size, const char *output_path,
+                        const char *transform, const char *filename) {
+    StageSample ps;
+    int ok;
+
+    //WRITE
+    stage_begin(&ps);
+    if (pipeline_options.sink) {
+        ok = shm_sink_put(pipeline_options.sink, filename, transform, data, size);
+    } else if (pipeline_options.committer) {
+        ok = output_commit_write(pipeline_options.committer, output_path, data, size);
+    } else {
+        ok = write_file_data((char *)output_path, data, size);
+    }
+    if (!ok) {
+        fprintf(stderr, "\tErro ao escrever %s\n", output_path);
+    }
+    stage_end(&ps, STAGE_WRITE);
+    return ok;
+}
+
+// Codifica a imagem transformada com os parametros do seu tipo, escreve-a
+// e liberta-a. Devolve 1 se o resultado ficou escrito (ou publicado no
+// destino partilhado)
+static int save_transformed(Pixmap *transformed, PipelineOutput kind, const char *output_path,
+                            const char *transform, const char *filename) {
+    StageSample ps;
+    void *data = NULL;
+    void *gd_data = NULL;         // do gd: liberta-se com gdFree()
+    int size = 0;
+    int ok = 0;
+
+    if (!transformed) {
+        return 0;
+    }
+
+    //ENCODE
+    stage_begin(&ps);
+    if (pipeline_options.gd_codec) {
+        gdImagePtr out_img = pixmap_to_gd(transformed);
+        if (out_img) {
+            data = gd_data = encode_jpeg_data(out_img, &size);
+            gdImageDestroy(out_img);
+        }
+    } else {
+        data = jpeg_encode_rgb(transformed, &pipeline_options.encode[kind], &size);
+    }
+    stage_end(&ps, STAGE_ENCODE);
+    pixmap_destroy(transformed);
+
+    if (data) {
+        ok = save_encoded(data, size, output_path, transform, filename);
+    }
+    if (gd_data) {
+        gdFree(gd_data);
+    } else {
+        free(data);
+    }
+    return ok;
+}
+
+// Gray a partir do plano Y da JPEG, codificada so com a luminancia
+// (sem conversao de cor nos dois sentidos). Sem plano Y (ficheiro que nao
+// e YCbCr) usa-se a luminancia calculada do original
+static int save_gray(const Pixmap *luma, const Pixmap *original,
+                     const char *output_path, const char *filename) {
+    StageSample ps;
+    Pixmap *computed = NULL;
+    void *data;
+    int size = 0;
+    int ok = 0;
+
+    if (!luma) {
+        luma = computed = run_stage(gray_pixmap, original, STAGE_GRAY);
+        if (!luma) {
+            return 0;
+        }
+    }
+
+    //ENCODE
+    stage_begin(&ps);
+    data = jpeg_encode_gray(luma, &pipeline_options.encode[OUTPUT_GRAY], &size);
+    stage_end(&ps, STAGE_ENCODE);
+    pixmap_destroy(computed);
+
+    if (data) {
+        ok = save_encoded(data, size, output_path, "gray", filename);
+        free(data);
+    }
+    return ok;
+}
+
+// Ordena por ordem crescente (poucos elementos)
+static int compare_divisors(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+
+int pipeline_set_thumbs(const char *list) {
+    int divisors[MAX_THUMB_RENDITIONS];
+    int n = 0;
+    const char *p = list;
+
+    while (*p) {
+        char *end;
+        long d = strtol(p, &end, 10);
+        if (end == p || d < 2 || d > 1000 || n == MAX_THUMB_RENDITIONS) {
+            return 0;
+        }
+        divisors[n++] = (int)d;
+        p = end;
+        if (*p == ',') {
+            p++;
+        } else if (*p) {
+            return 0;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+    qsort(divisors, n, sizeof(int), compare_divisors);
+
+    pipeline_options.num_thumbs = 0;
+    for (int i = 0; i < n; i++) {
+        if (i > 0 && divisors[i] == divisors[i - 1]) {
+            continue;
+        }
+        pipeline_options.thumb_divisors[pipeline_options.num_thumbs++] = divisors[i];
+    }
+    return 1;
+}
+
+int pipeline_set_sink(const char *spec) {
+    if (strcmp(spec, "file") == 0) {
+        return 1;
+    }
+    if (strncmp(spec, "shm:", 4) != 0 || !spec[4]) {
+        return 0;
+    }
+    char name[64];
+    int num_slots = SHM_SINK_DEFAULT_SLOTS;
+    snprintf(name, sizeof(name), "%s", spec + 4);
+    char *colon = strchr(name, ':');
+    if (colon) {
+        *colon = '\0';
+        num_slots = atoi(colon + 1);
+        if (num_slots <= 0 || !name[0]) {
+            return 0;
+        }
+    }
+    pipeline_options.sink = shm_sink_create(name, num_slots, SHM_SINK_DEFAULT_SLOT_SIZE);
+    return pipeline_options.sink != NULL;
+}
+
+int pipeline_set_codec(const char *name) {
+    if (strcmp(name, "libjpeg") == 0) {
+        pipeline_options.gd_codec = 0;
+    } else if (strcmp(name, "gd") == 0) {
+        pipeline_options.gd_codec = 1;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+int pipeline_set_decode(const char *list) {
+    int flags = 0;
+    char item[32];
+
+    while (*list) {
+        size_t len = strcspn(list, ",");
+        if (len == 0 || len >= sizeof(item)) {
+            return 0;
+        }
+        memcpy(item, list, len);
+        item[len] = '\0';
+        list += len + (list[len] == ',');
+
+        if (strcmp(item, "fast-dct") == 0) {
+            flags |= JPEG_FAST_DCT;
+        } else if (strcmp(item, "fast-upsample") == 0) {
+            flags |= JPEG_FAST_UPSAMPLE;
+        } else {
+            return 0;
+        }
+    }
+    pipeline_options.decode_flags = flags;
+    return 1;
+}
+
+int pipeline_set_encode(const char *spec) {
+    const char *colon = strchr(spec, ':');
+    if (!colon) {
+        for (int i = 0; i < NUM_OUTPUTS; i++) {
+            if (!jpeg_parse_settings(spec, &pipeline_options.encode[i])) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    for (int i = 0; i < NUM_OUTPUTS; i++) {
+        size_t len = strlen(pipeline_output_names[i]);
+        if ((size_t)(colon - spec) == len && strncmp(spec, pipeline_output_names[i], len) == 0) {
+            return jpeg_parse_settings(colon + 1, &pipeline_options.encode[i]);
+        }
+    }
+    return 0;
+}
+
+// Miniaturas de uma imagem, guardadas em paralelo pelas threads auxiliares
+typedef struct {
+    int count;
+    Pixmap *thumb[MAX_THUMB_RENDITIONS];
+    char path[MAX_THUMB_RENDITIONS][MAX_PATH];
+    char transform[MAX_THUMB_RENDITIONS][16];
+    const char *filename;
+    int ok[MAX_THUMB_RENDITIONS];
+} ThumbSet;
+
+static void save_thumb_part(void *arg, int i) {
+    ThumbSet *set = arg;
+    set->ok[i] = save_transformed(set->thumb[i], OUTPUT_THUMB, set->path[i], set->transform[i],
+                                  set->filename);
+}
+
+// Mede a diferenca entre o resultado aproximado e o exato
+static void report_quality(const char *filename, const char *name,
+                           Pixmap *approx, Pixmap *exact) {
+    if (!approx || !exact) {
+        return;
+    }
+    printf("\t%s %s: PSNR %.2f dB, SSIM %.4f\n", name, filename,
+           image_psnr(approx, exact), image_ssim(approx, exact));
+}
+
+
+// Faz as miniaturas em cascata e codifica-as em paralelo
+// Devolve o numero de miniaturas que falharam
+static int save_thumbnails(image_pyramid *pyr, const char *output_dir, const char *filename) {
+    static const int default_divisors[1] = { 5 };
+    const int *divisors = default_divisors;
+    int n = 1;
+    Pixmap *thumbs[MAX_THUMB_RENDITIONS];
+    ThumbSet set;
+    StageSample ps;
+    int failed = 0;
+
+    if (pipeline_options.num_thumbs > 0) {
+        divisors = pipeline_options.thumb_divisors;
+        n = pipeline_options.num_thumbs;
+    }
+
+    // so as que faltam; sem nenhuma nao vale a pena reduzir
+    set.count = 0;
+    set.filename = filename;
+    int needed[MAX_THUMB_RENDITIONS];
+    for (int i = 0; i < n; i++) {
+        char output_path[MAX_PATH];
+        char transform[16];
+        if (divisors[i] == 5) {
+            snprintf(transform, sizeof(transform), "thumb");
+        } else {
+            snprintf(transform, sizeof(transform), "thumb%d", divisors[i]);
+        }
+        snprintf(output_path, MAX_PATH, "%s/%s_%s", output_dir, transform, filename);
+        needed[i] = output_needed(output_path);
+        if (needed[i]) {
+            strcpy(set.transform[set.count], transform);
+            strcpy(set.path[set.count++], output_path);
+        }
+    }
+    if (set.count == 0) {
+        return 0;
+    }
+
+    stage_begin(&ps);
+    if (!pipeline_options.fast) {
+        // sem -fast a primeira miniatura e reduzida da original
+        image_pyramid exact = { 1, { pyr->level[0] } };
+        thumb_pixmap_set(&exact, divisors, n, thumbs);
+    } else {
+        thumb_pixmap_set(pyr, divisors, n, thumbs);
+    }
+    stage_end(&ps, STAGE_THUMB);
+
+    set.count = 0;
+    for (int i = 0; i < n; i++) {
+        if (pipeline_options.fast_check && thumbs[i]) {
+            Pixmap *exact = pixmap_resize_area(pyr->level[0], thumbs[i]->width, thumbs[i]->height);
+            char name[32];
+            snprintf(name, sizeof(name), "thumb 1/%d", divisors[i]);
+            report_quality(filename, name, thumbs[i], exact);
+            pixmap_destroy(exact);
+        }
+        if (needed[i]) {
+            set.thumb[set.count++] = thumbs[i];
+        } else {
+            pixmap_destroy(thumbs[i]);
+        }
+    }
+
+    // a primeira miniatura pesa mais; as outras sao codificadas ao mesmo tempo
+    if (set.count > 1) {
+        helper_pool_start(set.count - 1);
+    }
+    helper_pool_run(save_thumb_part, &set, set.count);
+
+    for (int i = 0; i < set.count; i++) {
+        failed += !set.ok[i];
+    }
+    return failed;
+}
+
+
+// Original descodificado e luminancia, vindos do ficheiro ou da cache
+typedef struct {
+    Pixmap *image;
+    Pixmap *luma;                 // plano Y da JPEG; NULL = calcula-se do RGB
+    CacheEntry *cached;           // != NULL: os pixmaps pertencem a cache
+} SourceImage;
+
+// Le e descodifica a imagem, ou encontra-a ja descodificada na cache.
+// Com buffer a JPEG ja esta em memoria e input_path so serve para as
+// mensagens. Devolve 1 em caso de sucesso
+static int load_source(const char *input_path, const void *buffer, int buffer_size,
+                       int need_luma, SourceImage *src) {
+    StageSample ps;
+    struct stat st;
+    void *data;
+    int size;
+
+    memset(src, 0, sizeof(SourceImage));
+    int use_cache = !buffer && image_cache_enabled() && stat(input_path, &st) == 0;
+    if (use_cache) {
+        src->cached = image_cache_get(input_path, st.st_mtime, st.st_size);
+        if (src->cached) {
+            src->image = src->cached->image;
+            src->luma = src->cached->luma;
+            return 1;
+        }
+        need_luma = 1;            // fica na cache para todos os comandos seguintes
+    }
+
+    //Ler ficheiro original
+    if (buffer) {
+        data = (void *)buffer;
+        size = buffer_size;
+    } else {
+        stage_begin(&ps);
+        data = read_file_data((char *)input_path, &size);
+        stage_end(&ps, STAGE_READ);
+    }
+    if (!data) {
+        fprintf(stderr, "\tErro ao ler %s\n", input_path);
+        return 0;
+    }
+    
+    //Descodificar direto para a representacao interna, com o plano Y para
+    //o gray tirado da mesma descodificacao; o CMYK (e o -codec gd) passa
+    //pelo gd e o gray calcula a luminancia do RGB. Um ficheiro que o
+    //libjpeg nao conseguiu descodificar nao vai ao gd (falhava outra vez)
+    stage_begin(&ps);
+    int use_gd = pipeline_options.gd_codec;
+    if (!use_gd) {
+        src->image = jpeg_decode_rgb_luma(data, size, pipeline_options.decode_flags,
+                                          need_luma ? &src->luma : NULL);
+        use_gd = !src->image && jpeg_is_cmyk(data, size);
+    }
+    if (use_gd) {
+        gdImagePtr read_img = decode_jpeg_data(data, size);
+        if (read_img) {
+            src->image = pixmap_from_gd(read_img);
+            gdImageDestroy(read_img);
+        }
+    }
+    stage_end(&ps, STAGE_DECODE);
+    if (!src->image) {
+        fprintf(stderr, "\tErro ao descodificar %s\n", input_path);
+        if (!buffer) {
+            free(data);
+        }
+        return 0;
+    }
+    if (!buffer) {
+        free(data);
+    }
+    
+    if (use_cache) {
+        src->cached = image_cache_put(input_path, st.st_mtime, st.st_size, src->image, src->luma);
+        if (src->cached) {
+            src->image = src->cached->image;
+            src->luma = src->cached->luma;
+        }
+    }
+    return 1;
+}
+
+static void release_source(SourceImage *src) {
+    if (src->cached) {
+        image_cache_release(src->cached);
+    } else {
+        pixmap_destroy(src->image);
+        pixmap_destroy(src->luma);
+    }
+}
+
+
+// processa a imagem aplicando as 5 transformações
+// Devolve o numero de resultados que falharam, ou -1 se a imagem nao foi lida
+static int transform_image(const char *input_path, const void *buffer, int buffer_size,
+                           const char *output_dir, const char *filename) {
+    char output_path[MAX_PATH];
+    char gray_path[MAX_PATH];
+    const Pixmap *original;
+    Pixmap *transformed;
+    SourceImage src;
+    image_pyramid pyr;
+    StageSample ps;
+    TraceSpan image_span;
+    int failed = 0;
+    
+    trace_begin(&image_span);
+    
+    snprintf(gray_path, MAX_PATH, "%s/gray_%s", output_dir, filename);
+    int need_gray = output_needed(gray_path);
+    if (!load_source(input_path, buffer, buffer_size, need_gray, &src)) {
+        trace_end(&image_span, "image_failed", filename);  // nao lida/descodificada
+        return -1;
+    }
+    original = src.image;
+    
+    //Piramide partilhada pelo blur e pelo thumb do modo rapido
+    pyr.level[0] = original;
+    pyr.levels = 1;
+    if (pipeline_options.fast) {
+        stage_begin(&ps);
+        build_pyramid(original, &pyr, 3);
+        stage_end(&ps, STAGE_PYRAMID);
+    }
+    
+    //Contrast
+    snprintf(output_path, MAX_PATH, "%s/contrast_%s", output_dir, filename);
+    if (output_needed(output_path)) {
+        failed += !save_transformed(run_stage(contrast_pixmap, original, STAGE_CONTRAST), OUTPUT_CONTRAST,
+                                    output_path, "contrast", filename);
+    }
+    
+    //BLUR
+    snprintf(output_path, MAX_PATH, "%s/blur_%s", output_dir, filename);
+    if (output_needed(output_path)) {
+        if (pipeline_options.fast) {
+            stage_begin(&ps);
+            transformed = blur_pixmap_fast(&pyr);
+            stage_end(&ps, STAGE_BLUR);
+            if (pipeline_options.fast_check) {
+                Pixmap *exact = blur_pixmap(original);
+                report_quality(filename, "blur", transformed, exact);
+                pixmap_destroy(exact);
+            }
+        } else {
+            transformed = run_stage(blur_pixmap, original, STAGE_BLUR);
+        }
+        failed += !save_transformed(transformed, OUTPUT_BLUR, output_path, "blur", filename);
+    }
+    
+    //SEPIA
+    snprintf(output_path, MAX_PATH, "%s/sepia_%s", output_dir, filename);
+    if (output_needed(output_path)) {
+        failed += !save_transformed(run_stage(sepia_pixmap, original, STAGE_SEPIA), OUTPUT_SEPIA,
+                                    output_path, "sepia", filename);
+    }
+    
+    //THUMB: todas as miniaturas a partir da mesma descodificacao
+    failed += save_thumbnails(&pyr, output_dir, filename);
+    
+    //GRAY
+    if (need_gray) {
+        failed += !save_gray(src.luma, original, gray_path, filename);
+    }
+    
+    //LIBERTAR IMAGEM ORIG (ou devolve-la a cache)
+    free_pyramid(&pyr);
+    release_source(&src);
+    
+    //So entra no diario se todos os resultados foram escritos
+    if (pipeline_options.committer && failed == 0) {
+        output_commit_image_done(pipeline_options.committer, filename);
+    }
+    trace_end(&image_span, "image", filename);
+    return failed;
+}
+
+
+// Admissao pelo orcamento de memoria a volta do processamento
+int pipeline_process(const char *input_path, const void *data, int size,
+                     const char *output_dir, const char *filename) {
+    //Ja esta no diario: todos os resultados foram escritos e sincronizados
+    if (pipeline_options.committer && pipeline_options.skip_existing &&
+        output_commit_is_done(pipeline_options.committer, filename)) {
+        return 0;
+    }
+    if (!input_path) {
+        input_path = filename;    // so para as mensagens
+    }
+    
+    //So comeca quando a memoria prevista pelo cabecalho JPEG couber
+    int reservation = -1;
+    if (mem_budget_enabled()) {
+        TraceSpan span;
+        trace_begin(&span);
+        long long bytes = data ? mem_predict_bytes_data(data, size) : mem_predict_bytes(input_path);
+        reservation = mem_budget_acquire(bytes);
+        trace_end(&span, "mem_wait", filename);
+    }
+    
+    int failed = transform_image(input_path, data, size, output_dir, filename);
+    
+    mem_budget_release(reservation);
+    return failed;
+}
+
+void process_image(const char *input_path, const char *output_dir, const char *filename) {
+    pipeline_process(input_path, NULL, 0, output_dir, filename);
+}
+
+
+// Sincroniza as imagens que ainda estao pendentes no committer
+void pipeline_flush_outputs(void) {
+    if (pipeline_options.committer) {
+        output_commit_flush(pipeline_options.committer);
+    }
+}
@@ -0,0 +1,178 @@
+#ifndef PHOTO_PIPELINE_H
+#define PHOTO_PIPELINE_H
+
+#include "image-lib.h"
+#include "output-commit.h"
+#include "shm-sink.h"
+#include "jpeg-codec.h"
+
+// Tipos de resultado, cada um com os seus parametros de codificacao
+typedef enum {
+    OUTPUT_CONTRAST,
+    OUTPUT_BLUR,
+    OUTPUT_SEPIA,
+    OUTPUT_THUMB,                 // todas as miniaturas
+    OUTPUT_GRAY,
+    NUM_OUTPUTS
+} PipelineOutput;
+
+extern const char *pipeline_output_names[NUM_OUTPUTS];
+
+// Opcoes do processamento de cada imagem (iguais para todas as threads)
+typedef struct {
+    int skip_existing;            // Parte A: nao refaz ficheiros que ja existem
+    int fast;                     // blur/thumb aproximados a partir da piramide
+    int fast_check;               // compara o modo rapido com o exato (PSNR/SSIM)
+    OutputCommitter *committer;   // escrita atomica + diario; NULL = escrita direta
+    ShmSink *sink;                // resultados em memoria partilhada em vez de ficheiros
+    int thumb_divisors[MAX_THUMB_RENDITIONS];   // miniaturas 1/d, por ordem crescente
+    int num_thumbs;               // 0 = so a de 1/5
+    int gd_codec;                 // ler e escrever pelo gd, como antes (comparacao)
+    int decode_flags;             // JPEG_FAST_DCT | JPEG_FAST_UPSAMPLE
+    JpegEncodeSettings encode[NUM_OUTPUTS];   // por omissao os do gd
+} PipelineOptions;
+
+extern PipelineOptions pipeline_options;
+
+// Etapas do processamento de uma imagem (para os contadores de desempenho)
+typedef enum {
+    STAGE_READ,
+    STAGE_DECODE,
+    STAGE_PYRAMID,
+    STAGE_CONTRAST,
+    STAGE_BLUR,
+    STAGE_SEPIA,
+    STAGE_THUMB,
+    STAGE_GRAY,
+    STAGE_ENCODE,
+    STAGE_WRITE,
+    NUM_STAGES
+} PipelineStage;
+
+extern const char *pipeline_stage_names[NUM_STAGES];
+
+
+/******************************************************************************
+ * file_exists()
+ *
+ * Arguments: filename - path to check
+ * Returns: (bool) 1 if the file exists, 0 otherwise
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int file_exists(const char *filename);
+
+/******************************************************************************
+ * pipeline_set_thumbs()
+ *
+ * Arguments: list - comma separated divisors, e.g. "2,5,10"
+ * Returns: (bool) 1 in case of success, 0 if the list is invalid
+ * Side-Effects: sets pipeline_options.thumb_divisors / num_thumbs
+ *
+ * Description: the 1/5 rendition keeps the thumb_ prefix, the others are
+ *              named thumb<d>_ (thumb2_, thumb10_, ...)
+ *
+ *****************************************************************************/
+int pipeline_set_thumbs(const char *list);
+
+/******************************************************************************
+ * pipeline_set_sink()
+ *
+ * Arguments: spec - "file" (default) or "shm:NAME[:SLOTS]"
+ * Returns: (bool) 1 in case of success, 0 if invalid or the shared memory
+ *          could not be created
+ * Side-Effects: creates the shared memory sink (before threads/processes)
+ *
+ *****************************************************************************/
+int pipeline_set_sink(const char *spec);
+
+/******************************************************************************
+ * pipeline_set_codec()
+ *
+ * Arguments: name - "libjpeg" (default) or "gd"
+ * Returns: (bool) 1 in case of success, 0 if the name is unknown
+ * Side-Effects: sets pipeline_options.gd_codec
+ *
+ * Description: with gd the images are decoded and encoded through
+ *              gdImageCreateFromJpegPtr()/gdImageJpegPtr() and the
+ *              -decode/-encode options only apply to the gray output
+ *
+ *****************************************************************************/
+int pipeline_set_codec(const char *name);
+
+/******************************************************************************
+ * pipeline_set_decode()
+ *
+ * Arguments: list - comma separated: fast-dct, fast-upsample
+ * Returns: (bool) 1 in case of success, 0 if the list is invalid
+ * Side-Effects: sets pipeline_options.decode_flags
+ *
+ *****************************************************************************/
+int pipeline_set_decode(const char *list);
+
+/******************************************************************************
+ * pipeline_set_encode()
+ *
+ * Arguments: spec - "[output:]items", e.g. "thumb:q=85,444,opt"; without an
+ *                   output the items apply to all of them
+ * Returns: (bool) 1 in case of success, 0 if the spec is invalid
+ * Side-Effects: changes pipeline_options.encode (may be called repeatedly)
+ *
+ *****************************************************************************/
+int pipeline_set_encode(const char *spec);
+
+/******************************************************************************
+ * process_image()
+ *
+ * Arguments: input_path - path of the original JPEG
+ *            output_dir - directory for the results
+ *            filename - name of the image (used to name the results)
+ * Returns: none
+ * Side-Effects: writes contrast_, blur_, sepia_, thumb_ (one per rendition)
+ *               and gray_ files
+ *
+ * Description: applies the 5 transformations to one image, following
+ *              pipeline_options. With a committer, an image already in the
+ *              journal is skipped as a whole (if skip_existing) and the image
+ *              is only journaled after all its results were written. With a
+ *              memory budget it first waits until the footprint predicted
+ *              from the JPEG header fits. With a sink the encoded results
+ *              are published there instead of written to output_dir.
+ *
+ *****************************************************************************/
+void process_image(const char *input_path, const char *output_dir, const char *filename);
+
+/******************************************************************************
+ * pipeline_process()
+ *
+ * Arguments: input_path - path of the original JPEG (only used for
+ *                         messages when data is given; may then be NULL)
+ *            data, size - JPEG already in memory, or NULL to read input_path
+ *            output_dir - directory for the results
+ *            filename - name of the image (used to name the results)
+ * Returns: number of results that failed, or -1 if the image could not be
+ *          read or decoded
+ * Side-Effects: same as process_image()
+ *
+ * Description: process_image() with a result; an image taken from memory
+ *              is not kept in the image cache (it has no mtime)
+ *
+ *****************************************************************************/
+int pipeline_process(const char *input_path, const void *data, int size,
+                     const char *output_dir, const char *filename);
+
+/******************************************************************************
+ * pipeline_flush_outputs()
+ *
+ * Arguments: none
+ * Returns: none
+ * Side-Effects: syncs and journals the images still pending in the
+ *               committer (if any)
+ *
+ * Description: must be called by every process that ran process_image()
+ *              before it exits
+ *
+ *****************************************************************************/
+void pipeline_flush_outputs(void);
+
+#endif
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "photoproc.h"
+
+// Exemplo de uso da libphotoproc so pela API publica: cada ficheiro vai
+// para o pool pelo caminho (photoproc_submit_file) e, lido para memoria,
+// tambem como buffer (photoproc_submit_buffer), com um callback em todos.
+// Confere o que a API promete (poll, wait, callback) e sai com 1 se algo
+// nao bater certo, por isso serve tambem de teste: make example
+
+#define MAX_JOBS 1024
+
+typedef struct {
+    int calls;                    // callbacks chamados (atomico)
+    int mismatches;               // callbacks em que o job nao estava acabado
+} ExampleCounts;
+
+// Corre numa thread do pool: o job ja tem de estar acabado
+static void on_done(PhotoprocJob *job, void *user) {
+    ExampleCounts *counts = user;
+    int result;
+
+    if (!photoproc_poll(job, &result) || photoproc_wait(job) != result) {
+        __atomic_add_fetch(&counts->mismatches, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&counts->calls, 1, __ATOMIC_RELAXED);
+}
+
+// Le o ficheiro inteiro para memoria. Devolve NULL em caso de erro
+static void *read_whole_file(const char *path, int *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return NULL;
+    }
+    void *data = NULL;
+    if (fseek(fp, 0, SEEK_END) == 0) {
+        long length = ftell(fp);
+        rewind(fp);
+        data = length > 0 ? malloc(length) : NULL;
+        if (data && fread(data, 1, length, fp) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+        *size = (int)length;
+    }
+    fclose(fp);
+    return data;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 4 || atoi(argv[1]) <= 0) {
+        fprintf(stderr, "Uso: %s <num_threads> <pasta_resultados> <ficheiro.jpeg>...\n", argv[0]);
+        exit(1);
+    }
+    const char *output_dir = argv[2];
+    mkdir(output_dir, 0755);
+
+    PhotoprocPool *pool = photoproc_create(atoi(argv[1]));
+    if (!pool) {
+        fprintf(stderr, "Erro ao criar o pool\n");
+        exit(1);
+    }
+
+    ExampleCounts counts = { 0, 0 };
+    PhotoprocJob *jobs[MAX_JOBS];
+    int num_jobs = 0;
+    int errors = 0;
+
+    for (int i = 3; i < argc && num_jobs + 2 <= MAX_JOBS; i++) {
+        PhotoprocJob *job = photoproc_submit_file(pool, argv[i], output_dir, on_done, &counts);
+        if (job) {
+            jobs[num_jobs++] = job;
+        }
+
+        // a mesma imagem em memoria, com outro nome para os resultados
+        int size;
+        void *data = read_whole_file(argv[i], &size);
+        if (!data) {
+            fprintf(stderr, "Erro ao ler %s\n", argv[i]);
+            errors++;
+            continue;
+        }
+        const char *slash = strrchr(argv[i], '/');
+        char name[256];
+        snprintf(name, sizeof(name), "mem-%s", slash ? slash + 1 : argv[i]);
+        job = photoproc_submit_buffer(pool, data, size, name, output_dir, on_done, &counts);
+        free(data);               // o submit fica com uma copia
+        if (job) {
+            jobs[num_jobs++] = job;
+        }
+    }
+
+    for (int i = 0; i < num_jobs; i++) {
+        int result = photoproc_wait(jobs[i]);
+        int polled;
+        if (!photoproc_poll(jobs[i], &polled) || polled != result) {
+            fprintf(stderr, "poll de %s nao deu o resultado do wait\n", photoproc_job_name(jobs[i]));
+            errors++;
+        }
+        printf("%-30s %6.3fs %s\n", photoproc_job_name(jobs[i]), photoproc_job_seconds(jobs[i]),
+               result == 0 ? "ok" : "falhou");
+        errors += result != 0;
+        photoproc_release(jobs[i]);
+    }
+
+    // depois do wait_all nenhum callback esta a correr
+    photoproc_wait_all(pool);
+    if (counts.calls != num_jobs || counts.mismatches > 0) {
+        fprintf(stderr, "%d callbacks para %d trabalhos, %d com o job por acabar\n",
+                counts.calls, num_jobs, counts.mismatches);
+        errors++;
+    }
+    photoproc_print_statistics(pool, stdout);
+    photoproc_destroy(pool);
+
+    printf("%d trabalhos, %d erros\n", num_jobs, errors);
+    return errors > 0;
+}
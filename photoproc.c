@@ -0,0 +1,413 @@
+#include "photoproc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "photo-pipeline.h"
+#include "catalog.h"
+#include "mem-budget.h"
+#include "perf-counters.h"
+#include "trace.h"
+
+#define MAX_PATH 4096
+
+struct PhotoprocJob {
+    char *input_path;             // NULL se a imagem veio em memoria
+    void *data;                   // copia da JPEG (photoproc_submit_buffer)
+    int size;
+    char *output_dir;
+    char *name;
+    photoproc_done_fn done;
+    void *user;
+    PhotoprocPool *pool;
+    int finished;                 // escrito com o mutex do pool, lido atomico
+    int result;
+    double seconds;
+    int refs;                     // quem submeteu + o pool (atomico)
+    struct PhotoprocJob *next;    // fila do pool
+};
+
+struct PhotoprocPool {
+    pthread_mutex_t mutex;
+    pthread_cond_t work;          // ha trabalhos na fila (ou o pool vai fechar)
+    pthread_cond_t done;          // acabou um trabalho
+    PhotoprocJob *head, *tail;
+    int queued, running;
+    int closing;
+    int num_threads;
+    int started;                  // threads que ja arrancaram (nome no trace)
+    pthread_t threads[PHOTOPROC_MAX_THREADS];
+    long completed, failed;
+    double total_time;
+};
+
+
+// Pools vivos: so o primeiro escolhe as bandas, que sao do processo
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int live_pools;
+
+
+int photoproc_option(int argc, char *argv[]) {
+    const char *name = argv[0];
+    const char *value = argc > 1 ? argv[1] : NULL;
+
+    if (strcmp(name, "-fast") == 0) {
+        pipeline_options.fast = 1;
+        return 1;
+    }
+    if (strcmp(name, "-fast-check") == 0) {
+        pipeline_options.fast = 1;
+        pipeline_options.fast_check = 1;
+        return 1;
+    }
+    if (strcmp(name, "-trace") == 0) {
+        trace_enable(TRACE_DEFAULT_EVENTS);
+        return 1;
+    }
+    if (strcmp(name, "-perf") == 0) {
+        // tem de ser antes de criar threads/processos
+        if (!perf_counters_enable(NUM_STAGES, pipeline_stage_names)) {
+            fprintf(stderr, "Aviso: nao foi possivel ativar os contadores\n");
+        }
+        return 1;
+    }
+
+    // as restantes tem um valor
+    static const char *const valued[] = { "-sink", "-mem", "-codec", "-decode", "-encode", "-thumbs" };
+    int known = 0;
+    for (size_t i = 0; i < sizeof(valued) / sizeof(valued[0]); i++) {
+        known |= strcmp(name, valued[i]) == 0;
+    }
+    if (!known) {
+        return 0;
+    }
+    if (!value) {
+        fprintf(stderr, "Erro: A opcao %s precisa de um valor\n", name);
+        return -1;
+    }
+    if (strcmp(name, "-sink") == 0) {
+        // resultados para memoria partilhada em vez de ficheiros
+        if (!pipeline_set_sink(value)) {
+            fprintf(stderr, "Erro: Destino invalido %s\n", value);
+            return -1;
+        }
+    } else if (strcmp(name, "-mem") == 0) {
+        // orcamento de memoria de pixeis para as imagens em curso
+        long long mb = atoll(value);
+        if (mb <= 0 || !mem_budget_enable(mb * 1024 * 1024)) {
+            fprintf(stderr, "Erro: Orcamento de memoria invalido %s\n", value);
+            return -1;
+        }
+    } else if (strcmp(name, "-codec") == 0) {
+        if (!pipeline_set_codec(value)) {
+            fprintf(stderr, "Erro: Codec desconhecido %s\n", value);
+            return -1;
+        }
+    } else if (strcmp(name, "-decode") == 0) {
+        if (!pipeline_set_decode(value)) {
+            fprintf(stderr, "Erro: Opcoes de descodificacao invalidas %s\n", value);
+            return -1;
+        }
+    } else if (strcmp(name, "-encode") == 0) {
+        // por exemplo thumb:q=85,444 (sem saida: todas); pode repetir-se
+        if (!pipeline_set_encode(value)) {
+            fprintf(stderr, "Erro: Parametros de codificacao invalidos %s\n", value);
+            return -1;
+        }
+    } else if (strcmp(name, "-thumbs") == 0) {
+        // miniaturas 1/d, por exemplo 2,5,10
+        if (!pipeline_set_thumbs(value)) {
+            fprintf(stderr, "Erro: Lista de miniaturas invalida %s\n", value);
+            return -1;
+        }
+    }
+    return 2;
+}
+
+
+// ---------------------------------------------------------------- trabalhos
+
+static void job_free(PhotoprocJob *job) {
+    free(job->input_path);
+    free(job->data);
+    free(job->output_dir);
+    free(job->name);
+    free(job);
+}
+
+void photoproc_release(PhotoprocJob *job) {
+    if (job && __atomic_sub_fetch(&job->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        job_free(job);
+    }
+}
+
+static PhotoprocJob *job_create(const char *output_dir, const char *name,
+                                photoproc_done_fn done, void *user, int refs) {
+    PhotoprocJob *job = calloc(1, sizeof(PhotoprocJob));
+    if (!job) {
+        return NULL;
+    }
+    job->output_dir = strdup(output_dir);
+    job->name = strdup(name);
+    if (!job->output_dir || !job->name) {
+        job_free(job);
+        return NULL;
+    }
+    job->done = done;
+    job->user = user;
+    job->refs = refs;
+    return job;
+}
+
+// Poe o trabalho no fim da fila. Devolve 0 se o pool esta a fechar
+static int enqueue(PhotoprocPool *pool, PhotoprocJob *job) {
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->closing) {
+        pthread_mutex_unlock(&pool->mutex);
+        return 0;
+    }
+    job->pool = pool;
+    if (pool->tail) {
+        pool->tail->next = job;
+    } else {
+        pool->head = job;
+    }
+    pool->tail = job;
+    pool->queued++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+    return 1;
+}
+
+// Ciclo de cada thread do pool
+static void *pool_thread(void *arg) {
+    PhotoprocPool *pool = arg;
+
+    pthread_mutex_lock(&pool->mutex);
+    trace_thread_name("photoproc %d", pool->started++);
+    while (1) {
+        while (!pool->head && !pool->closing) {
+            pthread_cond_wait(&pool->work, &pool->mutex);
+        }
+        if (!pool->head) {
+            break;                // a fechar e sem trabalho
+        }
+        PhotoprocJob *job = pool->head;
+        pool->head = job->next;
+        if (!pool->head) {
+            pool->tail = NULL;
+        }
+        pool->queued--;
+        pool->running++;
+        pthread_mutex_unlock(&pool->mutex);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        job->result = pipeline_process(job->input_path, job->data, job->size, job->output_dir, job->name);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        job->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+        free(job->data);          // a imagem ja nao e precisa
+        job->data = NULL;
+
+        // o job acaba antes do callback: dentro dele o photoproc_wait() e
+        // o photoproc_poll() do proprio job ja veem o resultado
+        pthread_mutex_lock(&pool->mutex);
+        __atomic_store_n(&job->finished, 1, __ATOMIC_RELEASE);
+        pool->completed++;
+        pool->failed += job->result != 0;
+        pool->total_time += job->seconds;
+        pthread_cond_broadcast(&pool->done);
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (job->done) {
+            job->done(job, job->user);
+        }
+
+        // so agora deixa de contar como em curso, para o photoproc_wait_all()
+        // voltar sem callbacks a correr
+        pthread_mutex_lock(&pool->mutex);
+        pool->running--;
+        pthread_cond_broadcast(&pool->done);
+        photoproc_release(job);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+
+// ---------------------------------------------------------------- pool
+
+PhotoprocPool *photoproc_create(int num_threads) {
+    if (num_threads < 1 || num_threads > PHOTOPROC_MAX_THREADS) {
+        return NULL;
+    }
+    PhotoprocPool *pool = calloc(1, sizeof(PhotoprocPool));
+    if (!pool) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    // as threads do pool esperam na fila: quem faz as faixas sao auxiliares
+    pthread_mutex_lock(&pools_mutex);
+    if (live_pools++ == 0) {
+        image_set_bands(BAND_MIN_PIXELS, num_threads - 1);
+    }
+    pthread_mutex_unlock(&pools_mutex);
+
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, pool_thread, pool) != 0) {
+            break;
+        }
+        pool->num_threads++;
+    }
+    if (pool->num_threads == 0) {
+        photoproc_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+PhotoprocJob *photoproc_submit_file(PhotoprocPool *pool, const char *input_path, const char *output_dir,
+                                    photoproc_done_fn done, void *user) {
+    const char *slash = strrchr(input_path, '/');
+    PhotoprocJob *job = job_create(output_dir, slash ? slash + 1 : input_path, done, user, 2);
+    if (!job) {
+        return NULL;
+    }
+    job->input_path = strdup(input_path);
+    if (!job->input_path || !enqueue(pool, job)) {
+        job_free(job);
+        return NULL;
+    }
+    return job;
+}
+
+PhotoprocJob *photoproc_submit_buffer(PhotoprocPool *pool, const void *data, int size, const char *name,
+                                      const char *output_dir, photoproc_done_fn done, void *user) {
+    PhotoprocJob *job = job_create(output_dir, name, done, user, 2);
+    if (!job) {
+        return NULL;
+    }
+    job->data = malloc(size > 0 ? size : 1);
+    if (!job->data) {
+        job_free(job);
+        return NULL;
+    }
+    memcpy(job->data, data, size);
+    job->size = size;
+    if (!enqueue(pool, job)) {
+        job_free(job);
+        return NULL;
+    }
+    return job;
+}
+
+int photoproc_submit_dir(PhotoprocPool *pool, const char *input_dir, const char *output_dir, int order,
+                         photoproc_done_fn done, void *user) {
+    Catalog *catalog = catalog_scan(input_dir);
+    if (!catalog) {
+        return -1;
+    }
+    catalog_sort(catalog, order == PHOTOPROC_BY_SIZE ? CATALOG_BY_SIZE : CATALOG_BY_NAME, pool->num_threads);
+
+    int queued = 0;
+    for (int i = 0; i < catalog->count; i++) {
+        const char *name = CATALOG_NAME(catalog, catalog->order[i]);
+        char input_path[MAX_PATH];
+        snprintf(input_path, MAX_PATH, "%s/%s", input_dir, name);
+
+        // so o pool fica com a referencia
+        PhotoprocJob *job = job_create(output_dir, name, done, user, 1);
+        if (!job) {
+            break;
+        }
+        job->input_path = strdup(input_path);
+        if (!job->input_path || !enqueue(pool, job)) {
+            job_free(job);
+            break;
+        }
+        queued++;
+    }
+    catalog_free(catalog);
+    return queued;
+}
+
+int photoproc_wait(PhotoprocJob *job) {
+    // ja acabou: nao toca no pool (pode ja ter sido destruido)
+    if (!__atomic_load_n(&job->finished, __ATOMIC_ACQUIRE)) {
+        PhotoprocPool *pool = job->pool;
+        pthread_mutex_lock(&pool->mutex);
+        while (!job->finished) {
+            pthread_cond_wait(&pool->done, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    return job->result;
+}
+
+int photoproc_poll(PhotoprocJob *job, int *result) {
+    if (!__atomic_load_n(&job->finished, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    if (result) {
+        *result = job->result;
+    }
+    return 1;
+}
+
+const char *photoproc_job_name(const PhotoprocJob *job) {
+    return job->name;
+}
+
+double photoproc_job_seconds(const PhotoprocJob *job) {
+    return job->seconds;
+}
+
+void photoproc_wait_all(PhotoprocPool *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->queued > 0 || pool->running > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void photoproc_print_statistics(PhotoprocPool *pool, FILE *fp) {
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->completed > 0) {
+        fprintf(fp, "Numero total de imagens processadas - %ld (%ld com falhas)\n",
+                pool->completed, pool->failed);
+        fprintf(fp, "Tempo médio de processamento - %.2fs\n", pool->total_time / pool->completed);
+    } else {
+        fprintf(fp, "0 imagens - 0.0s tempo médio\n");
+    }
+    fprintf(fp, "Na fila: %d, em curso: %d, threads: %d\n", pool->queued, pool->running, pool->num_threads);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void photoproc_destroy(PhotoprocPool *pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->closing = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+
+    // as threads so saem com a fila vazia
+    for (int i = 0; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pipeline_flush_outputs();
+
+    pthread_mutex_lock(&pools_mutex);
+    live_pools--;
+    pthread_mutex_unlock(&pools_mutex);
+
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
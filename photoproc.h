@@ -0,0 +1,199 @@
+#ifndef PHOTOPROC_H
+#define PHOTOPROC_H
+
+// libphotoproc: o processamento das duas partes (as 5 transformacoes, os
+// codecs, o orcamento de memoria e a cache) como biblioteca, com um pool
+// de threads que fica quente dentro do processo de quem a usa. As Partes A
+// e B so usam photoproc_option(): distribuem o trabalho a sua maneira e
+// nao passam pelo pool, que e para quem embebe a biblioteca (ver
+// photoproc-example.c).
+//
+//     PhotoprocPool *pool = photoproc_create(4);
+//     PhotoprocJob *job = photoproc_submit_file(pool, "in/a.jpeg", "out", NULL, NULL);
+//     int failed = photoproc_wait(job);
+//     photoproc_release(job);
+//     photoproc_destroy(pool);
+//
+// Uma configuracao por processo: as opcoes de photoproc_option(), o
+// orcamento de memoria, a cache de imagens e as threads auxiliares das
+// bandas sao do processo e valem para todos os pools. Dois pools ao mesmo
+// tempo partilham-nas (as bandas ficam com as do primeiro); quem precisar
+// de configuracoes diferentes usa processos diferentes.
+
+#include <stdio.h>
+
+#define PHOTOPROC_MAX_THREADS 256
+
+typedef struct PhotoprocPool PhotoprocPool;
+typedef struct PhotoprocJob PhotoprocJob;
+
+// Chamada por uma thread do pool quando o trabalho acaba: o job ja esta
+// acabado (photoproc_poll() e photoproc_wait() dele voltam logo) e o
+// photoproc_wait_all() so volta depois do callback. O job so e valido
+// durante a chamada, a menos que quem o submeteu ainda tenha a sua
+// referencia. O callback ocupa uma thread do pool, por isso nao pode
+// chamar photoproc_wait_all() nem esperar por outros jobs (ficaria a
+// esperar por si proprio); submeter mais trabalho pode
+typedef void (*photoproc_done_fn)(PhotoprocJob *job, void *user);
+
+// Ordem dos trabalhos de photoproc_submit_dir()
+#define PHOTOPROC_BY_NAME 0
+#define PHOTOPROC_BY_SIZE 1
+
+
+/******************************************************************************
+ * photoproc_option()
+ *
+ * Arguments: argc, argv - remaining command line, argv[0] is the option
+ * Returns: number of arguments used (1 or 2), 0 if argv[0] is not a
+ *          library option, -1 if its value is missing or invalid (the
+ *          message was already written to stderr)
+ * Side-Effects: changes pipeline_options or enables -mem, -perf, -trace
+ *
+ * Description: the options shared by every front-end: -fast, -fast-check,
+ *              -thumbs, -sink, -mem, -codec, -decode, -encode, -perf and
+ *              -trace. Must be used before creating threads or processes.
+ *
+ *****************************************************************************/
+int photoproc_option(int argc, char *argv[]);
+
+/******************************************************************************
+ * photoproc_create()
+ *
+ * Arguments: num_threads - worker threads (1..PHOTOPROC_MAX_THREADS)
+ * Returns: pool - pointer to the pool, or NULL in case of failure
+ * Side-Effects: starts the worker threads
+ *
+ * Description: huge images are split into bands by up to num_threads - 1
+ *              helper threads; while another pool exists the bands keep
+ *              the limit of the first one (one configuration per process)
+ *
+ *****************************************************************************/
+PhotoprocPool *photoproc_create(int num_threads);
+
+/******************************************************************************
+ * photoproc_submit_file()
+ *
+ * Arguments: pool - pointer to pool
+ *            input_path - JPEG file
+ *            output_dir - directory for the results (must exist)
+ *            done - completion callback, or NULL
+ *            user - passed to done
+ * Returns: job (the caller holds a reference: photoproc_release()), or
+ *          NULL in case of failure or if the pool is being destroyed
+ * Side-Effects: queues the image
+ *
+ *****************************************************************************/
+PhotoprocJob *photoproc_submit_file(PhotoprocPool *pool, const char *input_path, const char *output_dir,
+                                    photoproc_done_fn done, void *user);
+
+/******************************************************************************
+ * photoproc_submit_buffer()
+ *
+ * Arguments: pool - pointer to pool
+ *            data, size - JPEG file in memory (copied, may be freed on return)
+ *            name - name of the image, used to name the results
+ *            output_dir - directory for the results (must exist)
+ *            done - completion callback, or NULL
+ *            user - passed to done
+ * Returns: job (the caller holds a reference), or NULL in case of failure
+ * Side-Effects: queues the image
+ *
+ *****************************************************************************/
+PhotoprocJob *photoproc_submit_buffer(PhotoprocPool *pool, const void *data, int size, const char *name,
+                                      const char *output_dir, photoproc_done_fn done, void *user);
+
+/******************************************************************************
+ * photoproc_submit_dir()
+ *
+ * Arguments: pool - pointer to pool
+ *            input_dir - directory with the .jpeg files
+ *            output_dir - directory for the results (must exist)
+ *            order - PHOTOPROC_BY_NAME or PHOTOPROC_BY_SIZE
+ *            done - called for every image, or NULL
+ *            user - passed to done
+ * Returns: number of images queued, or -1 if the directory can't be read
+ * Side-Effects: queues every image of the directory (no job handles are
+ *               returned: use done or photoproc_wait_all())
+ *
+ *****************************************************************************/
+int photoproc_submit_dir(PhotoprocPool *pool, const char *input_dir, const char *output_dir, int order,
+                         photoproc_done_fn done, void *user);
+
+/******************************************************************************
+ * photoproc_wait()
+ *
+ * Arguments: job - job from a submit
+ * Returns: number of results that failed, or -1 if the image could not be
+ *          read or decoded
+ * Side-Effects: blocks until the job is done (its callback may still be
+ *               running)
+ *
+ *****************************************************************************/
+int photoproc_wait(PhotoprocJob *job);
+
+/******************************************************************************
+ * photoproc_poll()
+ *
+ * Arguments: job - job from a submit
+ *            result - where to store what photoproc_wait() would return
+ * Returns: (bool) 1 if the job is done, 0 otherwise
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+int photoproc_poll(PhotoprocJob *job, int *result);
+
+/******************************************************************************
+ * photoproc_job_name() / photoproc_job_seconds()
+ *
+ * Arguments: job - job from a submit
+ * Returns: name of the image / processing time (0 until it is done)
+ *
+ *****************************************************************************/
+const char *photoproc_job_name(const PhotoprocJob *job);
+double photoproc_job_seconds(const PhotoprocJob *job);
+
+/******************************************************************************
+ * photoproc_release()
+ *
+ * Arguments: job - job from a submit (may be NULL)
+ * Returns: none
+ * Side-Effects: drops the caller's reference; a job still queued or
+ *               running is freed by the pool when it is done
+ *
+ *****************************************************************************/
+void photoproc_release(PhotoprocJob *job);
+
+/******************************************************************************
+ * photoproc_wait_all()
+ *
+ * Arguments: pool - pointer to pool
+ * Returns: none
+ * Side-Effects: blocks until every job submitted so far is done
+ *
+ *****************************************************************************/
+void photoproc_wait_all(PhotoprocPool *pool);
+
+/******************************************************************************
+ * photoproc_print_statistics()
+ *
+ * Arguments: pool - pointer to pool
+ *            fp - where to write
+ * Returns: none
+ * Side-Effects: writes images done, failed, queued and the mean time
+ *
+ *****************************************************************************/
+void photoproc_print_statistics(PhotoprocPool *pool, FILE *fp);
+
+/******************************************************************************
+ * photoproc_destroy()
+ *
+ * Arguments: pool - pointer to pool (may be NULL)
+ * Returns: none
+ * Side-Effects: finishes the queued jobs, joins the threads, flushes the
+ *               outputs (pipeline_flush_outputs()) and frees the pool
+ *
+ *****************************************************************************/
+void photoproc_destroy(PhotoprocPool *pool);
+
+#endif
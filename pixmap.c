@@ -0,0 +1,309 @@
+#include "pixmap.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+/******************************************************************************
+ * pixmap_create()
+ *
+ * Arguments: width, height - size in pixels
+ *            channels - 1 (luma), 3 (RGB) or 4 (RGB + alpha)
+ * Returns: pointer to the new pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: allocates an uninitialised planar image
+ *
+ *****************************************************************************/
+Pixmap *pixmap_create(int width, int height, int channels){
+
+	Pixmap *pix;
+	void *data;
+
+	if (width <= 0 || height <= 0 || channels < 1 || channels > 4) {
+		return NULL;
+	}
+	pix = malloc(sizeof(Pixmap));
+	if (!pix) {
+		return NULL;
+	}
+	pix->width = width;
+	pix->height = height;
+	pix->channels = channels;
+	pix->stride = (width + PIXMAP_ALIGN - 1) & ~(PIXMAP_ALIGN - 1);
+
+	size_t plane_size = (size_t)pix->stride * height;
+	if (posix_memalign(&data, PIXMAP_ALIGN, plane_size * channels) != 0) {
+		free(pix);
+		return NULL;
+	}
+	pix->data = data;
+	for (int c = 0; c < 4; c++) {
+		pix->plane[c] = c < channels ? pix->data + c * plane_size : NULL;
+	}
+	return pix;
+}
+
+
+/******************************************************************************
+ * pixmap_destroy()
+ *
+ * Arguments: pix - pointer to pixmap (may be NULL)
+ * Returns: none
+ * Side-Effects: frees the pixmap
+ *
+ *****************************************************************************/
+void pixmap_destroy(Pixmap *pix){
+	if (pix) {
+		free(pix->data);
+		free(pix);
+	}
+}
+
+
+/******************************************************************************
+ * pixmap_from_gd()
+ *
+ * Arguments: img - gd image
+ * Returns: pointer to a pixmap with the same pixels, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: lossless conversion from gd
+ *
+ *****************************************************************************/
+Pixmap *pixmap_from_gd(gdImagePtr img){
+
+	int w = img->sx, h = img->sy;
+	int has_alpha = 0;
+
+	for (int y = 0; y < h && !has_alpha; y++) {
+		for (int x = 0; x < w; x++) {
+			int p = img->trueColor ? img->tpixels[y][x] : gdImageGetTrueColorPixel(img, x, y);
+			if (gdTrueColorGetAlpha(p)) {
+				has_alpha = 1;
+				break;
+			}
+		}
+	}
+
+	Pixmap *pix = pixmap_create(w, h, has_alpha ? 4 : 3);
+	if (!pix) {
+		return NULL;
+	}
+	for (int y = 0; y < h; y++) {
+		unsigned char *r = PIXMAP_ROW(pix, 0, y);
+		unsigned char *g = PIXMAP_ROW(pix, 1, y);
+		unsigned char *b = PIXMAP_ROW(pix, 2, y);
+		for (int x = 0; x < w; x++) {
+			int p = img->trueColor ? img->tpixels[y][x] : gdImageGetTrueColorPixel(img, x, y);
+			r[x] = gdTrueColorGetRed(p);
+			g[x] = gdTrueColorGetGreen(p);
+			b[x] = gdTrueColorGetBlue(p);
+		}
+		if (has_alpha) {
+			unsigned char *a = PIXMAP_ROW(pix, 3, y);
+			for (int x = 0; x < w; x++) {
+				int p = img->trueColor ? img->tpixels[y][x] : gdImageGetTrueColorPixel(img, x, y);
+				a[x] = gdTrueColorGetAlpha(p);
+			}
+		}
+	}
+	return pix;
+}
+
+
+/******************************************************************************
+ * pixmap_to_gd()
+ *
+ * Arguments: pix - pointer to pixmap
+ * Returns: truecolor gd image with the same pixels, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: lossless conversion to gd, used before encoding
+ *
+ *****************************************************************************/
+gdImagePtr pixmap_to_gd(const Pixmap *pix){
+
+	gdImagePtr img = gdImageCreateTrueColor(pix->width, pix->height);
+	if (!img) {
+		return NULL;
+	}
+	for (int y = 0; y < pix->height; y++) {
+		const unsigned char *r = PIXMAP_ROW(pix, 0, y);
+		const unsigned char *g = PIXMAP_ROW(pix, 1, y);
+		const unsigned char *b = PIXMAP_ROW(pix, 2, y);
+		int *out = img->tpixels[y];
+		if (pix->channels == 4) {
+			const unsigned char *a = PIXMAP_ROW(pix, 3, y);
+			for (int x = 0; x < pix->width; x++) {
+				out[x] = gdTrueColorAlpha(r[x], g[x], b[x], a[x]);
+			}
+		} else {
+			for (int x = 0; x < pix->width; x++) {
+				out[x] = gdTrueColor(r[x], g[x], b[x]);
+			}
+		}
+	}
+	return img;
+}
+
+
+/******************************************************************************
+ * pixmap_downsample2()
+ *
+ * Arguments: pix - pointer to pixmap
+ * Returns: half-size pixmap (2x2 box average), or NULL in case of failure
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+Pixmap *pixmap_downsample2(const Pixmap *pix){
+
+	int w = pix->width / 2, h = pix->height / 2;
+	Pixmap *out = pixmap_create(w, h, pix->channels);
+	if (!out) {
+		return NULL;
+	}
+	for (int c = 0; c < pix->channels; c++) {
+		for (int y = 0; y < h; y++) {
+			const unsigned char *r0 = PIXMAP_ROW(pix, c, 2 * y);
+			const unsigned char *r1 = PIXMAP_ROW(pix, c, 2 * y + 1);
+			unsigned char *o = PIXMAP_ROW(out, c, y);
+			for (int x = 0; x < w; x++) {
+				o[x] = (r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2;
+			}
+		}
+	}
+	return out;
+}
+
+
+/******************************************************************************
+ * pixmap_resize_area()
+ *
+ * Arguments: pix - pointer to pixmap
+ *            width, height - new size, smaller than or equal to the original
+ * Returns: reduced pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: each output pixel is the mean of the source pixels it covers
+ *
+ *****************************************************************************/
+Pixmap *pixmap_resize_area(const Pixmap *pix, int width, int height){
+
+	Pixmap *out = pixmap_create(width, height, pix->channels);
+	if (!out) {
+		return NULL;
+	}
+	int *x0 = malloc((width + 1) * sizeof(int));
+	unsigned int *colsum = malloc(pix->width * sizeof(unsigned int));
+	if (!x0 || !colsum) {
+		free(x0);
+		free(colsum);
+		pixmap_destroy(out);
+		return NULL;
+	}
+	for (int x = 0; x <= width; x++) {
+		x0[x] = (int)((long)x * pix->width / width);
+	}
+
+	for (int c = 0; c < pix->channels; c++) {
+		for (int y = 0; y < height; y++) {
+			int y0 = (int)((long)y * pix->height / height);
+			int y1 = (int)((long)(y + 1) * pix->height / height);
+
+			/* soma vertical das linhas cobertas, depois soma por blocos */
+			memset(colsum, 0, pix->width * sizeof(unsigned int));
+			for (int sy = y0; sy < y1; sy++) {
+				const unsigned char *row = PIXMAP_ROW(pix, c, sy);
+				for (int sx = 0; sx < pix->width; sx++) {
+					colsum[sx] += row[sx];
+				}
+			}
+			unsigned char *o = PIXMAP_ROW(out, c, y);
+			for (int x = 0; x < width; x++) {
+				unsigned int acc = 0;
+				for (int sx = x0[x]; sx < x0[x + 1]; sx++) {
+					acc += colsum[sx];
+				}
+				unsigned int n = (unsigned int)(x0[x + 1] - x0[x]) * (y1 - y0);
+				o[x] = (acc + n / 2) / n;
+			}
+		}
+	}
+	free(x0);
+	free(colsum);
+	return out;
+}
+
+
+/******************************************************************************
+ * pixmap_resize_bilinear()
+ *
+ * Arguments: pix - pointer to pixmap
+ *            width, height - new size
+ * Returns: resized pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: bilinear interpolation with pixel-centre alignment
+ *
+ *****************************************************************************/
+Pixmap *pixmap_resize_bilinear(const Pixmap *pix, int width, int height){
+
+	Pixmap *out = pixmap_create(width, height, pix->channels);
+	if (!out) {
+		return NULL;
+	}
+	int *xi = malloc(width * sizeof(int));
+	int *xw = malloc(width * sizeof(int));   /* peso do pixel da direita, 0..256 */
+	if (!xi || !xw) {
+		free(xi);
+		free(xw);
+		pixmap_destroy(out);
+		return NULL;
+	}
+	double sx = (double)pix->width / width;
+	double sy = (double)pix->height / height;
+
+	for (int x = 0; x < width; x++) {
+		double fx = (x + 0.5) * sx - 0.5;
+		if (fx < 0) {
+			fx = 0;
+		}
+		int ix = (int)fx;
+		if (ix >= pix->width - 1) {
+			ix = pix->width - 1;
+			fx = ix;
+		}
+		xi[x] = ix;
+		xw[x] = (int)((fx - ix) * 256 + 0.5);
+	}
+
+	for (int y = 0; y < height; y++) {
+		double fy = (y + 0.5) * sy - 0.5;
+		if (fy < 0) {
+			fy = 0;
+		}
+		int iy = (int)fy;
+		if (iy >= pix->height - 1) {
+			iy = pix->height - 1;
+			fy = iy;
+		}
+		int wy = (int)((fy - iy) * 256 + 0.5);
+		int iy1 = iy + 1 < pix->height ? iy + 1 : iy;
+
+		for (int c = 0; c < pix->channels; c++) {
+			const unsigned char *r0 = PIXMAP_ROW(pix, c, iy);
+			const unsigned char *r1 = PIXMAP_ROW(pix, c, iy1);
+			unsigned char *o = PIXMAP_ROW(out, c, y);
+			for (int x = 0; x < width; x++) {
+				int i0 = xi[x];
+				int i1 = i0 + 1 < pix->width ? i0 + 1 : i0;
+				int top = r0[i0] * (256 - xw[x]) + r0[i1] * xw[x];
+				int bot = r1[i0] * (256 - xw[x]) + r1[i1] * xw[x];
+				o[x] = (top * (256 - wy) + bot * wy + 32768) >> 16;
+			}
+		}
+	}
+	free(xi);
+	free(xw);
+	return out;
+}
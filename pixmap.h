@@ -0,0 +1,106 @@
+#ifndef PIXMAP_H
+#define PIXMAP_H
+
+#include "gd.h"
+
+#define PIXMAP_ALIGN 64
+
+/* imagem interna: planos R, G, B (e alfa, se existir) de u8 numa unica
+ * alocacao alinhada; cada linha de cada plano ocupa stride bytes */
+typedef struct {
+	int width;
+	int height;
+	int channels;                 /* 1 = so luminancia, 3 = RGB, 4 = RGB + alfa do gd (0..127) */
+	int stride;                   /* bytes por linha, multiplo de PIXMAP_ALIGN */
+	unsigned char *data;
+	unsigned char *plane[4];
+} Pixmap;
+
+#define PIXMAP_ROW(p, c, y) ((p)->plane[c] + (size_t)(y) * (p)->stride)
+
+
+/******************************************************************************
+ * pixmap_create()
+ *
+ * Arguments: width, height - size in pixels
+ *            channels - 1 (luma), 3 (RGB) or 4 (RGB + alpha)
+ * Returns: pointer to the new pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: allocates an uninitialised planar image
+ *
+ *****************************************************************************/
+Pixmap *pixmap_create(int width, int height, int channels);
+
+/******************************************************************************
+ * pixmap_destroy()
+ *
+ * Arguments: pix - pointer to pixmap (may be NULL)
+ * Returns: none
+ * Side-Effects: frees the pixmap
+ *
+ *****************************************************************************/
+void pixmap_destroy(Pixmap *pix);
+
+/******************************************************************************
+ * pixmap_from_gd()
+ *
+ * Arguments: img - gd image
+ * Returns: pointer to a pixmap with the same pixels, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: lossless conversion from gd; an alpha plane is only created
+ *              when some pixel is not opaque
+ *
+ *****************************************************************************/
+Pixmap *pixmap_from_gd(gdImagePtr img);
+
+/******************************************************************************
+ * pixmap_to_gd()
+ *
+ * Arguments: pix - pointer to pixmap
+ * Returns: truecolor gd image with the same pixels, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: lossless conversion to gd, used before encoding
+ *
+ *****************************************************************************/
+gdImagePtr pixmap_to_gd(const Pixmap *pix);
+
+/******************************************************************************
+ * pixmap_downsample2()
+ *
+ * Arguments: pix - pointer to pixmap
+ * Returns: half-size pixmap (2x2 box average), or NULL in case of failure
+ * Side-Effects: none
+ *
+ *****************************************************************************/
+Pixmap *pixmap_downsample2(const Pixmap *pix);
+
+/******************************************************************************
+ * pixmap_resize_area()
+ *
+ * Arguments: pix - pointer to pixmap
+ *            width, height - new size, smaller than or equal to the original
+ * Returns: reduced pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: each output pixel is the mean of the source pixels it covers
+ *
+ *****************************************************************************/
+Pixmap *pixmap_resize_area(const Pixmap *pix, int width, int height);
+
+/******************************************************************************
+ * pixmap_resize_bilinear()
+ *
+ * Arguments: pix - pointer to pixmap
+ *            width, height - new size
+ * Returns: resized pixmap, or NULL in case of failure
+ * Side-Effects: none
+ *
+ * Description: bilinear interpolation with pixel-centre alignment
+ *
+ *****************************************************************************/
+Pixmap *pixmap_resize_bilinear(const Pixmap *pix, int width, int height);
+
+#endif
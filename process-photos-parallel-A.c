@@ -2,26 +2,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
-#include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <time.h>
 #include <gd.h>
 #include "image-lib.h"
+#include "process-pool.h"
+#include "photo-pipeline.h"
+#include "perf-counters.h"
+#include "trace.h"
+#include "mem-budget.h"
+#include "catalog.h"
+#include "helper-pool.h"
+#include "photoproc.h"
 
-#define MAX_IMAGES 10000
 #define MAX_PATH 4096
-
-//Estrutura para informacao de cada imagem
-typedef struct {
-    char filename[256];
-    long size;
-}  image_info;
+#define MEM_LOOKAHEAD 16          // imagens seguintes vistas para preencher o orcamento
 
 // Estrutura para passar dados a cada thread
 typedef struct {
-    char **image_files;           // ponteiro para array de strings (nomes dos ficheiros)
+    Catalog *catalog;             // imagens da pasta (partilhado, so leitura)
     int num_images;               // total de imagens
     int start_ind;                // onde a thread comeca
     int end_ind;                  // onde a thread termina
@@ -33,117 +34,88 @@ typedef struct {
 } thread_info;
 
 
-//Comparacao por nome (ordem alfabetica)
-int compare_by_name(const void *a, const void *b) {
-     image_info *img_a = ( image_info *)a;
-     image_info *img_b = ( image_info *)b;
-    return strcmp(img_a->filename, img_b->filename);
-}
-
-// Comparacao por tamanho (ordem crescente) 
-int compare_by_size(const void *a, const void *b) {
-     image_info *img_a = ( image_info *)a;
-     image_info *img_b = ( image_info *)b;
-    return (img_a->size > img_b->size) - (img_a->size < img_b->size);
-}
-
+// Threads que ainda tem imagens suas; as que acabam ajudam nas faixas
+// das imagens grandes das outras
+static int active_workers = 0;
 
-//simples verificação para ver se o file existe
-int file_exists(const char *filename) {
-    return access(filename, F_OK) == 0;
+static int workers_active(void) {
+    return __atomic_load_n(&active_workers, __ATOMIC_ACQUIRE) > 0;
 }
 
-
-// processa a imagem aplicando as 5 transformações
-void process_image(const char *input_path, const char *output_dir, const char *filename) {
-    char output_path[MAX_PATH];
-    gdImagePtr original, transformed;
-    
-    //Ler imagem original
-    original = read_jpeg_file((char *)input_path);
-    if (!original) {
-        fprintf(stderr, "\tErro ao ler %s\n", input_path);
+// Processa a imagem na posicao i da ordem escolhida
+static void process_one(thread_info *data, int i) {
+    const char *filename = CATALOG_NAME(data->catalog, data->catalog->order[i]);
+    char input_path[MAX_PATH];
+    if (snprintf(input_path, MAX_PATH, "%s/%s", data->input_dir, filename) >= MAX_PATH) {
+        fprintf(stderr, "Thread %d: caminho demasiado longo para %s\n", data->thread_id, filename);
         return;
     }
     
-    //Contrast
-    snprintf(output_path, MAX_PATH, "%s/contrast_%s", output_dir, filename);
-    if (!file_exists(output_path)) {
-        transformed = contrast_image(original);
-        if (transformed) {
-            write_jpeg_file(transformed, output_path);
-            gdImageDestroy(transformed);
-        }
-    }
-    
-    //BLUR
-    snprintf(output_path, MAX_PATH, "%s/blur_%s", output_dir, filename);
-    if (!file_exists(output_path)) {
-        transformed = blur_image(original);
-        if (transformed) {
-            write_jpeg_file(transformed, output_path);
-            gdImageDestroy(transformed);
-        }
-    }
-    
-    //SEPIA
-    snprintf(output_path, MAX_PATH, "%s/sepia_%s", output_dir, filename);
-    if (!file_exists(output_path)) {
-        transformed = sepia_image(original);
-        if (transformed) {
-            write_jpeg_file(transformed, output_path);
-            gdImageDestroy(transformed);
-        }
-    }
-    
-    //THUMB
-    snprintf(output_path, MAX_PATH, "%s/thumb_%s", output_dir, filename);
-    if (!file_exists(output_path)) {
-        transformed = thumb_image(original);
-        if (transformed) {
-            write_jpeg_file(transformed, output_path);
-            gdImageDestroy(transformed);
-        }
-    }
-    
-    //GRAY
-    snprintf(output_path, MAX_PATH, "%s/gray_%s", output_dir, filename);
-    if (!file_exists(output_path)) {
-        transformed = gray_image(original);
-        if (transformed) {
-            write_jpeg_file(transformed, output_path);
-            gdImageDestroy(transformed);
-        }
-    }
-    
-    //LIBERTAR IMAGEM ORIG
-    gdImageDestroy(original);
+    printf("Thread %d: A processar thread %s\n", data->thread_id, filename);
+    process_image(input_path, data->output_dir, filename);
 }
 
-
 // FUNÇÃO DE CADA THREAD WORKER
 void *thread_worker(void *arg) {
     thread_info *data = (thread_info *)arg;
     
     // inicia a contagem do tempo
     clock_gettime(CLOCK_MONOTONIC, &data->start_time);
+    trace_thread_name("worker %d", data->thread_id);
     
     // Processar imagens atribuidas a esta thread
-    for (int i = data->start_ind; i < data->end_ind; i++) {
-        char input_path[MAX_PATH];
-        snprintf(input_path, MAX_PATH, "%s/%s", data->input_dir, data->image_files[i]);
-        
-        printf("Thread %d: A processar thread %s\n", data->thread_id, data->image_files[i]);
-        process_image(input_path, data->output_dir, data->image_files[i]);
+    if (!mem_budget_enabled()) {
+        for (int i = data->start_ind; i < data->end_ind; i++) {
+            process_one(data, i);
+        }
+    } else {
+        // Com orcamento de memoria: se a proxima imagem nao cabe agora,
+        // avanca uma mais pequena das seguintes (preenche o espaco livre)
+        int count = data->end_ind - data->start_ind;
+        int *order = malloc(count * sizeof(int));
+        long long *bytes = malloc(count * sizeof(long long));
+        for (int k = 0; k < count; k++) {
+            order[k] = data->start_ind + k;
+            bytes[k] = data->catalog->cost[data->catalog->order[order[k]]];
+        }
+        while (count > 0) {
+            int pick = 0;   // se nenhuma couber, espera pela mais antiga
+            for (int k = 0; k < count && k < MEM_LOOKAHEAD; k++) {
+                if (mem_budget_fits(bytes[k])) {
+                    pick = k;
+                    break;
+                }
+            }
+            process_one(data, order[pick]);
+            count--;
+            memmove(&order[pick], &order[pick + 1], (count - pick) * sizeof(int));
+            memmove(&bytes[pick], &bytes[pick + 1], (count - pick) * sizeof(long long));
+        }
+        free(order);
+        free(bytes);
     }
     
     // Para a contagem de tempo
     clock_gettime(CLOCK_MONOTONIC, &data->end_time);
     
+    // Sem imagens proprias: empresta-se as threads que ainda trabalham
+    __atomic_sub_fetch(&active_workers, 1, __ATOMIC_RELEASE);
+    helper_pool_wake();
+    helper_pool_idle(workers_active);
+    
     return NULL;
 }
 
 
+// Valor da opcao argv[*i] (avanca *i); sem valor termina com uma mensagem
+static const char *option_value(int argc, char *argv[], int *i) {
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "Erro: A opcao %s precisa de um valor\n", argv[*i]);
+        exit(1);
+    }
+    return argv[++*i];
+}
+
 //main
 int main(int argc, char *argv[]) {
     struct timespec main_start, main_end;
@@ -153,8 +125,8 @@ int main(int argc, char *argv[]) {
     clock_gettime(CLOCK_MONOTONIC, &main_start);
     
     // Validação dos argumentos
-    if (argc != 4) {
-        fprintf(stderr, "Uso: %s <diretoria> <num_threads> <-name|-size>\n", argv[0]);
+    if (argc < 4) {
+        fprintf(stderr, "Uso: %s <diretoria> <num_threads> <-name|-size> [-proc] [-fast] [-fast-check] [-perf] [-trace] [-commit N] [-thumbs D,D,...] [-mem MB] [-sink file|shm:NOME] [-bands MP] [-codec gd|libjpeg] [-decode fast-dct,fast-upsample] [-encode [saida:]q=N,420|422|444,opt,fast-dct]\n", argv[0]);
         fprintf(stderr, "Exemplo: %s ./images 4 -size\n", argv[0]);
         exit(1);
     }
@@ -172,11 +144,51 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Erro: Modo de ordenacao deve ser -name ou -size\n");
         exit(1);
     }
+
+    // Opcoes extra
+    int use_processes = 0;
+    int commit_interval = COMMIT_DEFAULT_INTERVAL;
+    long band_pixels = BAND_MIN_PIXELS;
+    pipeline_options.skip_existing = 1;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "-proc") == 0) {
+            use_processes = 1;
+        } else if (strcmp(argv[i], "-commit") == 0) {
+            // imagens entre cada sync; 0 = escrita direta, sem diario
+            commit_interval = atoi(option_value(argc, argv, &i));
+            if (commit_interval < 0) {
+                fprintf(stderr, "Erro: Intervalo de commit nao pode ser negativo\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "-bands") == 0) {
+            // megapixeis a partir dos quais uma imagem e dividida em faixas; 0 = nunca
+            double mp = atof(option_value(argc, argv, &i));
+            if (mp < 0) {
+                fprintf(stderr, "Erro: Limite das faixas nao pode ser negativo\n");
+                exit(1);
+            }
+            band_pixels = (long)(mp * 1000000);
+        } else {
+            // opcoes comuns a todos os front-ends (libphotoproc)
+            int used = photoproc_option(argc - i, argv + i);
+            if (used == 0) {
+                fprintf(stderr, "Erro: Opcao desconhecida %s\n", argv[i]);
+            }
+            if (used <= 0) {
+                exit(1);
+            }
+            i += used - 1;
+        }
+    }
     // Fiz isto so para mostrar as informações iniciais porcausa daquele problema
     printf("=== Process Photos Parallel A ===\n");
     printf("Diretoria: %s\n", input_dir);
     printf("Threads: %d\n", num_threads);
     printf("Ordenacao: %s\n", sort_mode);
+    printf("Modo: %s\n", use_processes ? "processos (memoria partilhada)" : "threads");
+    if (pipeline_options.fast) {
+        printf("Qualidade: rapida (blur/thumb a partir da piramide)\n");
+    }
     printf("\n");
     
     // Cria diretoria de output
@@ -187,43 +199,22 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
     
-    DIR *dir = opendir(input_dir);
-    if (!dir) {
-        fprintf(stderr, "Erro ao abrir diretoria %s\n", input_dir);
-        exit(1);
+    // Resultados escritos por rename e confirmados no diario a cada
+    // commit_interval imagens; so as imagens no diario sao saltadas
+    if (commit_interval > 0 && !pipeline_options.sink) {
+        pipeline_options.committer = output_commit_open(output_dir, commit_interval);
+        if (!pipeline_options.committer) {
+            exit(1);
+        }
     }
     
-     image_info images[MAX_IMAGES];
-    int num_images = 0;
-    struct dirent *entry;
-    
-    while ((entry = readdir(dir)) != NULL) {
-        int len = strlen(entry->d_name);
-        
-        // Verificar se termina em .jpeg
-        if (len > 5 && strcmp(entry->d_name + len - 5, ".jpeg") == 0) {
-            // Guardar nome
-            strncpy(images[num_images].filename, entry->d_name, 255);
-            images[num_images].filename[255] = '\0';
-            
-            // Obter tamanho do ficheiro
-            char full_path[MAX_PATH];
-            snprintf(full_path, MAX_PATH, "%s/%s", input_dir, entry->d_name);
-            struct stat st;
-            if (stat(full_path, &st) == 0) {
-                images[num_images].size = st.st_size;
-            } else {
-                images[num_images].size = 0;
-            }
-            
-            num_images++;
-            if (num_images >= MAX_IMAGES) {
-                fprintf(stderr, "Aviso: Limite de %d imagens atingido\n", MAX_IMAGES);
-                break;
-            }
-        }
+    // LISTA DAS IMAGENS: nomes numa arena, ordenados por indice
+    Catalog *catalog = catalog_scan(input_dir);
+    if (!catalog) {
+        fprintf(stderr, "Erro ao abrir diretoria %s\n", input_dir);
+        exit(1);
     }
-    closedir(dir);
+    int num_images = catalog->count;
     
     printf("Encontradas %d imagens .jpeg\n", num_images);
     
@@ -234,59 +225,111 @@ int main(int argc, char *argv[]) {
     
     // ORDENAR IMAGENS
     if (strcmp(sort_mode, "-name") == 0) {
-        qsort(images, num_images, sizeof( image_info), compare_by_name);
+        catalog_sort(catalog, CATALOG_BY_NAME, num_threads);
         printf("Imagens ordenadas por nome\n\n");
     } else {
-        qsort(images, num_images, sizeof( image_info), compare_by_size);
+        catalog_sort(catalog, CATALOG_BY_SIZE, num_threads);
         printf("Imagens ordenadas por tamanho\n\n");
     }
     
-    //Criar array de strings para passar as threads
-    char **image_files = malloc(num_images * sizeof(char *));
-    for (int i = 0; i < num_images; i++) {
-        image_files[i] = strdup(images[i].filename);
+    // memoria prevista de cada imagem (so le os cabecalhos)
+    if (mem_budget_enabled()) {
+        catalog_predict_costs(catalog, input_dir, num_threads);
     }
     
+    // FAIXAS DAS IMAGENS GRANDES: com threads ajudam as que ja acabaram;
+    // cada processo so se pode ajudar a si proprio (threads auxiliares,
+    // dividindo os CPUs pelos processos)
+    image_set_bands(band_pixels, use_processes ? helper_pool_share(num_threads, num_threads - 1) : 0);
+    
     //Tempo nao paralelo termina aqui
     clock_gettime(CLOCK_MONOTONIC, &parallel_start);
     
-    //CRIAR E LANCAR THREADS
-    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
-    thread_info *thread_data = malloc(num_threads * sizeof(thread_info));
+    //Tempo de trabalho de cada thread/processo
+    struct timespec *thread_times = malloc(num_threads * sizeof(struct timespec));
+    pthread_t *threads = NULL;
+    thread_info *thread_data = NULL;
+
+    if (use_processes) {
+        if (trace_enabled()) {
+            fprintf(stderr, "Aviso: -trace so regista as threads (ignorado com -proc)\n");
+        }
+        //CRIAR PROCESSOS QUE PARTILHAM UM ANEL DE TRABALHOS
+        ProcPool *pool = proc_pool_create(num_threads, process_image, pipeline_flush_outputs);
+        if (!pool) {
+            fprintf(stderr, "Erro ao criar processos trabalhadores\n");
+            exit(1);
+        }
+        for (int i = 0; i < num_images; i++) {
+            long long cost = catalog->cost ? catalog->cost[catalog->order[i]] : 0;
+            proc_pool_submit(pool, input_dir, output_dir, CATALOG_NAME(catalog, catalog->order[i]), NULL, 0, cost);
+        }
+        proc_pool_finish(pool);
+
+        for (int t = 0; t < num_threads; t++) {
+            double busy = pool->shm->workers[t].busy_time;
+            thread_times[t].tv_sec = (time_t)busy;
+            thread_times[t].tv_nsec = (long)((busy - thread_times[t].tv_sec) * 1000000000.0);
+            if (pool->shm->workers[t].respawns > 0) {
+                printf("Processo %d foi recriado %d vez(es)\n", t, pool->shm->workers[t].respawns);
+            }
+        }
+        if (pool->shm->failed_images > 0) {
+            printf("Imagens falhadas: %d\n", pool->shm->failed_images);
+        }
+        proc_pool_destroy(pool);
+    } else {
+        //CRIAR E LANCAR THREADS
+        threads = malloc(num_threads * sizeof(pthread_t));
+        thread_data = malloc(num_threads * sizeof(thread_info));
     
-    //Dividir trabalho entre threads
-    int images_per_thread = num_images / num_threads;
-    int remainder = num_images % num_threads;
+        //Dividir trabalho entre threads
+        int images_per_thread = num_images / num_threads;
+        int remainder = num_images % num_threads;
     
-    int start_idx = 0;
-    for (int t = 0; t < num_threads; t++) {
-        thread_data[t].image_files = image_files;
-        thread_data[t].num_images = num_images;
-        thread_data[t].start_ind = start_idx;
-        
-        //Distribuir imagens restantes pelas primeiras threads
-        int images_for_this_thread = images_per_thread + (t < remainder ? 1 : 0);
-        thread_data[t].end_ind = start_idx + images_for_this_thread;
+        int start_idx = 0;
+        active_workers = num_threads;
+        for (int t = 0; t < num_threads; t++) {
+            thread_data[t].catalog = catalog;
+            thread_data[t].num_images = num_images;
+            thread_data[t].start_ind = start_idx;
         
-        //Copiar diretorias com garantia de null terminator
-        strncpy(thread_data[t].input_dir, input_dir, MAX_PATH - 1);
-        thread_data[t].input_dir[MAX_PATH - 1] = '\0'; 
+            //Distribuir imagens restantes pelas primeiras threads
+            int images_for_this_thread = images_per_thread + (t < remainder ? 1 : 0);
+            thread_data[t].end_ind = start_idx + images_for_this_thread;
         
-        strncpy(thread_data[t].output_dir, output_dir, MAX_PATH - 1);
-        thread_data[t].output_dir[MAX_PATH - 1] = '\0';
+            //Copiar diretorias com garantia de null terminator
+            snprintf(thread_data[t].input_dir, MAX_PATH, "%s", input_dir);
+            snprintf(thread_data[t].output_dir, MAX_PATH, "%s", output_dir);
         
-        thread_data[t].thread_id = t;
+            thread_data[t].thread_id = t;
         
-        start_idx = thread_data[t].end_ind;
+            start_idx = thread_data[t].end_ind;
         
-        pthread_create(&threads[t], NULL, thread_worker, &thread_data[t]);
-    }
+            pthread_create(&threads[t], NULL, thread_worker, &thread_data[t]);
+        }
     
-    //AGUARDAR THREAD
-    for (int t = 0; t < num_threads; t++) {
-        pthread_join(threads[t], NULL);
+        //AGUARDAR THREAD
+        for (int t = 0; t < num_threads; t++) {
+            pthread_join(threads[t], NULL);
+        }
+
+        for (int t = 0; t < num_threads; t++) {
+            thread_times[t] = diff_timespec(&thread_data[t].end_time, &thread_data[t].start_time);
+        }
     }
-    
+
+    //ULTIMO COMMIT (as imagens que ainda nao foram sincronizadas)
+    if (pipeline_options.committer) {
+        output_commit_close(pipeline_options.committer);
+        pipeline_options.committer = NULL;
+    }
+    //ESPERA QUE O CONSUMIDOR CONFIRME TUDO O QUE FOI PUBLICADO
+    if (pipeline_options.sink) {
+        shm_sink_close(pipeline_options.sink);
+        pipeline_options.sink = NULL;
+    }
+
     //Tempo paralelo termina
     clock_gettime(CLOCK_MONOTONIC, &parallel_end);
     clock_gettime(CLOCK_MONOTONIC, &main_end);
@@ -311,8 +354,28 @@ int main(int argc, char *argv[]) {
     printf("Tempo nao paralelo:  %10jd.%09ld s\n", non_parallel_time.tv_sec, non_parallel_time.tv_nsec);
     
     for (int t = 0; t < num_threads; t++) {
-        struct timespec thread_time = diff_timespec(&thread_data[t].end_time, &thread_data[t].start_time);
-        printf("Thread %d:            %10jd.%09ld s\n", t, thread_time.tv_sec, thread_time.tv_nsec);
+        printf("Thread %d:            %10jd.%09ld s\n", t, thread_times[t].tv_sec, thread_times[t].tv_nsec);
+    }
+    
+    if (perf_counters_enabled()) {
+        printf("\n");
+        perf_counters_report(stdout);
+    }
+    if (mem_budget_enabled()) {
+        printf("\n");
+        mem_budget_report(stdout);
+    }
+    
+    //TIMELINE DAS THREADS (chrome://tracing ou ui.perfetto.dev)
+    if (trace_enabled()) {
+        char trace_file[MAX_PATH];
+        snprintf(trace_file, MAX_PATH, "trace_%d%s.json", num_threads, sort_mode);
+        int events = trace_dump(trace_file);
+        if (events < 0) {
+            fprintf(stderr, "Erro ao criar %s\n", trace_file);
+        } else {
+            printf("\nTrace com %d eventos guardado em: %s\n", events, trace_file);
+        }
     }
     
     //GUARDAR ESTATISTICAS
@@ -326,13 +389,15 @@ int main(int argc, char *argv[]) {
         
         //Tempo de cada thread
         for (int t = 0; t < num_threads; t++) {
-            struct timespec thread_time = diff_timespec(&thread_data[t].end_time, &thread_data[t].start_time);
-            fprintf(fp, "%jd.%09ld\n", thread_time.tv_sec, thread_time.tv_nsec);
+            fprintf(fp, "%jd.%09ld\n", thread_times[t].tv_sec, thread_times[t].tv_nsec);
         }
         
         //Tempo nao paralelo
         fprintf(fp, "%jd.%09ld\n", non_parallel_time.tv_sec, non_parallel_time.tv_nsec);
         
+        //Contadores por etapa (so com -perf, depois dos tempos)
+        perf_counters_report(fp);
+        
         fclose(fp);
         printf("\nEstatisticas guardadas em: %s\n", stats_file);
     } else {
@@ -340,12 +405,10 @@ int main(int argc, char *argv[]) {
     }
     
     //LIBERTAR MEMORIA
-    for (int i = 0; i < num_images; i++) {
-        free(image_files[i]);
-    }
-    free(image_files);
+    catalog_free(catalog);
     free(threads);
     free(thread_data);
+    free(thread_times);
     
     printf("\n=== Processamento Concluido ===\n");
     return 0;
@@ -2,35 +2,85 @@
  #include <stdlib.h>
  #include <string.h>
  #include <pthread.h>
- #include <dirent.h>
  #include <sys/stat.h>
  #include <sys/types.h>
  #include <unistd.h>
  #include <time.h>
+ #include <errno.h>
+ #include <fcntl.h>
+ #include <poll.h>
  #include <gd.h>
  #include "image-lib.h"
+ #include "process-pool.h"
+ #include "photo-pipeline.h"
+ #include "perf-counters.h"
+ #include "trace.h"
+ #include "mem-budget.h"
+ #include "dir-watch.h"
+ #include "catalog.h"
+ #include "image-cache.h"
+ #include "helper-pool.h"
+ #include "photoproc.h"
  
- #define MAX_IMAGES 10000
  #define MAX_PATH 4096
+ #define DEFAULT_BACKLOG 100000
  
- // ESTRUT PARA INFORMACAO DAS IMAGENS
- typedef struct {
-     char filename[256];
-     long size;
- } ImageInfo;
+ // LOTE DE IMAGENS (UM POR CADA COMANDO DIR)
+ typedef struct Batch {
+     int id;
+     char input_dir[MAX_PATH];
+     char output_dir[MAX_PATH];
+     int total;                    // imagens do lote
+     int sent;                     // ja entregues as threads/processos
+     int done;                     // ja processadas (modo threads)
+     int skipped;                  // descartadas por CANCEL / QUIT ABORT
+     int cancelled;
+     int watching;                 // lote de um WATCH: o total vai crescendo
+     Catalog *catalog;             // imagens do DIR (NULL num WATCH)
+     int queued;                   // imagens do catalogo ja postas no backlog
+     struct Batch *next;
+     struct Batch *next_feed;      // fila dos lotes com imagens por entrar
+ } Batch;
  
  // ESTRUT PARA TAREFAS DAS IMAGENS
+ // Mais pequena que PIPE_BUF: cada write() e atomico mesmo sem bloquear
  typedef struct {
-     char input_dir[MAX_PATH];
-     char output_dir[MAX_PATH];
+     Batch *batch;
      char filename[256];
+     struct timespec arrival;      // chegada do ficheiro (WATCH); 0 = sem hora
      int terminate;
  } ImageTask;
  
+ // TRABALHO A ESPERA DE SER ENVIADO PARA UMA THREAD
+ typedef struct {
+     Batch *batch;
+     char *filename;               // no catalogo do lote; copia so no WATCH
+     struct timespec arrival;
+ } PendingJob;
+ 
+ // BACKLOG LIMITADO ENTRE O CICLO DE COMANDOS E A THREAD QUE SUBMETE
+ typedef struct {
+     PendingJob *jobs;             // anel com capacity posicoes
+     int capacity;
+     int head;
+     int count;
+     Batch *batches;               // lotes por acabar (um DIR sai quando acaba)
+     Batch *feed_head, *feed_tail; // DIR maiores do que o espaco livre: o resto
+                                   // entra do catalogo a medida que ha espaco
+     int next_batch_id;
+     int use_processes;            // um lote acaba quando entregue (o anel copia os nomes)
+     int quitting;                 // depois de esvaziar, termina as threads
+     pthread_mutex_t mutex;
+     pthread_cond_t not_empty;
+     pthread_cond_t not_full;      // so o WATCH espera por espaco
+ } Backlog;
+ 
  // ESTRUT PARA ESTATISTICAS GLOBAIS
  typedef struct {
      int total_images;
      double total_time;
+     int watched_images;           // chegadas por WATCH ja processadas
+     double latency_sum, latency_max;
      pthread_mutex_t mutex; 
  } Statistics;
  
@@ -38,79 +88,26 @@
  typedef struct {
      int pipe_fd;
      Statistics *stats;
+     Backlog *backlog;
      int thread_id;
  } ThreadData;
  
+ // Dados da thread que passa o backlog para os pipes
+ typedef struct {
+     Backlog *backlog;
+     Statistics *stats;
+     int num_threads;
+     int (*pipes)[2];
+     ProcPool *pool;               // != NULL no modo processos
+ } SubmitterData;
+ 
+ // Dados da thread do WATCH para por as chegadas no backlog
+ typedef struct {
+     Backlog *backlog;
+     Statistics *stats;
+ } WatchContext;
  
- // Comparacao por nome (ordem alfabetica)
- int compare_by_name(const void *a, const void *b) {
-     ImageInfo *img_a = (ImageInfo *)a;
-     ImageInfo *img_b = (ImageInfo *)b;
-     return strcmp(img_a->filename, img_b->filename);
- }
  
- // Comparacao por tamanho (ordem crescente)
- int compare_by_size(const void *a, const void *b) {
-     ImageInfo *img_a = (ImageInfo *)a;
-     ImageInfo *img_b = (ImageInfo *)b;
-     return (img_a->size > img_b->size) - (img_a->size < img_b->size);
- }
- int file_exists(const char *filename) {
-     return access(filename, F_OK) == 0;
- }
- void process_image(const char *input_path, const char *output_dir, const char *filename) {
-     char output_path[MAX_PATH];
-     gdImagePtr original, transformed;
-     
-     //LER IMG 
-     original = read_jpeg_file((char *)input_path);
-     if (!original) {
-         fprintf(stderr, "\tErro ao ler %s\n", input_path);
-         return;
-     }
-     
-     //CONTRAST 
-     snprintf(output_path, MAX_PATH, "%s/contrast_%s", output_dir, filename);
-     transformed = contrast_image(original);
-     if (transformed) {
-         write_jpeg_file(transformed, output_path);
-         gdImageDestroy(transformed);
-     }
-     
-     //BLUR
-     snprintf(output_path, MAX_PATH, "%s/blur_%s", output_dir, filename);
-     transformed = blur_image(original);
-     if (transformed) {
-         write_jpeg_file(transformed, output_path);
-         gdImageDestroy(transformed);
-     }
-     
-     //SEPIA
-     snprintf(output_path, MAX_PATH, "%s/sepia_%s", output_dir, filename);
-     transformed = sepia_image(original);
-     if (transformed) {
-         write_jpeg_file(transformed, output_path);
-         gdImageDestroy(transformed);
-     }
-     
-     //THUMB
-     snprintf(output_path, MAX_PATH, "%s/thumb_%s", output_dir, filename);
-     transformed = thumb_image(original);
-     if (transformed) {
-         write_jpeg_file(transformed, output_path);
-         gdImageDestroy(transformed);
-     }
-     
-     //GRAY
-     snprintf(output_path, MAX_PATH, "%s/gray_%s", output_dir, filename);
-     transformed = gray_image(original);
-     if (transformed) {
-         write_jpeg_file(transformed, output_path);
-         gdImageDestroy(transformed);
-     }
-     gdImageDestroy(original);
- }
-
  void print_statistics(Statistics *stats) {
      pthread_mutex_lock(&stats->mutex);
      
@@ -121,57 +118,60 @@
      } else {
          printf("0 imagens - 0.0s tempo médio\n");
      }
+     if (stats->watched_images > 0) {
+         printf("Latencia chegada -> resultados (WATCH) - media %.3fs, maxima %.3fs, %d imagens\n",
+                stats->latency_sum / stats->watched_images, stats->latency_max, stats->watched_images);
+     }
      
      pthread_mutex_unlock(&stats->mutex);
  }
 
- int list_images(char *dir_path, ImageInfo *images) {
-     DIR *dir = opendir(dir_path);
-     if (!dir) {
-         fprintf(stderr, "Erro ao abrir diretoria %s\n", dir_path);
-         return 0;
-     }
-     
-     int count = 0;
-     struct dirent *entry;
-     
-     while ((entry = readdir(dir)) != NULL) {
-         int len = strlen(entry->d_name);
-         
-         // VERIFICACAO SE TERMINA EM JPEG
-         if (len > 5 && strcmp(entry->d_name + len - 5, ".jpeg") == 0) {
-             strncpy(images[count].filename, entry->d_name, 255);
-             images[count].filename[255] = '\0';
-             
-             //OBTEM O TAMANHO DO FICHEIOR
-             char full_path[MAX_PATH];
-             snprintf(full_path, MAX_PATH, "%s/%s", dir_path, entry->d_name);
-             struct stat st;
-             if (stat(full_path, &st) == 0) {
-                 images[count].size = st.st_size;
-             } else {
-                 images[count].size = 0;
-             }
-             
-             count++;
-             if (count >= MAX_IMAGES) {
-                 fprintf(stderr, "Aviso: Limite de %d imagens atingido\n", MAX_IMAGES);
-                 break;
-             }
+ // UM LOTE DE DIR ACABOU QUANDO NENHUMA DAS SUAS IMAGENS ESTA POR FAZER:
+ // processadas ou descartadas (threads), entregues ao anel ou descartadas
+ // (processos). Chamada com stats->mutex
+ int batch_finished(Batch *batch, int use_processes) {
+     int gone = (use_processes ? batch->sent : batch->done) + batch->skipped;
+     return batch->catalog && gone == batch->total;
+ }
+ 
+ // LIBERTA OS LOTES DE DIR QUE ACABARAM (o catalogo e o proprio lote)
+ // Chamada sem locks; quem a chama nao pode voltar a usar esses lotes
+ void backlog_retire_finished(Backlog *backlog, Statistics *stats) {
+     pthread_mutex_lock(&backlog->mutex);
+     pthread_mutex_lock(&stats->mutex);
+     Batch **p = &backlog->batches;
+     while (*p) {
+         Batch *b = *p;
+         if (batch_finished(b, backlog->use_processes)) {
+             *p = b->next;
+             catalog_free(b->catalog);
+             free(b);
+         } else {
+             p = &b->next;
          }
      }
-     
-     closedir(dir);
-     return count;
+     pthread_mutex_unlock(&stats->mutex);
+     pthread_mutex_unlock(&backlog->mutex);
  }
-
+ 
  void *thread_worker(void *arg) {
      ThreadData *data = (ThreadData *)arg;
      ImageTask task;
+     TraceSpan span;
+     
+     trace_thread_name("worker %d", data->thread_id);
      
      while (1) {
+         // SEM TRABALHO A ESPERA: FAZ JA O COMMIT DO QUE ESTA PENDENTE
+         struct pollfd pfd = { data->pipe_fd, POLLIN, 0 };
+         if (pipeline_options.committer && poll(&pfd, 1, 0) == 0) {
+             pipeline_flush_outputs();
+         }
+         
          // AQUI ESPOERA POR TRABBALHO, BLOQUEIA ATE RECEBER DADOS
+         trace_begin(&span);
          ssize_t bytes_read = read(data->pipe_fd, &task, sizeof(ImageTask));
+         trace_end(&span, "wait_task", NULL);
          
          if (bytes_read <= 0) {
              break;  /* Pipe fechado */
@@ -181,14 +181,28 @@
              break;
          }
          
+         // LOTE CANCELADO: A TAREFA JA ESTAVA NO PIPE, SO E DESCARTADA
+         char input_path[MAX_PATH];
+         int too_long = snprintf(input_path, MAX_PATH, "%s/%s", task.batch->input_dir, task.filename) >= MAX_PATH;
+         if (too_long) {
+             fprintf(stderr, "Thread %d: caminho demasiado longo para %s\n", data->thread_id, task.filename);
+         }
+         if (task.batch->cancelled || too_long) {
+             pthread_mutex_lock(&data->stats->mutex);
+             task.batch->skipped++;
+             int finished = batch_finished(task.batch, 0);
+             pthread_mutex_unlock(&data->stats->mutex);
+             if (finished) {
+                 backlog_retire_finished(data->backlog, data->stats);
+             }
+             continue;
+         }
+         
          // PROCESSA A IMAGEM
          struct timespec start, end;
          clock_gettime(CLOCK_MONOTONIC, &start);
          
-         char input_path[MAX_PATH];
-         snprintf(input_path, MAX_PATH, "%s/%s", task.input_dir, task.filename);
-         
-         process_image(input_path, task.output_dir, task.filename);
+         process_image(input_path, task.batch->output_dir, task.filename);
          
          clock_gettime(CLOCK_MONOTONIC, &end);
          struct timespec processing_time = diff_timespec(&end, &start);
@@ -196,10 +210,13 @@
                               processing_time.tv_nsec / 1000000000.0;
          
          //ATUALIXA AS ESTATISTICAS
+         trace_begin(&span);
          pthread_mutex_lock(&data->stats->mutex);
+         trace_end(&span, "stats_lock", NULL);
          
          data->stats->total_images++;
          data->stats->total_time += time_seconds;
+         task.batch->done++;
          
          double avg_time = data->stats->total_time / data->stats->total_images;
          
@@ -209,15 +226,395 @@
                 data->stats->total_images);
          printf("Tempo médio de processamento - %.2fs\n", avg_time);
          
+         // WATCH: DA CHEGADA DO FICHEIRO ATE AO ULTIMO RESULTADO ESCRITO
+         if (task.arrival.tv_sec || task.arrival.tv_nsec) {
+             struct timespec latency = diff_timespec(&end, &task.arrival);
+             double latency_seconds = latency.tv_sec + latency.tv_nsec / 1000000000.0;
+             data->stats->watched_images++;
+             data->stats->latency_sum += latency_seconds;
+             if (latency_seconds > data->stats->latency_max) {
+                 data->stats->latency_max = latency_seconds;
+             }
+             printf("Latencia desde a chegada - %.3fs\n", latency_seconds);
+         }
+         
+         int finished = batch_finished(task.batch, 0);
          pthread_mutex_unlock(&data->stats->mutex);
+         if (finished) {
+             backlog_retire_finished(data->backlog, data->stats);
+         }
      }
      
      return NULL;
  }
 
+ // ENVIA UMA TAREFA PARA A PRIMEIRA THREAD (ROUND-ROBIN) COM ESPACO NO PIPE
+ // Os pipes de escrita sao nao bloqueantes; se estao todos cheios espera com poll()
+ void send_task(SubmitterData *data, ImageTask *task, int *next_thread) {
+     struct pollfd fds[data->num_threads];
+     
+     while (1) {
+         for (int k = 0; k < data->num_threads; k++) {
+             int t = (*next_thread + k) % data->num_threads;
+             if (write(data->pipes[t][1], task, sizeof(ImageTask)) == sizeof(ImageTask)) {
+                 *next_thread = (t + 1) % data->num_threads;
+                 return;
+             }
+         }
+         for (int t = 0; t < data->num_threads; t++) {
+             fds[t].fd = data->pipes[t][1];
+             fds[t].events = POLLOUT;
+         }
+         TraceSpan span;
+         trace_begin(&span);
+         poll(fds, data->num_threads, -1);
+         trace_end(&span, "pipes_full", NULL);
+     }
+ }
+ 
+ // ENVIA O PEDIDO DE TERMINAR A UMA THREAD ESPECIFICA
+ void send_terminate(int fd) {
+     ImageTask task;
+     memset(&task, 0, sizeof(ImageTask));
+     task.terminate = 1;
+     
+     while (write(fd, &task, sizeof(ImageTask)) != sizeof(ImageTask)) {
+         struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+         poll(&pfd, 1, -1);
+     }
+ }
+ 
+ // PASSA PARA O BACKLOG AS IMAGENS DOS LOTES A ENTRAR, POR ORDEM, ATE ENCHER
+ // Chamada com backlog->mutex
+ void backlog_feed_locked(Backlog *backlog) {
+     int added = 0;
+     while (backlog->feed_head && backlog->count < backlog->capacity) {
+         Batch *batch = backlog->feed_head;
+         while (batch->queued < batch->total && backlog->count < backlog->capacity) {
+             int pos = (backlog->head + backlog->count) % backlog->capacity;
+             backlog->jobs[pos].batch = batch;
+             backlog->jobs[pos].filename = CATALOG_NAME(batch->catalog, batch->catalog->order[batch->queued]);
+             memset(&backlog->jobs[pos].arrival, 0, sizeof(struct timespec));
+             backlog->count++;
+             batch->queued++;
+             added++;
+         }
+         if (batch->queued == batch->total) {
+             backlog->feed_head = batch->next_feed;
+             if (!backlog->feed_head) {
+                 backlog->feed_tail = NULL;
+             }
+         }
+     }
+     if (added) {
+         pthread_cond_signal(&backlog->not_empty);
+     }
+ }
+ 
+ // THREAD QUE SUBMETE: TIRA TRABALHO DO BACKLOG E ENTREGA-O AOS TRABALHADORES
+ // Assim o ciclo de comandos nunca fica bloqueado num write()
+ void *submitter_thread(void *arg) {
+     SubmitterData *data = (SubmitterData *)arg;
+     Backlog *backlog = data->backlog;
+     int next_thread = 0;  /* Para distribuicao round-robin */
+     
+     trace_thread_name("submitter");
+     
+     while (1) {
+         pthread_mutex_lock(&backlog->mutex);
+         while (backlog->count == 0 && !backlog->quitting) {
+             pthread_cond_wait(&backlog->not_empty, &backlog->mutex);
+         }
+         if (backlog->count == 0) {
+             pthread_mutex_unlock(&backlog->mutex);
+             break;
+         }
+         PendingJob job = backlog->jobs[backlog->head];
+         backlog->head = (backlog->head + 1) % backlog->capacity;
+         backlog->count--;
+         backlog_feed_locked(backlog);
+         pthread_cond_signal(&backlog->not_full);
+         pthread_mutex_unlock(&backlog->mutex);
+         
+         int has_arrival = job.arrival.tv_sec || job.arrival.tv_nsec;
+         int finished = 0;
+         if (data->pool) {
+             // cancelado entre sair do backlog e chegar aqui: ja nao entra no anel
+             pthread_mutex_lock(&data->stats->mutex);
+             int cancelled = job.batch->cancelled;
+             pthread_mutex_unlock(&data->stats->mutex);
+             if (!cancelled) {
+                 proc_pool_submit(data->pool, job.batch->input_dir, job.batch->output_dir, job.filename,
+                                  has_arrival ? &job.arrival : NULL, job.batch->id, 0);
+             }
+             pthread_mutex_lock(&data->stats->mutex);
+             if (cancelled) {
+                 job.batch->skipped++;
+             } else {
+                 job.batch->sent++;
+             }
+             finished = batch_finished(job.batch, 1);
+             pthread_mutex_unlock(&data->stats->mutex);
+             if (!job.batch->catalog) {
+                 free(job.filename);
+             }
+         } else {
+             // o lote so e libertado depois de a thread acabar a tarefa, mas
+             // o nome e copiado antes de a entregar
+             ImageTask task;
+             memset(&task, 0, sizeof(ImageTask));
+             task.batch = job.batch;
+             task.arrival = job.arrival;
+             strncpy(task.filename, job.filename, 255);
+             pthread_mutex_lock(&data->stats->mutex);
+             job.batch->sent++;
+             pthread_mutex_unlock(&data->stats->mutex);
+             if (!job.batch->catalog) {
+                 free(job.filename);
+             }
+             send_task(data, &task, &next_thread);
+         }
+         if (finished) {
+             backlog_retire_finished(backlog, data->stats);
+         }
+     }
+     
+     // BACKLOG VAZIO E QUIT PEDIDO: TERMINAR AS THREADS
+     for (int i = 0; i < data->num_threads && !data->pool; i++) {
+         send_terminate(data->pipes[i][1]);
+     }
+     return NULL;
+ }
+ 
+ // COLOCA UM LOTE NO BACKLOG; RECUSA-O SE O BACKLOG ESTIVER CHEIO (BACKPRESSURE)
+ // O lote fica com o catalogo: o backlog aponta para os nomes sem os copiar.
+ // O que nao cabe ja fica no catalogo e entra a medida que o submitter
+ // liberta espaco, depois dos lotes que ja estavam a espera.
+ // Devolve o numero do lote (0 se foi recusado); o lote pode acabar e ser
+ // libertado logo a seguir, por isso quem chama nao fica com ele
+ int backlog_add_batch(Backlog *backlog, const char *input_dir, const char *output_dir,
+                          Catalog *catalog) {
+     int num_images = catalog->count;
+     pthread_mutex_lock(&backlog->mutex);
+     
+     if (backlog->count == backlog->capacity) {
+         printf("Backlog cheio: %d trabalhos pendentes, capacidade %d. Lote recusado, tente mais tarde\n",
+                backlog->count, backlog->capacity);
+         pthread_mutex_unlock(&backlog->mutex);
+         return 0;
+     }
+     
+     Batch *batch = calloc(1, sizeof(Batch));
+     if (!batch) {
+         printf("Erro: sem memoria para o lote. Lote recusado\n");
+         pthread_mutex_unlock(&backlog->mutex);
+         return 0;
+     }
+     batch->id = backlog->next_batch_id++;
+     strncpy(batch->input_dir, input_dir, MAX_PATH - 1);
+     strncpy(batch->output_dir, output_dir, MAX_PATH - 1);
+     batch->total = num_images;
+     batch->catalog = catalog;
+     batch->next = backlog->batches;
+     backlog->batches = batch;
+     
+     if (backlog->feed_tail) {
+         backlog->feed_tail->next_feed = batch;
+     } else {
+         backlog->feed_head = batch;
+     }
+     backlog->feed_tail = batch;
+     backlog_feed_locked(backlog);
+     
+     if (batch->queued < num_images) {
+         printf("Aviso: backlog cheio (%d/%d); %d imagens do lote entram a medida que houver espaco\n",
+                backlog->count, backlog->capacity, num_images - batch->queued);
+     } else if (backlog->count > backlog->capacity * 3 / 4) {
+         printf("Aviso: backlog a %d%% (%d/%d)\n", backlog->count * 100 / backlog->capacity,
+                backlog->count, backlog->capacity);
+     }
+     
+     int id = batch->id;
+     pthread_mutex_unlock(&backlog->mutex);
+     return id;
+ }
+ 
+ // CRIA O LOTE DE UM WATCH, AINDA SEM IMAGENS (vao chegando). NULL sem memoria
+ Batch *backlog_add_watch(Backlog *backlog, const char *input_dir, const char *output_dir) {
+     pthread_mutex_lock(&backlog->mutex);
+     Batch *batch = calloc(1, sizeof(Batch));
+     if (!batch) {
+         pthread_mutex_unlock(&backlog->mutex);
+         return NULL;
+     }
+     batch->id = backlog->next_batch_id++;
+     strncpy(batch->input_dir, input_dir, MAX_PATH - 1);
+     strncpy(batch->output_dir, output_dir, MAX_PATH - 1);
+     batch->watching = 1;
+     batch->next = backlog->batches;
+     backlog->batches = batch;
+     pthread_mutex_unlock(&backlog->mutex);
+     return batch;
+ }
+ 
+ // CHAMADA PELA THREAD DO WATCH COM CADA RAJADA DE FICHEIROS NOVOS
+ // Aqui nao se pode recusar (perdiam-se chegadas): espera por espaco no backlog
+ void backlog_add_arrivals(void *ctx, WatchArrival *arrivals, int n) {
+     WatchContext *wc = (WatchContext *)ctx;
+     Backlog *backlog = wc->backlog;
+     
+     pthread_mutex_lock(&backlog->mutex);
+     for (int i = 0; i < n; i++) {
+         Batch *batch = (Batch *)arrivals[i].tag;
+         while (backlog->count == backlog->capacity && !batch->cancelled) {
+             pthread_cond_wait(&backlog->not_full, &backlog->mutex);
+         }
+         if (batch->cancelled) {
+             continue;
+         }
+         int pos = (backlog->head + backlog->count) % backlog->capacity;
+         backlog->jobs[pos].batch = batch;
+         backlog->jobs[pos].filename = strdup(arrivals[i].filename);
+         backlog->jobs[pos].arrival = arrivals[i].arrival;
+         backlog->count++;
+         
+         pthread_mutex_lock(&wc->stats->mutex);
+         batch->total++;
+         pthread_mutex_unlock(&wc->stats->mutex);
+         
+         // o submitter pode comecar ja enquanto se espera por espaco
+         pthread_cond_signal(&backlog->not_empty);
+     }
+     pthread_mutex_unlock(&backlog->mutex);
+ }
+ 
+ // RETIRA DO BACKLOG OS TRABALHOS DE UM LOTE (batch_id < 0: todos)
+ // Devolve quantos foram retirados
+ int backlog_cancel(Backlog *backlog, Statistics *stats, int batch_id) {
+     int dropped = 0;
+     
+     pthread_mutex_lock(&backlog->mutex);
+     pthread_mutex_lock(&stats->mutex);
+     
+     for (Batch *b = backlog->batches; b; b = b->next) {
+         if (batch_id < 0 || b->id == batch_id) {
+             b->cancelled = 1;
+         }
+     }
+     
+     // as imagens que ainda estavam so no catalogo ja nao entram
+     Batch **feed = &backlog->feed_head;
+     backlog->feed_tail = NULL;
+     while (*feed) {
+         Batch *b = *feed;
+         if (b->cancelled) {
+             b->skipped += b->total - b->queued;
+             dropped += b->total - b->queued;
+             b->queued = b->total;
+             *feed = b->next_feed;
+         } else {
+             backlog->feed_tail = b;
+             feed = &b->next_feed;
+         }
+     }
+     
+     // compacta o anel mantendo a ordem dos restantes
+     int kept = 0;
+     for (int i = 0; i < backlog->count; i++) {
+         PendingJob job = backlog->jobs[(backlog->head + i) % backlog->capacity];
+         if (job.batch->cancelled) {
+             job.batch->skipped++;
+             if (!job.batch->catalog) {
+                 free(job.filename);
+             }
+             dropped++;
+         } else {
+             backlog->jobs[(backlog->head + kept) % backlog->capacity] = job;
+             kept++;
+         }
+     }
+     backlog->count = kept;
+     backlog_feed_locked(backlog);
+     pthread_cond_broadcast(&backlog->not_full);
+     
+     pthread_mutex_unlock(&stats->mutex);
+     pthread_mutex_unlock(&backlog->mutex);
+     return dropped;
+ }
+ 
+ // -proc: RETIRA DO ANEL PARTILHADO OS TRABALHOS DOS LOTES CANCELADOS QUE
+ // NENHUM PROCESSO TIROU AINDA (batch_id < 0: todos). Devolve quantos
+ // Um lote todo entregue ja foi libertado, mas os trabalhos levam o numero dele
+ int pool_cancel_batches(ProcPool *pool, Backlog *backlog, Statistics *stats, int batch_id) {
+     int removed = 0;
+     
+     pthread_mutex_lock(&backlog->mutex);
+     pthread_mutex_lock(&stats->mutex);
+     for (Batch *b = backlog->batches; b; b = b->next) {
+         if (batch_id < 0 || b->id == batch_id) {
+             int n = proc_pool_cancel(pool, b->id);
+             b->sent -= n;
+             b->skipped += n;
+             removed += n;
+         }
+     }
+     removed += proc_pool_cancel(pool, batch_id);
+     pthread_mutex_unlock(&stats->mutex);
+     pthread_mutex_unlock(&backlog->mutex);
+     return removed;
+ }
+ 
+ // MOSTRA O ESTADO DO BACKLOG E DOS LOTES POR ACABAR
+ // (no modo processos so se sabe o que ja foi entregue ao anel partilhado)
+ void print_backlog(Backlog *backlog, Statistics *stats, int use_processes, DirWatcher *watcher) {
+     pthread_mutex_lock(&backlog->mutex);
+     pthread_mutex_lock(&stats->mutex);
+     
+     int waiting = 0;
+     for (Batch *b = backlog->feed_head; b; b = b->next_feed) {
+         waiting += b->total - b->queued;
+     }
+     printf("Backlog - %d/%d trabalhos pendentes", backlog->count, backlog->capacity);
+     if (waiting > 0) {
+         printf(", %d imagens ainda por entrar", waiting);
+     }
+     printf("\n");
+     for (Batch *b = backlog->batches; b; b = b->next) {
+         if (b->watching) {
+             printf("Lote %d (%s) - a vigiar, %d chegadas, %d %s\n", b->id, b->input_dir, b->total,
+                    use_processes ? b->sent : b->done, use_processes ? "entregues" : "processadas");
+         } else if (use_processes && b->sent + b->skipped < b->total) {
+             printf("Lote %d (%s) - %d/%d entregues%s\n", b->id, b->input_dir,
+                    b->sent, b->total, b->cancelled ? ", cancelado" : "");
+         } else if (!use_processes && b->done + b->skipped < b->total) {
+             printf("Lote %d (%s) - %d/%d processadas, %d entregues%s\n", b->id, b->input_dir,
+                    b->done, b->total, b->sent, b->cancelled ? ", cancelado" : "");
+         }
+     }
+     if (watcher) {
+         pthread_mutex_lock(&watcher->mutex);
+         printf("WATCH - %lu eventos, %lu repetidos ignorados, %lu rajadas\n",
+                watcher->events, watcher->duplicates, watcher->bursts);
+         pthread_mutex_unlock(&watcher->mutex);
+     }
+     
+     pthread_mutex_unlock(&stats->mutex);
+     pthread_mutex_unlock(&backlog->mutex);
+ }
+ 
+ // Valor da opcao argv[*i] (avanca *i); sem valor termina com uma mensagem
+ static const char *option_value(int argc, char *argv[], int *i) {
+     if (*i + 1 >= argc) {
+         fprintf(stderr, "Erro: A opcao %s precisa de um valor\n", argv[*i]);
+         exit(1);
+     }
+     return argv[++*i];
+ }
+ 
  int main(int argc, char *argv[]) {
-     if (argc != 3) {
-         fprintf(stderr, "Uso: %s <num_threads> <-name|-size>\n", argv[0]);
+     if (argc < 3) {
+         fprintf(stderr, "Uso: %s <num_threads> <-name|-size> [-proc] [-fast] [-fast-check] [-perf] [-trace] [-backlog N] [-commit N] [-thumbs D,D,...] [-mem MB] [-sink file|shm:NOME] [-bands MP] [-codec gd|libjpeg] [-decode fast-dct,fast-upsample] [-encode [saida:]q=N,420|422|444,opt,fast-dct] [-cache MB]\n", argv[0]);
+         fprintf(stderr, "Comandos: DIR <dir>, WATCH <dir>, UNWATCH <lote>, CANCEL <lote>, STAT, TRACE [ficheiro], QUIT [DRAIN|ABORT]\n");
          fprintf(stderr, "Exemplo: %s 4 -size\n", argv[0]);
          exit(1);
      }
@@ -235,46 +632,164 @@
          exit(1);
      }
      
+     // OPCOES EXTRA
+     int use_processes = 0;
+     int backlog_capacity = DEFAULT_BACKLOG;
+     int commit_interval = 0;
+     long band_pixels = BAND_MIN_PIXELS;
+     long long cache_mb = 0;
+     for (int i = 3; i < argc; i++) {
+         if (strcmp(argv[i], "-proc") == 0) {
+             use_processes = 1;
+         } else if (strcmp(argv[i], "-commit") == 0) {
+             commit_interval = atoi(option_value(argc, argv, &i));
+             if (commit_interval <= 0) {
+                 fprintf(stderr, "Erro: Intervalo de commit deve ser positivo\n");
+                 exit(1);
+             }
+         } else if (strcmp(argv[i], "-backlog") == 0) {
+             backlog_capacity = atoi(option_value(argc, argv, &i));
+             if (backlog_capacity <= 0) {
+                 fprintf(stderr, "Erro: Capacidade do backlog deve ser positiva\n");
+                 exit(1);
+             }
+         } else if (strcmp(argv[i], "-bands") == 0) {
+             double mp = atof(option_value(argc, argv, &i));
+             if (mp < 0) {
+                 fprintf(stderr, "Erro: Limite das faixas nao pode ser negativo\n");
+                 exit(1);
+             }
+             band_pixels = (long)(mp * 1000000);
+         } else if (strcmp(argv[i], "-cache") == 0) {
+             cache_mb = atoll(option_value(argc, argv, &i));
+             if (cache_mb <= 0) {
+                 fprintf(stderr, "Erro: Tamanho da cache invalido %s\n", argv[i]);
+                 exit(1);
+             }
+         } else {
+             // opcoes comuns a todos os front-ends (libphotoproc)
+             int used = photoproc_option(argc - i, argv + i);
+             if (used == 0) {
+                 fprintf(stderr, "Erro: Opcao desconhecida %s\n", argv[i]);
+             }
+             if (used <= 0) {
+                 exit(1);
+             }
+             i += used - 1;
+         }
+     }
+     
+     // ESCRITA ATOMICA + DIARIO (opcional): todos os lotes vao para a mesma pasta
+     if (commit_interval > 0) {
+         create_directory("./Result-image-dir");
+         pipeline_options.committer = output_commit_open("./Result-image-dir", commit_interval);
+         if (!pipeline_options.committer) {
+             exit(1);
+         }
+     }
+     
+     // FAIXAS DAS IMAGENS GRANDES: as threads de B ficam bloqueadas no pipe,
+     // por isso quem ajuda sao threads auxiliares (no maximo num_threads - 1,
+     // e com -proc os CPUs divididos pelos processos)
+     image_set_bands(band_pixels, helper_pool_share(use_processes ? num_threads : 1, num_threads - 1));
+     
+     // CACHE DE IMAGENS DESCODIFICADAS: antes das threads/processos; com
+     // -proc cada trabalhador tem a sua parte do orcamento
+     if (cache_mb > 0 && !image_cache_enable(cache_mb * 1024 * 1024, use_processes ? num_threads : 1)) {
+         fprintf(stderr, "Erro ao criar a cache de imagens\n");
+         exit(1);
+     }
+     
+     // MODO PROCESSOS: anel de trabalhos em memoria partilhada
+     ProcPool *pool = NULL;
+     if (use_processes) {
+         pool = proc_pool_create(num_threads, process_image, pipeline_flush_outputs);
+         if (!pool) {
+             fprintf(stderr, "Erro ao criar processos trabalhadores\n");
+             exit(1);
+         }
+         if (image_cache_enabled()) {
+             // cada processo tem a sua cache: a mesma imagem volta ao mesmo processo
+             proc_pool_set_affinity(pool, 4 * num_threads);
+         }
+     }
+     
      // CRIACAO DOS PIPES
      int pipes[num_threads][2];
-     for (int i = 0; i < num_threads; i++) {
+     for (int i = 0; i < num_threads && !use_processes; i++) {
          if (pipe(pipes[i]) == -1) {
              perror("Erro ao criar pipe");
              exit(1);
          }
+         // so a escrita e nao bloqueante; as threads continuam a bloquear no read
+         fcntl(pipes[i][1], F_SETFL, fcntl(pipes[i][1], F_GETFL) | O_NONBLOCK);
      }
      
      // INICIA AS ESTATISTICAS
      Statistics stats;
      stats.total_images = 0;
      stats.total_time = 0.0;
+     stats.watched_images = 0;
+     stats.latency_sum = 0.0;
+     stats.latency_max = 0.0;
      pthread_mutex_init(&stats.mutex, NULL);
      
+     // BACKLOG (as threads libertam os lotes que acabam)
+     Backlog backlog;
+     memset(&backlog, 0, sizeof(Backlog));
+     backlog.capacity = backlog_capacity;
+     backlog.jobs = malloc(backlog_capacity * sizeof(PendingJob));
+     if (!backlog.jobs) {
+         fprintf(stderr, "Erro: sem memoria para um backlog de %d trabalhos\n", backlog_capacity);
+         exit(1);
+     }
+     backlog.next_batch_id = 1;
+     backlog.use_processes = use_processes;
+     pthread_mutex_init(&backlog.mutex, NULL);
+     pthread_cond_init(&backlog.not_empty, NULL);
+     pthread_cond_init(&backlog.not_full, NULL);
+     
      // CRIACAO DAS THEREWDSA QUE VAO TRABAHAR
      pthread_t threads[num_threads];  // ESTE TEM DE TER _t!
      ThreadData thread_data[num_threads];
      
-     for (int i = 0; i < num_threads; i++) {
+     for (int i = 0; i < num_threads && !use_processes; i++) {
          thread_data[i].pipe_fd = pipes[i][0];  /* fd de LEITURA */
          thread_data[i].stats = &stats;
+         thread_data[i].backlog = &backlog;
          thread_data[i].thread_id = i;
          
          pthread_create(&threads[i], NULL, thread_worker, &thread_data[i]);
      }
      
-     printf("Foram criadas %d threads\n", num_threads);
+     printf("Foram criad%s %d %s\n", use_processes ? "os" : "as",
+            num_threads, use_processes ? "processos" : "threads");
+     
+     // THREAD QUE SUBMETE
+     SubmitterData submitter_data;
+     submitter_data.backlog = &backlog;
+     submitter_data.stats = &stats;
+     submitter_data.num_threads = num_threads;
+     submitter_data.pipes = pipes;
+     submitter_data.pool = pool;
+     pthread_t submitter;
+     pthread_create(&submitter, NULL, submitter_thread, &submitter_data);
+     
+     // THREAD DO WATCH: SO ARRANCA NO PRIMEIRO COMANDO WATCH
+     WatchContext watch_context = { &backlog, &stats };
+     DirWatcher *watcher = NULL;
      
      //CICLO DOS COMANDOS
      char linha[100], palavra_1[100], palavra_2[100];
      int should_quit = 0;
-     int next_thread = 0;  /* Para distribuicao round-robin */
+     int abort_on_quit = 0;
      
      while (!should_quit) {
          printf("Qual o comando: ");
          fflush(stdout);
          
          if (fgets(linha, 100, stdin) == NULL) {
-             break;
+             break;  /* fim do stdin: igual a QUIT */
          }
          
          int n_palavras = sscanf(linha, "%s %s", palavra_1, palavra_2);
@@ -284,70 +799,220 @@
              if (strcmp(palavra_1, "DIR") == 0 && n_palavras == 2) {
                  char *input_dir = palavra_2;
                  
-                 ImageInfo images[MAX_IMAGES];
-                 int num_images = list_images(input_dir, images);
+                 Catalog *catalog = catalog_scan(input_dir);
+                 if (!catalog) {
+                     fprintf(stderr, "Erro ao abrir diretoria %s\n", input_dir);
+                     continue;
+                 }
+                 int num_images = catalog->count;
                  
                  if (num_images == 0) {
                      printf("Nenhuma imagem encontrada em %s\n", input_dir);
+                     catalog_free(catalog);
                      continue;
                  }
                  
                  //ORDENAR IMAGNENS
                  if (strcmp(sort_mode, "-name") == 0) {
-                     qsort(images, num_images, sizeof(ImageInfo), compare_by_name);
+                     catalog_sort(catalog, CATALOG_BY_NAME, num_threads);
                  } else {
-                     qsort(images, num_images, sizeof(ImageInfo), compare_by_size);
+                     catalog_sort(catalog, CATALOG_BY_SIZE, num_threads);
                  }
                  
-                 printf("A %d imagens na pasta %s serão processadas pelas %d threads\n",
-                        num_images, input_dir, num_threads);
-                 
                  // criar output
                 char output_dir[MAX_PATH];
                 snprintf(output_dir, MAX_PATH, "./Result-image-dir");
                 create_directory(output_dir);
                  
-                 for (int i = 0; i < num_images; i++) {
-                     ImageTask task;
-                     strncpy(task.input_dir, input_dir, MAX_PATH - 1);
-                     strncpy(task.output_dir, output_dir, MAX_PATH - 1);
-                     strncpy(task.filename, images[i].filename, 255);
-                     task.filename[255] = '\0';
-                     task.terminate = 0;
-                     
-                     write(pipes[next_thread][1], &task, sizeof(ImageTask));
-                     
-                     next_thread = (next_thread + 1) % num_threads;
+                 // SO COLOCA NO BACKLOG: QUEM ESCREVE NOS PIPES E A THREAD QUE SUBMETE
+                 int batch_id = backlog_add_batch(&backlog, input_dir, output_dir, catalog);
+                 if (!batch_id) {
+                     catalog_free(catalog);
+                 } else {
+                     printf("Lote %d: %d imagens na pasta %s serão processadas pelas %d threads\n",
+                            batch_id, num_images, input_dir, num_threads);
                  }
              }
+             //WATCH: PROCESSA CADA JPEG QUE CHEGAR A PASTA (as que ja la estao nao)
+             else if (strcmp(palavra_1, "WATCH") == 0 && n_palavras == 2) {
+                 if (!watcher) {
+                     watcher = dir_watch_start(backlog_add_arrivals, &watch_context);
+                     if (!watcher) {
+                         printf("WATCH nao disponivel neste sistema\n");
+                         continue;
+                     }
+                 }
+                 char output_dir[MAX_PATH];
+                 snprintf(output_dir, MAX_PATH, "./Result-image-dir");
+                 create_directory(output_dir);
+                 
+                 Batch *batch = backlog_add_watch(&backlog, palavra_2, output_dir);
+                 if (!batch) {
+                     printf("Erro: sem memoria para o lote de %s\n", palavra_2);
+                     continue;
+                 }
+                 if (!dir_watch_add(watcher, palavra_2, batch)) {
+                     printf("Erro ao vigiar %s\n", palavra_2);
+                     backlog_cancel(&backlog, &stats, batch->id);
+                     continue;
+                 }
+                 printf("Lote %d: a vigiar a pasta %s\n", batch->id, palavra_2);
+             }
+             //UNWATCH
+             else if (strcmp(palavra_1, "UNWATCH") == 0 && n_palavras == 2) {
+                 int batch_id = atoi(palavra_2);
+                 Batch *batch = NULL;
+                 pthread_mutex_lock(&backlog.mutex);
+                 for (Batch *b = backlog.batches; b; b = b->next) {
+                     if (b->id == batch_id && b->watching) {
+                         batch = b;
+                     }
+                 }
+                 pthread_mutex_unlock(&backlog.mutex);
+                 // um lote de WATCH so e libertado no fim
+                 if (!batch || !dir_watch_remove(watcher, batch)) {
+                     printf("Lote %d nao esta a ser vigiado\n", batch_id);
+                     continue;
+                 }
+                 pthread_mutex_lock(&backlog.mutex);
+                 batch->watching = 0;
+                 pthread_mutex_unlock(&backlog.mutex);
+                 printf("Lote %d: deixou de vigiar %s (%d chegadas)\n", batch_id, batch->input_dir, batch->total);
+             }
+             //CANCEL
+             else if (strcmp(palavra_1, "CANCEL") == 0 && n_palavras == 2) {
+                 int batch_id = atoi(palavra_2);
+                 int found = 0;
+                 Batch *watched = NULL;
+                 pthread_mutex_lock(&backlog.mutex);
+                 for (Batch *b = backlog.batches; b; b = b->next) {
+                     if (b->id == batch_id) {
+                         found = 1;
+                         watched = b->watching ? b : NULL;
+                     }
+                 }
+                 pthread_mutex_unlock(&backlog.mutex);
+                 // com -proc um lote ja libertado ainda pode ter trabalhos no anel
+                 if (batch_id <= 0 || (!found && !use_processes)) {
+                     printf("Lote %s nao encontrado (nao existe ou ja acabou)\n", palavra_2);
+                     continue;
+                 }
+                 if (watched) {
+                     dir_watch_remove(watcher, watched);
+                     pthread_mutex_lock(&backlog.mutex);
+                     watched->watching = 0;
+                     pthread_mutex_unlock(&backlog.mutex);
+                 }
+                 int dropped = found ? backlog_cancel(&backlog, &stats, batch_id) : 0;
+                 if (use_processes) {
+                     int removed = pool_cancel_batches(pool, &backlog, &stats, batch_id);
+                     if (!found && removed == 0) {
+                         printf("Lote %d nao encontrado (nao existe ou ja acabou)\n", batch_id);
+                         continue;
+                     }
+                     printf("Lote %d cancelado: %d trabalhos retirados do backlog e %d do anel partilhado\n",
+                            batch_id, dropped, removed);
+                 } else {
+                     printf("Lote %d cancelado: %d trabalhos retirados do backlog\n", batch_id, dropped);
+                 }
+                 backlog_retire_finished(&backlog, &stats);
+             }
              //STAT
              else if (strcmp(palavra_1, "STAT") == 0) {
-                 print_statistics(&stats);
+                 if (use_processes) {
+                     proc_pool_print_statistics(pool);
+                 } else {
+                     print_statistics(&stats);
+                 }
+                 print_backlog(&backlog, &stats, use_processes, watcher);
+                 mem_budget_report(stdout);
+                 image_cache_report(stdout);
+                 perf_counters_report(stdout);
+             }
+             //TRACE [ficheiro]
+             else if (strcmp(palavra_1, "TRACE") == 0) {
+                 if (!trace_enabled()) {
+                     printf("Tracer desligado (usar a opcao -trace)\n");
+                     continue;
+                 }
+                 const char *trace_file = n_palavras == 2 ? palavra_2 : "trace.json";
+                 int events = trace_dump(trace_file);
+                 if (events < 0) {
+                     printf("Erro ao criar %s\n", trace_file);
+                 } else {
+                     printf("Trace com %d eventos guardado em %s\n", events, trace_file);
+                 }
              }
              //QUIT
+             // QUIT [DRAIN|ABORT]: DRAIN (omissao) acaba o trabalho pendente,
+             // ABORT descarta o backlog e o que ainda esta nos pipes
              else if (strcmp(palavra_1, "QUIT") == 0) {
-                 should_quit = 1;
-                 
-                 for (int i = 0; i < num_threads; i++) {
-                     ImageTask task;
-                     task.terminate = 1;
-                     write(pipes[i][1], &task, sizeof(ImageTask));
+                 if (n_palavras == 2 && strcmp(palavra_2, "ABORT") == 0) {
+                     abort_on_quit = 1;
+                 } else if (n_palavras == 2 && strcmp(palavra_2, "DRAIN") != 0) {
+                     printf("comando inválido\n");
+                     continue;
                  }
+                 should_quit = 1;
              }
              else {
                  printf("comando inválido\n");
              }
          }
      }
-     for (int i = 0; i < num_threads; i++) {
+     if (abort_on_quit) {
+         int dropped = backlog_cancel(&backlog, &stats, -1);
+         if (use_processes) {
+             dropped += pool_cancel_batches(pool, &backlog, &stats, -1);
+         }
+         backlog_retire_finished(&backlog, &stats);
+         printf("%d trabalhos pendentes descartados\n", dropped);
+     }
+     // a ultima rajada ainda entra no backlog (com DRAIN e processada)
+     if (watcher) {
+         dir_watch_stop(watcher);
+     }
+     pthread_mutex_lock(&backlog.mutex);
+     backlog.quitting = 1;
+     pthread_cond_signal(&backlog.not_empty);
+     pthread_mutex_unlock(&backlog.mutex);
+     pthread_join(submitter, NULL);
+     
+     if (use_processes) {
+         proc_pool_finish(pool);
+         proc_pool_print_statistics(pool);
+         proc_pool_destroy(pool);
+     }
+     for (int i = 0; i < num_threads && !use_processes; i++) {
          pthread_join(threads[i], NULL);
          close(pipes[i][0]); 
          close(pipes[i][1]); 
      }
      
-     print_statistics(&stats);
+     if (pipeline_options.committer) {
+         output_commit_close(pipeline_options.committer);
+     }
+     if (pipeline_options.sink) {
+         shm_sink_close(pipeline_options.sink);
+     }
+     if (!use_processes) {
+         print_statistics(&stats);
+     }
+     image_cache_report(stdout);
+     perf_counters_report(stdout);
      
      pthread_mutex_destroy(&stats.mutex);
      
+     while (backlog.batches) {
+         Batch *next = backlog.batches->next;
+         catalog_free(backlog.batches->catalog);
+         free(backlog.batches);
+         backlog.batches = next;
+     }
+     free(backlog.jobs);
+     pthread_mutex_destroy(&backlog.mutex);
+     pthread_cond_destroy(&backlog.not_empty);
+     pthread_cond_destroy(&backlog.not_full);
+     
      return 0;
  }
\ No newline at end of file
@@ -0,0 +1,539 @@
+#include "process-pool.h"
+#include "mem-budget.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define REAPER_TICK_MS 10         // intervalo entre verificacoes dos filhos
+
+// Lock que recupera o mutex se o dono morreu com ele fechado
+static void pool_lock(ProcShared *shm) {
+    int r = pthread_mutex_lock(&shm->mutex);
+#ifdef PTHREAD_MUTEX_ROBUST
+    if (r == EOWNERDEAD) {
+        pthread_mutex_consistent(&shm->mutex);
+    }
+#else
+    (void)r;
+#endif
+}
+
+static void pool_wait(pthread_cond_t *cond, ProcShared *shm) {
+    int r = pthread_cond_wait(cond, &shm->mutex);
+#ifdef PTHREAD_MUTEX_ROBUST
+    if (r == EOWNERDEAD) {
+        pthread_mutex_consistent(&shm->mutex);
+    }
+#else
+    (void)r;
+#endif
+}
+
+
+// FNV-1a do caminho: escolhe o processo preferido de cada ficheiro
+static int path_owner(const char *dir, const char *filename, int num_workers) {
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)dir; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    h = (h ^ '/') * 16777619u;
+    for (const unsigned char *p = (const unsigned char *)filename; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    return h % num_workers;
+}
+
+// Com afinidade, traz para a cabeca do anel o primeiro trabalho deste
+// processo entre os proximos shm->affinity. Chamada com o mutex fechado
+static void pick_own_job(ProcShared *shm, int slot_id) {
+    int window = shm->affinity < shm->count ? shm->affinity : shm->count;
+    for (int k = 1; k < window && shm->ring[shm->head].owner != slot_id; k++) {
+        int pos = (shm->head + k) % PROC_RING_SLOTS;
+        if (shm->ring[pos].owner == slot_id) {
+            ProcJob tmp = shm->ring[pos];
+            shm->ring[pos] = shm->ring[shm->head];
+            shm->ring[shm->head] = tmp;
+        }
+    }
+}
+
+// Com orcamento de memoria, se o trabalho da cabeca nao cabe agora traz para
+// a cabeca o primeiro dos proximos PROC_MEM_LOOKAHEAD que cabe, sem mudar a
+// ordem dos outros. Se nenhum couber fica o da cabeca (espera no acquire).
+// Chamada com o mutex fechado
+static void pick_fitting_job(ProcShared *shm) {
+    int window = PROC_MEM_LOOKAHEAD < shm->count ? PROC_MEM_LOOKAHEAD : shm->count;
+    if (mem_budget_fits(shm->ring[shm->head].cost)) {
+        return;
+    }
+    for (int k = 1; k < window; k++) {
+        int pos = (shm->head + k) % PROC_RING_SLOTS;
+        if (mem_budget_fits(shm->ring[pos].cost)) {
+            ProcJob tmp = shm->ring[pos];
+            for (int j = k; j > 0; j--) {
+                shm->ring[(shm->head + j) % PROC_RING_SLOTS] = shm->ring[(shm->head + j - 1) % PROC_RING_SLOTS];
+            }
+            shm->ring[shm->head] = tmp;
+            return;
+        }
+    }
+}
+
+
+// CICLO DE CADA PROCESSO TRABALHADOR
+static void worker_loop(ProcPool *pool, int slot_id) {
+    ProcShared *shm = pool->shm;
+    ProcWorkerSlot *slot = &shm->workers[slot_id];
+
+    while (1) {
+        pool_lock(shm);
+        if (shm->count == 0 && pool->idle_fn) {
+            // sem trabalho: trata do que tem pendente antes de esperar
+            pthread_mutex_unlock(&shm->mutex);
+            pool->idle_fn();
+            pool_lock(shm);
+        }
+        while (shm->count == 0 && !shm->closing) {
+            pool_wait(&shm->not_empty, shm);
+        }
+        if (shm->count == 0) {
+            pthread_mutex_unlock(&shm->mutex);
+            break;
+        }
+
+        // Retira o trabalho e regista-o como "em curso" antes de largar o lock
+        if (shm->affinity) {
+            pick_own_job(shm, slot_id);
+        }
+        if (mem_budget_enabled()) {
+            pick_fitting_job(shm);
+        }
+        slot->job = shm->ring[shm->head];
+        shm->head = (shm->head + 1) % PROC_RING_SLOTS;
+        shm->count--;
+        slot->busy = 1;
+        pthread_cond_signal(&shm->not_full);
+        pthread_mutex_unlock(&shm->mutex);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        char input_path[PROC_MAX_PATH];
+        snprintf(input_path, PROC_MAX_PATH, "%s/%s", slot->job.input_dir, slot->job.filename);
+        pool->fn(input_path, slot->job.output_dir, slot->job.filename);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double time_seconds = (end.tv_sec - start.tv_sec) +
+                              (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+
+        //ATUALIZA AS ESTATISTICAS PARTILHADAS
+        pool_lock(shm);
+        slot->busy = 0;
+        slot->processed++;
+        slot->busy_time += time_seconds;
+        shm->total_images++;
+        shm->total_time += time_seconds;
+        if (slot->job.arrival.tv_sec || slot->job.arrival.tv_nsec) {
+            // da chegada do ficheiro ate ao ultimo resultado escrito
+            double latency = (end.tv_sec - slot->job.arrival.tv_sec) +
+                             (end.tv_nsec - slot->job.arrival.tv_nsec) / 1000000000.0;
+            shm->latency_count++;
+            shm->latency_sum += latency;
+            if (latency > shm->latency_max) {
+                shm->latency_max = latency;
+            }
+        }
+        printf("processo %d (pid %d) processou %s em %.2fs\n",
+               slot_id, (int)getpid(), slot->job.filename, time_seconds);
+        fflush(stdout);
+        pthread_mutex_unlock(&shm->mutex);
+    }
+}
+
+// Cria (ou recria) o processo de um slot
+static int spawn_worker(ProcPool *pool, int slot_id) {
+    // Evita que o filho herde o stdio trancado por outra thread ou por despejar
+    fflush(stdout);
+    fflush(stderr);
+    flockfile(stdout);
+    flockfile(stderr);
+    pid_t pid = fork();
+    funlockfile(stderr);
+    funlockfile(stdout);
+
+    if (pid == 0) {
+        worker_loop(pool, slot_id);
+        fflush(stdout);
+        _exit(0);
+    }
+    if (pid < 0) {
+        perror("Erro no fork");
+        return 0;
+    }
+    pool_lock(pool->shm);
+    pool->shm->workers[slot_id].pid = pid;
+    pthread_mutex_unlock(&pool->shm->mutex);
+    return 1;
+}
+
+static int workers_alive(ProcShared *shm) {
+    int alive = 0;
+    for (int i = 0; i < shm->num_workers; i++) {
+        if (shm->workers[i].pid != 0) {
+            alive++;
+        }
+    }
+    return alive;
+}
+
+// Um filho do pool terminou (status -1: outra parte do programa ja o
+// recolheu e o estado perdeu-se). Recria-o se morreu antes do fim
+static void worker_exited(ProcPool *pool, int slot_id, int status) {
+    ProcShared *shm = pool->shm;
+    ProcWorkerSlot *slot = &shm->workers[slot_id];
+    int crashed = status < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+
+    pool_lock(shm);
+    if (slot->busy) {
+        // O trabalho em curso conta como falhado
+        slot->busy = 0;
+        shm->failed_images++;
+        if (status < 0) {
+            fprintf(stderr, "\tProcesso %d terminou a processar %s: imagem marcada como falhada\n",
+                    slot_id, slot->job.filename);
+        } else {
+            fprintf(stderr, "\tProcesso %d morreu a processar %s (%s %d): imagem marcada como falhada\n",
+                    slot_id, slot->job.filename,
+                    WIFSIGNALED(status) ? "sinal" : "codigo",
+                    WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+        }
+    }
+    slot->pid = 0;
+
+    int respawn = crashed && !(shm->closing && shm->count == 0);
+    if (respawn) {
+        slot->respawns++;
+    }
+    pthread_mutex_unlock(&shm->mutex);
+
+    if (respawn) {
+        spawn_worker(pool, slot_id);
+    }
+}
+
+// THREAD DO COORDENADOR: RECOLHE FILHOS E RECRIA OS QUE MORRERAM
+// So espera pelos pids do pool (um waitpid(-1) roubaria os filhos de quem
+// usa o pool), por isso verifica-os a cada REAPER_TICK_MS
+static void *reaper_thread(void *arg) {
+    ProcPool *pool = (ProcPool *)arg;
+    ProcShared *shm = pool->shm;
+    int ticks = 0;
+
+    while (1) {
+        int reaped = 0;
+        for (int i = 0; i < shm->num_workers; i++) {
+            pid_t pid = shm->workers[i].pid;
+            int status;
+            if (pid == 0) {
+                continue;
+            }
+            pid_t r = waitpid(pid, &status, WNOHANG);
+            if (r == pid) {
+                worker_exited(pool, i, status);
+                reaped = 1;
+            } else if (r < 0 && errno == ECHILD) {
+                worker_exited(pool, i, -1);
+                reaped = 1;
+            }
+        }
+
+        pool_lock(shm);
+        int closing = shm->closing;
+        int done = closing && shm->count == 0;
+        int alive = workers_alive(shm);
+        pthread_mutex_unlock(&shm->mutex);
+        if (closing && alive == 0) {
+            break;
+        }
+        if (reaped) {
+            continue;
+        }
+
+        // Slots sem processo (fork falhado): volta a tentar a cada segundo
+        if (++ticks % (1000 / REAPER_TICK_MS) == 0 && !done) {
+            for (int i = 0; i < shm->num_workers; i++) {
+                if (shm->workers[i].pid == 0) {
+                    spawn_worker(pool, i);
+                }
+            }
+        }
+        usleep(REAPER_TICK_MS * 1000);
+    }
+
+    return NULL;
+}
+
+
+/******************************************************************************
+ * proc_pool_create()
+ *
+ * Arguments: num_workers - number of worker processes
+ *            fn - function each worker calls for every job
+ *            idle_fn - function each worker calls when the ring is empty,
+ *                      before waiting or exiting (may be NULL)
+ * Returns: pool - pointer to the pool, or NULL in case of failure
+ * Side-Effects: forks num_workers processes and starts a reaper thread
+ *
+ * Description: creates the shared block and the worker processes
+ *
+ *****************************************************************************/
+ProcPool *proc_pool_create(int num_workers, proc_job_fn fn, proc_idle_fn idle_fn) {
+    ProcPool *pool = calloc(1, sizeof(ProcPool));
+    if (!pool) {
+        return NULL;
+    }
+    pool->fn = fn;
+    pool->idle_fn = idle_fn;
+    pool->shm_size = sizeof(ProcShared) + num_workers * sizeof(ProcWorkerSlot);
+
+    // Memoria partilhada POSIX; o nome sai logo do sistema, o mapeamento fica
+    char shm_name[64];
+    snprintf(shm_name, sizeof(shm_name), "/ppp-pool-%d", (int)getpid());
+    int fd = shm_open(shm_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("Erro no shm_open");
+        free(pool);
+        return NULL;
+    }
+    shm_unlink(shm_name);
+    if (ftruncate(fd, pool->shm_size) != 0) {
+        perror("Erro no ftruncate");
+        close(fd);
+        free(pool);
+        return NULL;
+    }
+    pool->shm = mmap(NULL, pool->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pool->shm == MAP_FAILED) {
+        perror("Erro no mmap");
+        free(pool);
+        return NULL;
+    }
+
+    ProcShared *shm = pool->shm;
+    memset(shm, 0, pool->shm_size);
+    shm->num_workers = num_workers;
+
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+#ifdef PTHREAD_MUTEX_ROBUST
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+#endif
+    pthread_mutex_init(&shm->mutex, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&shm->not_empty, &cattr);
+    pthread_cond_init(&shm->not_full, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    for (int i = 0; i < num_workers; i++) {
+        spawn_worker(pool, i);
+    }
+
+    pthread_create(&pool->reaper, NULL, reaper_thread, pool);
+    return pool;
+}
+
+
+/******************************************************************************
+ * proc_pool_submit()
+ *
+ * Arguments: pool - pointer to pool
+ *            input_dir, output_dir, filename - job description
+ *            arrival - when the file arrived (CLOCK_MONOTONIC), or NULL
+ *            tag - caller's mark for proc_pool_cancel()
+ *            cost - predicted pixel memory, or 0
+ * Returns: (bool) 1 in case of success, 0 if the pool is closing
+ * Side-Effects: blocks while the ring is full
+ *
+ * Description: places a job in the shared ring
+ *
+ *****************************************************************************/
+int proc_pool_submit(ProcPool *pool, const char *input_dir, const char *output_dir, const char *filename,
+                     const struct timespec *arrival, long tag, long long cost) {
+    ProcShared *shm = pool->shm;
+
+    pool_lock(shm);
+    while (shm->count == PROC_RING_SLOTS && !shm->closing) {
+        pool_wait(&shm->not_full, shm);
+    }
+    if (shm->closing) {
+        pthread_mutex_unlock(&shm->mutex);
+        return 0;
+    }
+
+    ProcJob *job = &shm->ring[shm->tail];
+    strncpy(job->input_dir, input_dir, PROC_MAX_PATH - 1);
+    job->input_dir[PROC_MAX_PATH - 1] = '\0';
+    strncpy(job->output_dir, output_dir, PROC_MAX_PATH - 1);
+    job->output_dir[PROC_MAX_PATH - 1] = '\0';
+    strncpy(job->filename, filename, 255);
+    job->filename[255] = '\0';
+    job->id = shm->next_id++;
+    if (arrival) {
+        job->arrival = *arrival;
+    } else {
+        memset(&job->arrival, 0, sizeof(job->arrival));
+    }
+    job->owner = path_owner(job->input_dir, job->filename, shm->num_workers);
+    job->tag = tag;
+    job->cost = cost;
+
+    shm->tail = (shm->tail + 1) % PROC_RING_SLOTS;
+    shm->count++;
+    pthread_cond_signal(&shm->not_empty);
+    pthread_mutex_unlock(&shm->mutex);
+    return 1;
+}
+
+
+/******************************************************************************
+ * proc_pool_set_affinity()
+ *
+ * Arguments: pool - pointer to pool
+ *            window - jobs at the head of the ring a worker may look at
+ *                     (0 = plain FIFO)
+ * Returns: none
+ * Side-Effects: changes the order in which workers take jobs
+ *
+ *****************************************************************************/
+void proc_pool_set_affinity(ProcPool *pool, int window) {
+    pool_lock(pool->shm);
+    pool->shm->affinity = window < PROC_RING_SLOTS ? window : PROC_RING_SLOTS;
+    pthread_mutex_unlock(&pool->shm->mutex);
+}
+
+
+/******************************************************************************
+ * proc_pool_cancel()
+ *
+ * Arguments: pool - pointer to pool
+ *            tag - tag of the jobs to remove (< 0: every job)
+ * Returns: number of jobs removed
+ * Side-Effects: removes from the ring the jobs with this tag that no worker
+ *               took yet
+ *
+ *****************************************************************************/
+int proc_pool_cancel(ProcPool *pool, long tag) {
+    ProcShared *shm = pool->shm;
+    int kept = 0;
+
+    pool_lock(shm);
+    // compacta o anel mantendo a ordem dos restantes
+    int count = shm->count;
+    for (int i = 0; i < count; i++) {
+        ProcJob *job = &shm->ring[(shm->head + i) % PROC_RING_SLOTS];
+        if (tag >= 0 && job->tag != tag) {
+            if (kept != i) {
+                shm->ring[(shm->head + kept) % PROC_RING_SLOTS] = *job;
+            }
+            kept++;
+        }
+    }
+    shm->count = kept;
+    shm->tail = (shm->head + kept) % PROC_RING_SLOTS;
+    if (kept < count) {
+        pthread_cond_broadcast(&shm->not_full);
+    }
+    pthread_mutex_unlock(&shm->mutex);
+    return count - kept;
+}
+
+
+/******************************************************************************
+ * proc_pool_print_statistics()
+ *
+ * Arguments: pool - pointer to pool
+ * Returns: none
+ * Side-Effects: writes to stdout
+ *
+ * Description: prints processed/failed counts and the average time
+ *
+ *****************************************************************************/
+void proc_pool_print_statistics(ProcPool *pool) {
+    ProcShared *shm = pool->shm;
+
+    pool_lock(shm);
+    if (shm->total_images > 0) {
+        double avg_time = shm->total_time / shm->total_images;
+        printf("Numero total de imagens processadas - %d\n", shm->total_images);
+        printf("Tempo médio de processamento - %.2fs\n", avg_time);
+    } else {
+        printf("0 imagens - 0.0s tempo médio\n");
+    }
+    if (shm->failed_images > 0) {
+        printf("Imagens falhadas (processo morreu) - %d\n", shm->failed_images);
+    }
+    if (shm->latency_count > 0) {
+        printf("Latencia chegada -> resultados (WATCH) - media %.3fs, maxima %.3fs, %d imagens\n",
+               shm->latency_sum / shm->latency_count, shm->latency_max, shm->latency_count);
+    }
+    pthread_mutex_unlock(&shm->mutex);
+}
+
+
+/******************************************************************************
+ * proc_pool_finish()
+ *
+ * Arguments: pool - pointer to pool
+ * Returns: none
+ * Side-Effects: waits for every queued job and for all workers to exit
+ *
+ * Description: closes the ring, lets the workers drain it and collects them
+ *
+ *****************************************************************************/
+void proc_pool_finish(ProcPool *pool) {
+    if (pool->finished) {
+        return;
+    }
+    ProcShared *shm = pool->shm;
+
+    pool_lock(shm);
+    shm->closing = 1;
+    pthread_cond_broadcast(&shm->not_empty);
+    pthread_cond_broadcast(&shm->not_full);
+    pthread_mutex_unlock(&shm->mutex);
+
+    pthread_join(pool->reaper, NULL);
+    pool->finished = 1;
+}
+
+
+/******************************************************************************
+ * proc_pool_destroy()
+ *
+ * Arguments: pool - pointer to pool
+ * Returns: none
+ * Side-Effects: calls proc_pool_finish() if needed and frees the pool
+ *
+ * Description: releases the shared memory block
+ *
+ *****************************************************************************/
+void proc_pool_destroy(ProcPool *pool) {
+    proc_pool_finish(pool);
+    pthread_mutex_destroy(&pool->shm->mutex);
+    pthread_cond_destroy(&pool->shm->not_empty);
+    pthread_cond_destroy(&pool->shm->not_full);
+    munmap(pool->shm, pool->shm_size);
+    free(pool);
+}
@@ -0,0 +1,176 @@
+#ifndef PROCESS_POOL_H
+#define PROCESS_POOL_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <time.h>
+
+#define PROC_MAX_PATH 4096
+#define PROC_RING_SLOTS 256
+#define PROC_MEM_LOOKAHEAD 16     // trabalhos vistos a procura de um que caiba no orcamento
+
+// Funcao que processa uma imagem (a mesma process_image das threads)
+typedef void (*proc_job_fn)(const char *input_path, const char *output_dir, const char *filename);
+
+// Chamada por cada processo trabalhador quando fica sem trabalhos, antes de
+// esperar por mais ou de terminar (pode ser NULL)
+typedef void (*proc_idle_fn)(void);
+
+// Trabalho colocado no anel partilhado
+typedef struct {
+    char input_dir[PROC_MAX_PATH];
+    char output_dir[PROC_MAX_PATH];
+    char filename[256];
+    long id;                      // numero sequencial do trabalho
+    struct timespec arrival;      // chegada do ficheiro (WATCH); 0 = sem hora
+    int owner;                    // processo preferido (mesmo ficheiro, mesmo processo)
+    long tag;                     // de quem submeteu (proc_pool_cancel())
+    long long cost;               // memoria prevista (0 = desconhecida)
+} ProcJob;
+
+// Estado de cada processo trabalhador (em memoria partilhada)
+typedef struct {
+    pid_t pid;                    // 0 se o slot nao tem processo
+    int busy;                     // 1 enquanto processa job
+    ProcJob job;                  // copia do trabalho em curso
+    int processed;                // imagens concluidas por este slot
+    int respawns;                 // vezes que o processo foi recriado
+    double busy_time;             // tempo acumulado a processar (s)
+} ProcWorkerSlot;
+
+// Bloco partilhado: anel de trabalhos + estatisticas
+typedef struct {
+    pthread_mutex_t mutex;        // robusto e partilhado entre processos
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    int head, tail, count;
+    int closing;                  // 1 = nao entram mais trabalhos
+    long next_id;
+    int total_images;
+    int failed_images;
+    double total_time;
+    int latency_count;            // imagens com hora de chegada
+    double latency_sum, latency_max;
+    int num_workers;
+    int affinity;                 // trabalhos vistos a procura do seu (0 = FIFO)
+    ProcJob ring[PROC_RING_SLOTS];
+    ProcWorkerSlot workers[];
+} ProcShared;
+
+typedef struct {
+    ProcShared *shm;
+    size_t shm_size;
+    proc_job_fn fn;
+    proc_idle_fn idle_fn;
+    pthread_t reaper;             // thread do coordenador que recolhe os filhos
+    int finished;
+} ProcPool;
+
+
+/******************************************************************************
+ * proc_pool_create()
+ *
+ * Arguments: num_workers - number of worker processes
+ *            fn - function each worker calls for every job
+ *            idle_fn - function each worker calls when the ring is empty,
+ *                      before waiting or exiting (may be NULL)
+ * Returns: pool - pointer to the pool, or NULL in case of failure
+ * Side-Effects: forks num_workers processes and starts a reaper thread
+ *
+ * Description: creates a POSIX shared memory block with a job ring and the
+ *              global statistics and forks the worker processes that consume
+ *              it. Workers that die are respawned by the reaper thread and
+ *              the job they had in flight is counted as failed.
+ *
+ *****************************************************************************/
+ProcPool *proc_pool_create(int num_workers, proc_job_fn fn, proc_idle_fn idle_fn);
+
+/******************************************************************************
+ * proc_pool_submit()
+ *
+ * Arguments: pool - pointer to pool
+ *            input_dir, output_dir, filename - job description
+ *            arrival - when the file arrived (CLOCK_MONOTONIC), or NULL
+ *            tag - caller's mark for proc_pool_cancel() (e.g. a batch id)
+ *            cost - predicted pixel memory (mem_predict_bytes()), or 0
+ * Returns: (bool) 1 in case of success, 0 if the pool is closing
+ * Side-Effects: blocks while the ring is full
+ *
+ * Description: places a job in the shared ring. With a memory budget, a
+ *              worker whose next job doesn't fit right now takes the first
+ *              of the following PROC_MEM_LOOKAHEAD that does (as the
+ *              threads of A do)
+ *
+ *****************************************************************************/
+int proc_pool_submit(ProcPool *pool, const char *input_dir, const char *output_dir, const char *filename,
+                     const struct timespec *arrival, long tag, long long cost);
+
+/******************************************************************************
+ * proc_pool_cancel()
+ *
+ * Arguments: pool - pointer to pool
+ *            tag - tag of the jobs to remove (< 0: every job)
+ * Returns: number of jobs removed
+ * Side-Effects: removes from the ring the jobs with this tag that no worker
+ *               took yet, keeping the order of the others
+ *
+ * Description: jobs already being processed are not stopped
+ *
+ *****************************************************************************/
+int proc_pool_cancel(ProcPool *pool, long tag);
+
+/******************************************************************************
+ * proc_pool_set_affinity()
+ *
+ * Arguments: pool - pointer to pool
+ *            window - jobs at the head of the ring a worker may look at
+ *                     (0 = plain FIFO)
+ * Returns: none
+ * Side-Effects: changes the order in which workers take jobs
+ *
+ * Description: each file has a preferred worker (hash of its path). A
+ *              worker takes the first of the next window jobs that is its
+ *              own, or the head if none is, so a file that comes back
+ *              usually lands on the process that already has it cached
+ *
+ *****************************************************************************/
+void proc_pool_set_affinity(ProcPool *pool, int window);
+
+/******************************************************************************
+ * proc_pool_print_statistics()
+ *
+ * Arguments: pool - pointer to pool
+ * Returns: none
+ * Side-Effects: writes to stdout
+ *
+ * Description: prints processed/failed counts and the average time
+ *
+ *****************************************************************************/
+void proc_pool_print_statistics(ProcPool *pool);
+
+/******************************************************************************
+ * proc_pool_finish()
+ *
+ * Arguments: pool - pointer to pool
+ * Returns: none
+ * Side-Effects: waits for every queued job and for all workers to exit
+ *
+ * Description: closes the ring, lets the workers drain it and collects them.
+ *              The statistics stay readable until proc_pool_destroy().
+ *
+ *****************************************************************************/
+void proc_pool_finish(ProcPool *pool);
+
+/******************************************************************************
+ * proc_pool_destroy()
+ *
+ * Arguments: pool - pointer to pool
+ * Returns: none
+ * Side-Effects: calls proc_pool_finish() if needed and frees the pool
+ *
+ * Description: releases the shared memory block
+ *
+ *****************************************************************************/
+void proc_pool_destroy(ProcPool *pool);
+
+#endif
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "shm-sink.h"
+
+#define MAX_PATH 4096
+
+// Consumidor de referencia do destino em memoria partilhada (-sink shm:NOME):
+// le os descritores por ordem, verifica cada JPEG e confirma-a para os
+// slots serem reaproveitados. Com -o tambem grava os ficheiros.
+
+// Uma JPEG completa comeca em FFD8 e acaba em FFD9
+static int valid_jpeg(const unsigned char *data, int length) {
+    return length >= 4 && data[0] == 0xFF && data[1] == 0xD8 &&
+           data[length - 2] == 0xFF && data[length - 1] == 0xD9;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Uso: %s <nome> [-o diretoria] [-q]\n", argv[0]);
+        fprintf(stderr, "Exemplo: %s fotos -o ./Result-shm\n", argv[0]);
+        exit(1);
+    }
+    const char *name = argv[1];
+    const char *output_dir = NULL;
+    int quiet = 0;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output_dir = argv[++i];
+        } else if (strcmp(argv[i], "-q") == 0) {
+            quiet = 1;
+        } else {
+            fprintf(stderr, "Erro: Opcao desconhecida %s\n", argv[i]);
+            exit(1);
+        }
+    }
+    if (output_dir) {
+        mkdir(output_dir, 0755);
+    }
+
+    // o produtor pode arrancar depois do consumidor
+    ShmSink *sink = shm_sink_open(name, 30);
+    if (!sink) {
+        exit(1);
+    }
+
+    ShmSinkDesc desc;
+    unsigned long results = 0, invalid = 0;
+    unsigned long long bytes = 0;
+
+    while (shm_sink_peek(sink, &desc)) {
+        const unsigned char *data = shm_sink_data(sink, &desc);
+        int ok = valid_jpeg(data, desc.length);
+
+        if (!quiet) {
+            printf("%lu %s %s %d bytes%s\n", desc.seq, desc.source, desc.transform,
+                   desc.length, ok ? "" : " (JPEG invalida)");
+        }
+        if (output_dir) {
+            char path[MAX_PATH];
+            snprintf(path, MAX_PATH, "%s/%s_%s", output_dir, desc.transform, desc.source);
+            FILE *fp = fopen(path, "wb");
+            if (!fp || fwrite(data, 1, desc.length, fp) != (size_t)desc.length) {
+                fprintf(stderr, "Erro ao escrever %s\n", path);
+            }
+            if (fp) {
+                fclose(fp);
+            }
+        }
+        results++;
+        invalid += !ok;
+        bytes += desc.length;
+
+        // so depois de usar os dados: os slots voltam ao produtor
+        shm_sink_ack(sink);
+    }
+
+    printf("=== Consumidor ===\n");
+    printf("Resultados: %lu (%.1f MB), invalidos: %lu\n", results, bytes / 1048576.0, invalid);
+    shm_sink_close(sink);
+    return invalid ? 2 : 0;
+}
@@ -0,0 +1,413 @@
+#include "shm-sink.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static void sink_lock(ShmSinkHeader *hdr) {
+    int r = pthread_mutex_lock(&hdr->mutex);
+#ifdef PTHREAD_MUTEX_ROBUST
+    if (r == EOWNERDEAD) {
+        pthread_mutex_consistent(&hdr->mutex);
+    }
+#else
+    (void)r;
+#endif
+}
+
+static void sink_wait(ShmSinkHeader *hdr) {
+    int r = pthread_cond_wait(&hdr->changed, &hdr->mutex);
+#ifdef PTHREAD_MUTEX_ROBUST
+    if (r == EOWNERDEAD) {
+        pthread_mutex_consistent(&hdr->mutex);
+    }
+#else
+    (void)r;
+#endif
+}
+
+static void sink_timedwait(ShmSinkHeader *hdr, int seconds) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += seconds;
+    int r = pthread_cond_timedwait(&hdr->changed, &hdr->mutex, &deadline);
+#ifdef PTHREAD_MUTEX_ROBUST
+    if (r == EOWNERDEAD) {
+        pthread_mutex_consistent(&hdr->mutex);
+    }
+#else
+    (void)r;
+#endif
+}
+
+// Espera (com o lock) que o consumidor faca alguma coisa. Devolve 0, e
+// marca o destino como abandonado, se o consumidor morreu ou se nao
+// confirmou nada em SHM_SINK_STALL_SECONDS; *acked e *since guardam o
+// ultimo progresso visto
+static int sink_wait_consumer(ShmSink *sink, unsigned long *acked, time_t *since) {
+    ShmSinkHeader *hdr = sink->hdr;
+    pid_t consumer = hdr->consumer;
+    const char *reason = NULL;
+
+    if (hdr->abandoned) {
+        return 0;
+    }
+    if (consumer > 0 && kill(consumer, 0) != 0 && errno == ESRCH) {
+        reason = "terminou";
+    } else if (hdr->acked != *acked) {
+        *acked = hdr->acked;
+        *since = time(NULL);
+    } else if (time(NULL) - *since >= SHM_SINK_STALL_SECONDS) {
+        reason = consumer > 0 ? "deixou de confirmar" : "nunca abriu o destino";
+    }
+    if (reason) {
+        fprintf(stderr, "O consumidor de %s %s: %d resultados por confirmar perdidos\n",
+                sink->name, reason, hdr->count);
+        hdr->abandoned = 1;
+        pthread_cond_broadcast(&hdr->changed);
+        return 0;
+    }
+    sink_timedwait(hdr, 1);
+    return 1;
+}
+
+// Objetos criados por este processo, apagados no exit() se ficarem abertos
+static struct {
+    char name[64];
+    pid_t pid;                    // os filhos de um fork() nao apagam
+} owned[SHM_SINK_MAX_OWNED];
+static pthread_mutex_t owned_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void unlink_owned_at_exit(void) {
+    for (int i = 0; i < SHM_SINK_MAX_OWNED; i++) {
+        if (owned[i].name[0] && owned[i].pid == getpid()) {
+            shm_unlink(owned[i].name);
+        }
+    }
+}
+
+static void set_owned(const char *name, int add) {
+    static int registered = 0;
+    pthread_mutex_lock(&owned_mutex);
+    if (!registered) {
+        atexit(unlink_owned_at_exit);
+        registered = 1;
+    }
+    for (int i = 0; i < SHM_SINK_MAX_OWNED; i++) {
+        if (add && !owned[i].name[0]) {
+            snprintf(owned[i].name, sizeof(owned[i].name), "%s", name);
+            owned[i].pid = getpid();
+            break;
+        }
+        if (!add && strcmp(owned[i].name, name) == 0 && owned[i].pid == getpid()) {
+            owned[i].name[0] = '\0';
+            break;
+        }
+    }
+    pthread_mutex_unlock(&owned_mutex);
+}
+
+// Primeiro bloco de n slots livres seguidos, ou -1
+static int find_free_slots(ShmSinkHeader *hdr, int n) {
+    int run = 0;
+    for (int i = 0; i < hdr->num_slots; i++) {
+        run = hdr->slot_busy[i] ? 0 : run + 1;
+        if (run == n) {
+            return i - n + 1;
+        }
+    }
+    return -1;
+}
+
+static size_t header_size(int num_slots) {
+    size_t size = sizeof(ShmSinkHeader) + num_slots;
+    return (size + 4095) & ~(size_t)4095;     // slab alinhado a pagina
+}
+
+
+/******************************************************************************
+ * shm_sink_create()
+ *
+ * Arguments: name - POSIX shared memory name (e.g. "/photos")
+ *            num_slots, slot_size - size of the slab
+ * Returns: sink, or NULL in case of failure
+ * Side-Effects: creates the shared memory object
+ *
+ *****************************************************************************/
+ShmSink *shm_sink_create(const char *name, int num_slots, int slot_size) {
+    ShmSink *sink = calloc(1, sizeof(ShmSink));
+    if (!sink) {
+        return NULL;
+    }
+    snprintf(sink->name, sizeof(sink->name), "%s%s", name[0] == '/' ? "" : "/", name);
+    sink->owner = 1;
+    sink->size = header_size(num_slots) + (size_t)num_slots * slot_size;
+
+    int fd = shm_open(sink->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("Erro no shm_open do destino");
+        free(sink);
+        return NULL;
+    }
+    if (ftruncate(fd, sink->size) != 0) {
+        perror("Erro no ftruncate do destino");
+        close(fd);
+        shm_unlink(sink->name);
+        free(sink);
+        return NULL;
+    }
+    sink->hdr = mmap(NULL, sink->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (sink->hdr == MAP_FAILED) {
+        perror("Erro no mmap do destino");
+        shm_unlink(sink->name);
+        free(sink);
+        return NULL;
+    }
+
+    ShmSinkHeader *hdr = sink->hdr;
+    memset(hdr, 0, header_size(num_slots));
+    hdr->num_slots = num_slots;
+    hdr->slot_size = slot_size;
+    hdr->slab_offset = header_size(num_slots);
+    sink->slab = (unsigned char *)hdr + hdr->slab_offset;
+
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+#ifdef PTHREAD_MUTEX_ROBUST
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+#endif
+    pthread_mutex_init(&hdr->mutex, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&hdr->changed, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    // so agora o consumidor pode confiar no cabecalho
+    __atomic_store_n(&hdr->magic, SHM_SINK_MAGIC, __ATOMIC_RELEASE);
+    set_owned(sink->name, 1);
+    return sink;
+}
+
+
+/******************************************************************************
+ * shm_sink_open()
+ *
+ * Arguments: name - name given to shm_sink_create()
+ *            wait_seconds - how long to wait for the producer to create it
+ * Returns: sink, or NULL in case of failure
+ * Side-Effects: maps the shared memory object
+ *
+ *****************************************************************************/
+ShmSink *shm_sink_open(const char *name, int wait_seconds) {
+    ShmSink *sink = calloc(1, sizeof(ShmSink));
+    if (!sink) {
+        return NULL;
+    }
+    snprintf(sink->name, sizeof(sink->name), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    // o produtor pode ainda nao ter criado (ou inicializado) o objeto
+    int fd = -1;
+    struct stat st;
+    for (int tries = 0; tries <= wait_seconds * 10; tries++) {
+        fd = shm_open(sink->name, O_RDWR, 0600);
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ShmSinkHeader)) {
+            sink->hdr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (sink->hdr != MAP_FAILED &&
+                __atomic_load_n(&sink->hdr->magic, __ATOMIC_ACQUIRE) == SHM_SINK_MAGIC) {
+                break;
+            }
+            if (sink->hdr != MAP_FAILED) {
+                munmap(sink->hdr, st.st_size);
+            }
+        }
+        sink->hdr = NULL;
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+        usleep(100000);
+    }
+    if (!sink->hdr) {
+        fprintf(stderr, "Destino %s nao existe\n", sink->name);
+        free(sink);
+        return NULL;
+    }
+    close(fd);
+    sink->size = st.st_size;
+    sink->slab = (unsigned char *)sink->hdr + sink->hdr->slab_offset;
+
+    // o produtor passa a poder ver se o consumidor ainda existe
+    sink_lock(sink->hdr);
+    sink->hdr->consumer = getpid();
+    pthread_cond_broadcast(&sink->hdr->changed);
+    pthread_mutex_unlock(&sink->hdr->mutex);
+    return sink;
+}
+
+
+/******************************************************************************
+ * shm_sink_put()
+ *
+ * Arguments: sink - sink
+ *            source - name of the source image
+ *            transform - name of the transformation
+ *            data, length - encoded JPEG
+ * Returns: (bool) 1 in case of success, 0 if it can never fit
+ * Side-Effects: blocks while there are no free slots or ring entries
+ *
+ *****************************************************************************/
+int shm_sink_put(ShmSink *sink, const char *source, const char *transform,
+                 const void *data, int length) {
+    ShmSinkHeader *hdr = sink->hdr;
+    int n = (length + hdr->slot_size - 1) / hdr->slot_size;
+    int first;
+    unsigned long acked;
+    time_t since = time(NULL);
+
+    if (n < 1) {
+        n = 1;
+    }
+    if (n > hdr->num_slots) {
+        return 0;
+    }
+
+    // reserva os slots; a copia e feita fora do lock
+    sink_lock(hdr);
+    acked = hdr->acked;
+    while ((first = find_free_slots(hdr, n)) < 0) {
+        if (!sink_wait_consumer(sink, &acked, &since)) {
+            pthread_mutex_unlock(&hdr->mutex);
+            return 0;
+        }
+    }
+    memset(&hdr->slot_busy[first], 1, n);
+    pthread_mutex_unlock(&hdr->mutex);
+
+    memcpy(sink->slab + (long)first * hdr->slot_size, data, length);
+
+    ShmSinkDesc desc;
+    memset(&desc, 0, sizeof(desc));
+    strncpy(desc.source, source, sizeof(desc.source) - 1);
+    strncpy(desc.transform, transform, sizeof(desc.transform) - 1);
+    desc.offset = (long)first * hdr->slot_size;
+    desc.length = length;
+    desc.first_slot = first;
+    desc.num_slots = n;
+
+    sink_lock(hdr);
+    acked = hdr->acked;
+    since = time(NULL);
+    while (hdr->count == SHM_SINK_RING) {
+        if (!sink_wait_consumer(sink, &acked, &since)) {
+            memset(&hdr->slot_busy[first], 0, n);
+            pthread_mutex_unlock(&hdr->mutex);
+            return 0;
+        }
+    }
+    desc.seq = hdr->published++;
+    hdr->ring[(hdr->head + hdr->count) % SHM_SINK_RING] = desc;
+    hdr->count++;
+    pthread_cond_broadcast(&hdr->changed);
+    pthread_mutex_unlock(&hdr->mutex);
+    return 1;
+}
+
+
+/******************************************************************************
+ * shm_sink_peek()
+ *
+ * Arguments: sink - sink
+ *            desc - where to copy the oldest descriptor
+ * Returns: (bool) 1 if there is one, 0 if the producer closed and
+ *          everything was acknowledged
+ * Side-Effects: blocks while the ring is empty
+ *
+ *****************************************************************************/
+int shm_sink_peek(ShmSink *sink, ShmSinkDesc *desc) {
+    ShmSinkHeader *hdr = sink->hdr;
+    sink_lock(hdr);
+    while (hdr->count == 0 && !hdr->closed) {
+        sink_wait(hdr);
+    }
+    int found = hdr->count > 0;
+    if (found) {
+        *desc = hdr->ring[hdr->head];
+    }
+    pthread_mutex_unlock(&hdr->mutex);
+    return found;
+}
+
+const void *shm_sink_data(ShmSink *sink, const ShmSinkDesc *desc) {
+    return sink->slab + desc->offset;
+}
+
+
+/******************************************************************************
+ * shm_sink_ack()
+ *
+ * Arguments: sink - sink
+ * Returns: none
+ * Side-Effects: removes the oldest descriptor and recycles its slots
+ *
+ *****************************************************************************/
+void shm_sink_ack(ShmSink *sink) {
+    ShmSinkHeader *hdr = sink->hdr;
+    sink_lock(hdr);
+    if (hdr->count > 0) {
+        ShmSinkDesc *desc = &hdr->ring[hdr->head];
+        memset(&hdr->slot_busy[desc->first_slot], 0, desc->num_slots);
+        hdr->head = (hdr->head + 1) % SHM_SINK_RING;
+        hdr->count--;
+        hdr->acked++;
+        pthread_cond_broadcast(&hdr->changed);
+    }
+    pthread_mutex_unlock(&hdr->mutex);
+}
+
+
+/******************************************************************************
+ * shm_sink_close()
+ *
+ * Arguments: sink - sink
+ * Returns: none
+ * Side-Effects: producer: marks the sink closed, waits until the consumer
+ *               acknowledged everything and removes the object;
+ *               consumer: only unmaps it
+ *
+ *****************************************************************************/
+void shm_sink_close(ShmSink *sink) {
+    ShmSinkHeader *hdr = sink->hdr;
+    if (sink->owner) {
+        sink_lock(hdr);
+        hdr->closed = 1;
+        pthread_cond_broadcast(&hdr->changed);
+        if (hdr->count > 0 && !hdr->abandoned) {
+            printf("A espera que o consumidor de %s confirme %d resultados\n",
+                   sink->name, hdr->count);
+            fflush(stdout);
+        }
+        unsigned long acked = hdr->acked;
+        time_t since = time(NULL);
+        while (hdr->count > 0) {
+            if (!sink_wait_consumer(sink, &acked, &since)) {
+                break;
+            }
+        }
+        pthread_mutex_unlock(&hdr->mutex);
+        shm_unlink(sink->name);
+        set_owned(sink->name, 0);
+    }
+    munmap(hdr, sink->size);
+    free(sink);
+}
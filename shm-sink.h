@@ -0,0 +1,147 @@
+#ifndef SHM_SINK_H
+#define SHM_SINK_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#define SHM_SINK_MAGIC 0x50505353       // "PPSS"
+#define SHM_SINK_RING 256               // descritores publicados e por confirmar
+#define SHM_SINK_DEFAULT_SLOTS 64
+#define SHM_SINK_DEFAULT_SLOT_SIZE (256 * 1024)
+#define SHM_SINK_STALL_SECONDS 30       // sem confirmacoes: o produtor desiste
+#define SHM_SINK_MAX_OWNED 4            // objetos apagados no exit() do produtor
+
+// Descritor de um resultado: onde esta a JPEG codificada dentro do slab
+typedef struct {
+    unsigned long seq;            // numero de ordem do resultado
+    char source[256];             // nome da imagem original
+    char transform[32];           // "contrast", "blur", "thumb2", ...
+    long offset;                  // em bytes desde o inicio do slab
+    int length;                   // bytes da JPEG
+    int first_slot, num_slots;    // slots ocupados (contiguos)
+} ShmSinkDesc;
+
+// Cabecalho no inicio do objeto de memoria partilhada; o slab vem depois
+typedef struct {
+    unsigned int magic;
+    pthread_mutex_t mutex;        // robusto e partilhado entre processos
+    pthread_cond_t changed;       // publicado, confirmado ou fechado
+    int num_slots;
+    int slot_size;
+    long slab_offset;             // inicio do slab no objeto
+    int head, count;              // descritores por confirmar
+    int closed;                   // o produtor ja nao publica mais nada
+    int abandoned;                // o produtor desistiu do consumidor
+    pid_t consumer;               // ultimo consumidor que abriu o objeto (0: nenhum)
+    unsigned long published, acked;
+    ShmSinkDesc ring[SHM_SINK_RING];
+    unsigned char slot_busy[];    // num_slots entradas
+} ShmSinkHeader;
+
+typedef struct {
+    char name[64];
+    ShmSinkHeader *hdr;
+    unsigned char *slab;
+    size_t size;
+    int owner;                    // 1 no produtor (apaga o objeto no fim)
+} ShmSink;
+
+
+/******************************************************************************
+ * shm_sink_create()
+ *
+ * Arguments: name - POSIX shared memory name (e.g. "/photos")
+ *            num_slots, slot_size - size of the slab
+ * Returns: sink, or NULL in case of failure
+ * Side-Effects: creates the shared memory object
+ *
+ * Description: producer side. Must be called before creating threads or
+ *              worker processes, which inherit the mapping. The object is
+ *              also removed if the producer calls exit() without closing
+ *              the sink.
+ *
+ *****************************************************************************/
+ShmSink *shm_sink_create(const char *name, int num_slots, int slot_size);
+
+/******************************************************************************
+ * shm_sink_open()
+ *
+ * Arguments: name - name given to shm_sink_create()
+ *            wait_seconds - how long to wait for the producer to create it
+ * Returns: sink, or NULL in case of failure
+ * Side-Effects: maps the shared memory object
+ *
+ * Description: consumer side
+ *
+ *****************************************************************************/
+ShmSink *shm_sink_open(const char *name, int wait_seconds);
+
+/******************************************************************************
+ * shm_sink_put()
+ *
+ * Arguments: sink - sink
+ *            source - name of the source image
+ *            transform - name of the transformation
+ *            data, length - encoded JPEG
+ * Returns: (bool) 1 in case of success, 0 if it can never fit or the
+ *          consumer is gone
+ * Side-Effects: blocks while there are no free slots or ring entries
+ *
+ * Description: copies the JPEG into contiguous free slots and publishes
+ *              its descriptor. If the consumer died, or acknowledged
+ *              nothing for SHM_SINK_STALL_SECONDS, the sink is abandoned
+ *              and every put fails at once
+ *
+ *****************************************************************************/
+int shm_sink_put(ShmSink *sink, const char *source, const char *transform,
+                 const void *data, int length);
+
+/******************************************************************************
+ * shm_sink_peek()
+ *
+ * Arguments: sink - sink
+ *            desc - where to copy the oldest descriptor
+ * Returns: (bool) 1 if there is one, 0 if the producer closed and
+ *          everything was acknowledged
+ * Side-Effects: blocks while the ring is empty
+ *
+ * Description: the descriptor stays in the ring until shm_sink_ack(), so a
+ *              consumer that dies halfway does not lose it
+ *
+ *****************************************************************************/
+int shm_sink_peek(ShmSink *sink, ShmSinkDesc *desc);
+
+/******************************************************************************
+ * shm_sink_data()
+ *
+ * Arguments: sink - sink
+ *            desc - descriptor returned by shm_sink_peek()
+ * Returns: pointer to the JPEG bytes inside the slab
+ *
+ *****************************************************************************/
+const void *shm_sink_data(ShmSink *sink, const ShmSinkDesc *desc);
+
+/******************************************************************************
+ * shm_sink_ack()
+ *
+ * Arguments: sink - sink
+ * Returns: none
+ * Side-Effects: removes the oldest descriptor and recycles its slots
+ *
+ *****************************************************************************/
+void shm_sink_ack(ShmSink *sink);
+
+/******************************************************************************
+ * shm_sink_close()
+ *
+ * Arguments: sink - sink
+ * Returns: none
+ * Side-Effects: producer: marks the sink closed, waits until the consumer
+ *               acknowledged everything (or died, or stalled for
+ *               SHM_SINK_STALL_SECONDS) and removes the object;
+ *               consumer: only unmaps it
+ *
+ *****************************************************************************/
+void shm_sink_close(ShmSink *sink);
+
+#endif
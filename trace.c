@@ -0,0 +1,230 @@
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+    const char *name;
+    unsigned long long start_ns;
+    unsigned long long dur_ns;
+    char detail[TRACE_DETAIL_LEN];
+} TraceEvent;
+
+// Anel de cada thread; so a propria thread escreve
+typedef struct TraceRing {
+    int tid;
+    char thread_name[64];
+    unsigned long long head;      // total de eventos escritos
+    TraceEvent *events;
+    struct TraceRing *next;
+} TraceRing;
+
+static int trace_on = 0;
+static int trace_capacity = TRACE_DEFAULT_EVENTS;
+static struct timespec trace_origin;
+static TraceRing *trace_rings = NULL;
+static int trace_next_tid = 0;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;   // so para registar aneis
+
+static __thread TraceRing *thread_ring = NULL;
+
+
+static unsigned long long now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (t.tv_sec - trace_origin.tv_sec) * 1000000000ULL + t.tv_nsec - trace_origin.tv_nsec;
+}
+
+static TraceRing *get_ring(void) {
+    if (thread_ring) {
+        return thread_ring;
+    }
+    TraceRing *ring = calloc(1, sizeof(TraceRing));
+    if (!ring) {
+        return NULL;
+    }
+    ring->events = calloc(trace_capacity, sizeof(TraceEvent));
+    if (!ring->events) {
+        free(ring);
+        return NULL;
+    }
+    pthread_mutex_lock(&trace_mutex);
+    ring->tid = trace_next_tid++;
+    snprintf(ring->thread_name, sizeof(ring->thread_name), "thread %d", ring->tid);
+    ring->next = trace_rings;
+    trace_rings = ring;
+    pthread_mutex_unlock(&trace_mutex);
+
+    thread_ring = ring;
+    return ring;
+}
+
+
+/******************************************************************************
+ * trace_enable()
+ *
+ * Arguments: events_per_thread - size of each thread's ring buffer
+ * Returns: none
+ * Side-Effects: from now on every thread that records a span gets a ring
+ *
+ *****************************************************************************/
+void trace_enable(int events_per_thread) {
+    if (events_per_thread > 0) {
+        trace_capacity = events_per_thread;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &trace_origin);
+    trace_on = 1;
+}
+
+int trace_enabled(void) {
+    return trace_on;
+}
+
+
+/******************************************************************************
+ * trace_thread_name()
+ *
+ * Arguments: fmt, ... - printf-like name for the calling thread
+ * Returns: none
+ *
+ *****************************************************************************/
+void trace_thread_name(const char *fmt, ...) {
+    if (!trace_on) {
+        return;
+    }
+    TraceRing *ring = get_ring();
+    if (!ring) {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(ring->thread_name, sizeof(ring->thread_name), fmt, ap);
+    va_end(ap);
+}
+
+
+/******************************************************************************
+ * trace_begin()
+ *
+ * Arguments: span - where to keep the start time
+ * Returns: none
+ *
+ *****************************************************************************/
+void trace_begin(TraceSpan *span) {
+    if (trace_on) {
+        span->start_ns = now_ns();
+    }
+}
+
+
+/******************************************************************************
+ * trace_end()
+ *
+ * Arguments: span - value filled by trace_begin()
+ *            name - event name (must be a string literal / static)
+ *            detail - optional text, may be NULL
+ * Returns: none
+ * Side-Effects: writes one event to the calling thread's ring, no locks
+ *
+ *****************************************************************************/
+void trace_end(TraceSpan *span, const char *name, const char *detail) {
+    if (!trace_on) {
+        return;
+    }
+    unsigned long long end = now_ns();
+    TraceRing *ring = get_ring();
+    if (!ring) {
+        return;
+    }
+
+    unsigned long long head = ring->head;
+    TraceEvent *ev = &ring->events[head % trace_capacity];
+    ev->name = name;
+    ev->start_ns = span->start_ns;
+    ev->dur_ns = end - span->start_ns;
+    if (detail) {
+        strncpy(ev->detail, detail, TRACE_DETAIL_LEN - 1);
+        ev->detail[TRACE_DETAIL_LEN - 1] = '\0';
+    } else {
+        ev->detail[0] = '\0';
+    }
+    // publica o evento so depois de estar completo
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+// Escreve uma string JSON (os nomes de ficheiro podem ter aspas)
+static void write_json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', fp);
+            fputc(*s, fp);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(fp, "\\u%04x", *s);
+        } else {
+            fputc(*s, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+/******************************************************************************
+ * trace_dump()
+ *
+ * Arguments: file_name - output file
+ * Returns: number of events written, or -1 in case of failure
+ * Side-Effects: creates the file
+ *
+ * Description: writes every ring as Chrome trace-event JSON
+ *
+ *****************************************************************************/
+int trace_dump(const char *file_name) {
+    FILE *fp = fopen(file_name, "w");
+    if (!fp) {
+        return -1;
+    }
+    int pid = (int)getpid();
+    int written = 0;
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&trace_mutex);
+    for (TraceRing *ring = trace_rings; ring; ring = ring->next) {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+                written ? "," : "", pid, ring->tid);
+        write_json_string(fp, ring->thread_name);
+        fprintf(fp, "}}\n");
+        written++;
+
+        // o dono pode estar a escrever: deixa uma margem para nao ler
+        // eventos a meio de serem reescritos
+        unsigned long long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        unsigned long long margin = trace_capacity > 64 ? 16 : 0;
+        unsigned long long first = head > trace_capacity - margin ? head - (trace_capacity - margin) : 0;
+
+        for (unsigned long long i = first; i < head; i++) {
+            TraceEvent ev = ring->events[i % trace_capacity];
+            fprintf(fp, ",{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                    ev.name, pid, ring->tid, ev.start_ns / 1000.0, ev.dur_ns / 1000.0);
+            if (ev.detail[0]) {
+                fprintf(fp, ",\"args\":{\"file\":");
+                write_json_string(fp, ev.detail);
+                fprintf(fp, "}");
+            }
+            fprintf(fp, "}\n");
+            written++;
+        }
+    }
+    pthread_mutex_unlock(&trace_mutex);
+
+    fprintf(fp, "]}\n");
+    if (fclose(fp) != 0) {
+        return -1;
+    }
+    return written;
+}
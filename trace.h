@@ -0,0 +1,81 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_DEFAULT_EVENTS 16384
+#define TRACE_DETAIL_LEN 64
+
+// Inicio de um intervalo (span) a registar
+typedef struct {
+    unsigned long long start_ns;
+} TraceSpan;
+
+
+/******************************************************************************
+ * trace_enable()
+ *
+ * Arguments: events_per_thread - size of each thread's ring buffer
+ * Returns: none
+ * Side-Effects: from now on every thread that records a span gets a ring
+ *
+ * Description: turns the tracer on. When a ring is full the oldest events
+ *              are overwritten.
+ *
+ *****************************************************************************/
+void trace_enable(int events_per_thread);
+
+/******************************************************************************
+ * trace_enabled()
+ *
+ * Returns: (bool) 1 if trace_enable() was called
+ *
+ *****************************************************************************/
+int trace_enabled(void);
+
+/******************************************************************************
+ * trace_thread_name()
+ *
+ * Arguments: fmt, ... - printf-like name for the calling thread
+ * Returns: none
+ * Side-Effects: none if the tracer is off
+ *
+ * Description: name shown for this thread's track in the viewer
+ *
+ *****************************************************************************/
+void trace_thread_name(const char *fmt, ...);
+
+/******************************************************************************
+ * trace_begin()
+ *
+ * Arguments: span - where to keep the start time
+ * Returns: none
+ *
+ *****************************************************************************/
+void trace_begin(TraceSpan *span);
+
+/******************************************************************************
+ * trace_end()
+ *
+ * Arguments: span - value filled by trace_begin()
+ *            name - event name (must be a string literal / static)
+ *            detail - optional text (e.g. the file name), may be NULL
+ * Returns: none
+ * Side-Effects: writes one event to the calling thread's ring, no locks
+ *
+ *****************************************************************************/
+void trace_end(TraceSpan *span, const char *name, const char *detail);
+
+/******************************************************************************
+ * trace_dump()
+ *
+ * Arguments: file_name - output file
+ * Returns: number of events written, or -1 in case of failure
+ * Side-Effects: creates the file
+ *
+ * Description: writes every ring as Chrome trace-event JSON ("X" events,
+ *              microseconds), loadable in chrome://tracing or Perfetto.
+ *              May be called while threads keep recording.
+ *
+ *****************************************************************************/
+int trace_dump(const char *file_name);
+
+#endif